@@ -0,0 +1,114 @@
+#ifndef DEFLATEENCODER_H
+#define DEFLATEENCODER_H
+
+#include "fluenthttp.h"
+
+// log2 of the history repeats are searched in, 9..15. The encoder holds twice the window
+#ifndef FLUENTHTTP_DEFLATE_WINDOW_BITS
+  #define FLUENTHTTP_DEFLATE_WINDOW_BITS 10
+#endif
+
+// log2 of the entries of the match table, 4 bytes each
+#ifndef FLUENTHTTP_DEFLATE_HASH_BITS
+  #define FLUENTHTTP_DEFLATE_HASH_BITS 8
+#endif
+
+// input bytes per deflate block. A coded block is held until it ended, about 9/8 of this,
+// and goes out stored instead when that is smaller
+#ifndef FLUENTHTTP_DEFLATE_BLOCK_SIZE
+  #define FLUENTHTTP_DEFLATE_BLOCK_SIZE 512
+#endif
+
+// gzip or zlib ("deflate") compressed body, produced while it is sent: the content is pulled
+// from memory or another body source through a fixed window and written as deflate blocks
+// with the fixed huffman code, so memory stays bounded whatever the content size. Blocks the
+// code would grow, e.g. of already compressed data, are stored as they are.
+// Repeats are found through a one-entry hash table, enough for the repetitive JSON and text
+// bodies devices send. The size is unknown up front, the body is sent chunked.
+//
+//   DeflateEncoder gzip;
+//   gzip.begin((const uint8_t*)json, strlen(json));
+//   request.addHeader("Content-Encoding", gzip.contentEncoding()).fireContent(gzip);
+//
+// ServiceEndpoint::withCompression() does the same for all request bodies.
+class DeflateEncoder : public ServiceBodySource {
+    private:
+        static const size_t WINDOW = 1u << FLUENTHTTP_DEFLATE_WINDOW_BITS;
+        static const size_t BLOCK = FLUENTHTTP_DEFLATE_BLOCK_SIZE;
+
+        service_content_coding_t _coding;
+        const uint8_t* _data = nullptr;
+        size_t _dataLength = 0;
+        ServiceBodySource* _source = nullptr;
+        bool _ended = false;
+        bool _mismatched = false;
+
+        uint8_t _buffer[2 * WINDOW];
+        uint32_t _bufferStart = 0;  // stream position of _buffer[0]
+        uint32_t _fill = 0;         // stream position behind the buffered input
+        uint32_t _pos = 0;          // next position to encode
+        uint32_t _table[1u << FLUENTHTTP_DEFLATE_HASH_BITS]; // last position + 1 of each hash
+
+        uint32_t _blockStart = 0;   // stream position of the first input byte of the open block
+        uint8_t _out[(9 * BLOCK + 64) / 8]; // the open block once coded, or the head of a stored one
+        size_t _outLength = 0;
+        size_t _outPos = 0;
+
+        uint64_t _bits = 0;
+        uint8_t _bitCount = 0;
+        uint64_t _blockBits = 0;    // bits and count before the block header, taken back for a stored block
+        uint8_t _blockBitCount = 0;
+        uint8_t _state = 0;
+        uint8_t _frame[10];         // gzip/zlib header or trailer
+        uint8_t _frameLength = 0;
+        uint8_t _framePos = 0;
+
+        uint32_t _crc = 0;
+        uint32_t _adler = 1;
+        uint32_t _produced = 0;
+
+        void reset();
+        void fill();
+        void encode();
+        void openBlock();
+        void endBlock(bool final);
+        void putBits(uint32_t value, uint8_t count) {
+            _bits |= (uint64_t)value << _bitCount;
+            _bitCount += count;
+        }
+        // whole bytes go to the block output, less than one stays
+        void flushBits() {
+            while (_bitCount >= 8) {
+                _out[_outLength++] = (uint8_t)_bits;
+                _bits >>= 8;
+                _bitCount -= 8;
+            }
+        }
+        void putCode(uint16_t symbol);
+        void putMatch(uint16_t length, uint16_t distance);
+        void checksum(const uint8_t* data, size_t length);
+        void writeHeader();
+        void writeTrailer();
+    public:
+        DeflateEncoder(service_content_coding_t coding = sccGzip) : _coding(coding) {}
+
+        // compresses length bytes from memory, they must stay valid until the body was sent
+        void begin(const uint8_t* data, size_t length);
+        // compresses the bytes of another body source
+        void begin(ServiceBodySource& source);
+        void withCoding(service_content_coding_t coding) { _coding = coding; }
+        service_content_coding_t coding() const { return _coding; }
+        // value of the Content-Encoding header
+        const char* contentEncoding() const { return _coding == sccDeflate ? "deflate" : "gzip"; }
+
+        // bytes taken in and put out since begin()
+        uint32_t consumed() const { return _fill; }
+        uint32_t produced() const { return _produced; }
+        // whether the source ended before or ran past the size it declared, known once it was read
+        bool mismatched() const { return _mismatched; }
+
+        long size() { return -1; }
+        size_t read(uint8_t* buffer, size_t length);
+};
+
+#endif /* DEFLATEENCODER_H */
@@ -0,0 +1,114 @@
+#ifndef JSONREADER_H
+#define JSONREADER_H
+
+#include "fluenthttp.h"
+
+// max. nesting of objects and arrays, at most 31
+#ifndef FLUENTHTTP_JSON_DEPTH
+  #define FLUENTHTTP_JSON_DEPTH 8
+#endif
+
+// max. length of the path of a value, e.g. "data.items[12].name", at most 255
+#ifndef FLUENTHTTP_JSON_PATH_SIZE
+  #define FLUENTHTTP_JSON_PATH_SIZE 96
+#endif
+
+// bytes read from the stream at once, at most 255
+#ifndef FLUENTHTTP_JSON_READ_SIZE
+  #define FLUENTHTTP_JSON_READ_SIZE 32
+#endif
+
+enum json_token_t {
+    jtNone = 0,
+    jtBeginObject = 1,
+    jtEndObject = 2,
+    jtBeginArray = 3,
+    jtEndArray = 4,
+    jtKey = 5,      // value() is the key, path() already the one of its value
+    jtString = 6,
+    jtNumber = 7,   // value() is the number as written
+    jtTrue = 8,
+    jtFalse = 9,
+    jtNull = 10,
+    jtEnd = 11,     // the root value is complete
+    jtError = 12    // malformed json, nesting too deep or the stream ended early
+};
+
+// pull tokenizer reading json straight from a stream, no DOM is built and nothing is allocated.
+// String and number values are copied into caller provided storage, longer ones are cut
+// (see truncated()). Every token knows the path of its value, so single fields can be
+// picked out of large responses while they are read:
+//
+//   char value[32];
+//   JsonReader json(response, value, sizeof(value));
+//   if (json.find("data.items[0].name")) Serial.println(json.value());
+class JsonReader {
+    private:
+        Stream* _stream;
+        service_response_t* _response = nullptr; // set for chunked content
+        long _left;             // bytes left in the content or the current chunk, -1 = until the stream ends
+        bool _ended = false;
+
+        uint8_t _buf[FLUENTHTTP_JSON_READ_SIZE];
+        uint8_t _pos = 0;
+        uint8_t _fill = 0;
+        int _peek = -1;
+
+        char* _value;
+        size_t _capacity;
+        size_t _length = 0;
+        bool _truncated = false;
+
+        json_token_t _token = jtNone;
+        uint8_t _expect;
+        uint8_t _depth = 0;
+        uint32_t _arrays = 0;   // bit d set if the container at depth d is an array
+
+        char _path[FLUENTHTTP_JSON_PATH_SIZE];
+        uint8_t _pathLength = 0;
+        uint8_t _base[FLUENTHTTP_JSON_DEPTH + 1];       // path length of the container at each depth
+        uint16_t _index[FLUENTHTTP_JSON_DEPTH + 1];     // next element index of arrays
+        uint8_t _overflowDepth = 0;                     // path did not fit from this depth on, 0 = fits
+
+        bool fill();
+        int get();
+        int skipSpace();
+        bool inArray() const { return _depth > 0 && (_arrays & (1u << _depth)) != 0; }
+        void setPath(const char* segment, size_t length, bool index);
+        void putValue(char c);
+        void putCodepoint(uint32_t codepoint);
+        long readHex();
+        json_token_t fail();
+        json_token_t begin(bool array);
+        json_token_t end();
+        json_token_t readString(json_token_t token);
+        json_token_t readNumber(int first);
+        json_token_t readLiteral(int first);
+        json_token_t scalar(json_token_t token);
+    public:
+        // reads at most length bytes, -1 until the stream ends
+        JsonReader(Stream& stream, char* buffer, size_t capacity, long length = -1);
+        // reads the content of a response, plain or chunked
+        JsonReader(service_response_t& response, char* buffer, size_t capacity);
+
+        json_token_t next();
+        // reads on until the value at path starts, true if found. Paths read like "a.b[2].c",
+        // "" is the root value. Values are visited in document order only
+        bool find(const char* path);
+        // reads on behind the object or array that just began
+        void skip();
+
+        json_token_t token() const { return _token; }
+        // cut if longer than FLUENTHTTP_JSON_PATH_SIZE, find() never matches such values
+        const char* path() const { return _path; }
+        uint8_t depth() const { return _depth; }
+
+        const char* value() const { return _value; }
+        size_t valueLength() const { return _length; }
+        bool truncated() const { return _truncated; }
+        long asLong() const { return strtol(_value, nullptr, 10); }
+        double asDouble() const { return strtod(_value, nullptr); }
+        bool asBool() const { return _token == jtTrue; }
+};
+
+#endif /* JSONREADER_H */
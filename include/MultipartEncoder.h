@@ -0,0 +1,69 @@
+#ifndef MULTIPARTENCODER_H
+#define MULTIPARTENCODER_H
+
+#include "fluenthttp.h"
+
+// max. number of parts of a form
+#ifndef FLUENTHTTP_MULTIPART_PARTS
+  #define FLUENTHTTP_MULTIPART_PARTS 8
+#endif
+
+struct multipart_part_t {
+    const char* name;
+    const char* filename;       // nullptr for plain fields
+    const char* contentType;    // nullptr to leave it out
+    const uint8_t* data;        // content from memory, or
+    Stream* stream;             // content from a stream
+    long length;                // -1 if unknown
+};
+
+// multipart/form-data body that is produced while it is sent: boundaries and part headers
+// are generated on the fly and part content is copied straight from memory or a Stream,
+// so no part of the form is ever built in RAM. All strings, buffers and streams passed in
+// must stay valid until the request finished. Streams of unknown length end once no byte
+// arrived within their timeout (Stream::setTimeout()), a form containing one is sent chunked.
+// Quotes and line breaks in names and filenames are sent percent-encoded.
+//
+//   MultipartEncoder form;
+//   form.addField("device", "sensor-7").addFile("log", "log.txt", "text/plain", file, file.size());
+//   endpoint.post("/upload", request);
+//   request.addHeader("Content-Type", form.contentType()).fireContent(form);
+class MultipartEncoder : public ServiceBodySource {
+    private:
+        multipart_part_t _parts[FLUENTHTTP_MULTIPART_PARTS];
+        uint8_t _count = 0;
+        bool _failed = false;
+        char _boundary[31];
+        char _contentType[62];
+
+        // read position
+        uint8_t _part = 0;
+        uint8_t _fragment = 0;
+        size_t _offset = 0;
+
+        MultipartEncoder& add(const multipart_part_t& part);
+        const char* fragment(uint8_t part, uint8_t index) const;
+        size_t fragmentLength(uint8_t part, uint8_t index) const;
+        size_t readContent(multipart_part_t& part, uint8_t* buffer, size_t length);
+    public:
+        MultipartEncoder();
+
+        MultipartEncoder& addField(const char* name, const char* value);
+        MultipartEncoder& addFile(const char* name, const char* filename, const char* contentType,
+            const uint8_t* data, size_t length);
+        MultipartEncoder& addFile(const char* name, const char* filename, const char* contentType,
+            Stream& stream, long length = -1);
+
+        // value of the Content-Type header, including the boundary
+        const char* contentType() const { return _contentType; }
+        const char* boundary() const { return _boundary; }
+        // false if more than FLUENTHTTP_MULTIPART_PARTS parts were added
+        bool ok() const { return !_failed; }
+        // starts over, only meaningful if no part is read from a stream
+        void rewind();
+
+        long size();
+        size_t read(uint8_t* buffer, size_t length);
+};
+
+#endif /* MULTIPARTENCODER_H */
@@ -0,0 +1,128 @@
+#ifndef SERVICEBATCH_H
+#define SERVICEBATCH_H
+
+#include "fluenthttp.h"
+
+// max. number of requests of a batch
+#ifndef FLUENTHTTP_BATCH_SIZE
+  #define FLUENTHTTP_BATCH_SIZE 16
+#endif
+
+// heads and bodies of consecutive requests are collected here and written at once
+#ifndef FLUENTHTTP_BATCH_BUFFER_SIZE
+  #define FLUENTHTTP_BATCH_BUFFER_SIZE 1024
+#endif
+
+// requests sent ahead of their responses over a keep-alive connection
+#ifndef FLUENTHTTP_BATCH_PIPELINE
+  #define FLUENTHTTP_BATCH_PIPELINE 4
+#endif
+
+struct service_batch_item_t {
+    const char* method;
+    const char* uri;
+    const char* contentType;    // nullptr to leave it out
+    const uint8_t* content;
+    size_t contentLength;
+
+    // result, valid once the batch finished
+    uint16_t statusCode;        // 0 if no response was read
+    const char* error;          // why no response was read, nullptr otherwise
+    uint8_t sends;              // times the request was written
+    bool done;
+    #if FLUENTHTTP_METRICS
+    service_request_timing_t timing;
+    #endif
+
+    bool ok() const { return error == nullptr && statusCode >= 200 && statusCode < 400; }
+};
+
+class ServiceBatch;
+typedef std::function<void (ServiceBatch&)> service_batch_callback_t;
+
+// prepared requests sent to one endpoint under a single lock, see ServiceEndpoint::fire().
+// The requests share one connection: on keep-alive endpoints up to the pipelining depth
+// of them are written ahead of their responses, heads and bodies are coalesced into few
+// writes. Responses are read in order and their content is skipped, only the status is
+// kept. If the connection drops, requests that were not sent yet go out on a new one,
+// sent GETs are repeated once and sent POSTs or PATCHes fail. All strings and contents must
+// stay valid until the batch finished.
+//
+//   ServiceBatch batch;
+//   batch.post("/telemetry", sample1, n1, "application/json").post("/telemetry", sample2, n2);
+//   batch.onComplete([](ServiceBatch& b) { Serial.println(b.succeeded()); });
+//   if (endpoint.fire(batch)) batch.await();
+class ServiceBatch {
+    friend class ServiceEndpoint;
+    private:
+        service_batch_item_t _items[FLUENTHTTP_BATCH_SIZE];
+        uint8_t _count = 0;
+        bool _overflow = false;
+        service_batch_callback_t _completeCallback = 0;
+        uint32_t _timeout = 1000;
+        uint8_t _pipeline = FLUENTHTTP_BATCH_PIPELINE;
+
+        ServiceEndpoint* _endpoint = nullptr;
+        Client* _client = nullptr;
+        bool _active = false;
+        bool _finished = false;
+        bool _reconnect = false;
+        uint8_t _next = 0;          // next item to send
+        uint8_t _answered = 0;      // oldest item waiting for its response
+        uint8_t _inflight = 0;
+        unsigned long _t0 = 0;
+
+        uint8_t _buffer[FLUENTHTTP_BATCH_BUFFER_SIZE];
+        size_t _bufferLength = 0;
+
+        // response of the oldest item
+        uint8_t _readState = 0;
+        uint16_t _statusCode = 0;
+        uint32_t _contentLeft = 0;
+        bool _chunked = false;
+        bool _close = false;
+
+        uint8_t pending(uint8_t index) const;
+        void markTiming(service_batch_item_t& item, service_timing_point_t point);
+        void start(ServiceEndpoint& endpoint);
+        void sendAhead();
+        bool serialize(service_batch_item_t& item);
+        bool write(const void* data, size_t length);
+        bool flush();
+        bool readResponse();
+        bool readResponses();
+        bool skipContent();
+        void resetResponse();
+        void dropConnection(const char* error);
+        void settle(service_batch_item_t& item, uint16_t statusCode, const char* error);
+        void finish();
+    public:
+        ServiceBatch() {}
+
+        ServiceBatch& add(const char* method, const char* relativeUri, const uint8_t* content = nullptr,
+            size_t length = 0, const char* contentType = nullptr);
+        ServiceBatch& get(const char* relativeUri) { return add("GET", relativeUri); }
+        ServiceBatch& post(const char* relativeUri, const uint8_t* content, size_t length,
+            const char* contentType = nullptr) { return add("POST", relativeUri, content, length, contentType); }
+
+        ServiceBatch& onComplete(service_batch_callback_t callback) { _completeCallback = callback; return *this; }
+        // max. ms without progress while waiting for a response
+        ServiceBatch& withTimeout(uint32_t timeout) { _timeout = timeout; return *this; }
+        // requests written ahead of their responses, 1 waits for each response before sending on
+        ServiceBatch& withPipelining(uint8_t depth) { _pipeline = depth > 0 ? depth : 1; return *this; }
+        // removes all requests, the batch can be filled and fired again
+        void clear();
+
+        // false if more than FLUENTHTTP_BATCH_SIZE requests were added
+        bool ok() const { return !_overflow; }
+        uint8_t size() const { return _count; }
+        const service_batch_item_t& item(uint8_t index) const { return _items[index]; }
+        uint8_t succeeded() const;
+
+        bool yield();
+        void await();
+        bool finished() const { return _finished; }
+        bool active() const { return _active; }
+};
+
+#endif /* SERVICEBATCH_H */
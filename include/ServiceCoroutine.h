@@ -0,0 +1,195 @@
+#ifndef SERVICECOROUTINE_H
+#define SERVICECOROUTINE_H
+
+#include "fluenthttp.h"
+#include <stddef.h>
+#include <exception>
+#include <type_traits>
+#include <utility>
+
+// fixed-size block pool for coroutine frames, so awaiting requests does not hit the heap.
+// Awaited requests come from the request pool of their endpoint, a frame holds handles only.
+// Not thread safe, use one pool per task
+class ServiceFramePool {
+    private:
+        struct free_block_t { free_block_t* next; };
+        uint8_t* _storage;
+        size_t _blockSize;
+        size_t _blockCount;
+        free_block_t* _free = nullptr;
+        size_t _used = 0;
+    public:
+        // storage must be blockSize * blockCount bytes, aligned for max_align_t. Blocks keep that
+        // alignment, blockSize is rounded down to a multiple of alignof(max_align_t)
+        ServiceFramePool(void* storage, size_t blockSize, size_t blockCount);
+
+        // nullptr if size exceeds the block size or all blocks are in use
+        void* allocate(size_t size);
+        void release(void* block);
+
+        size_t blockSize() const { return _blockSize; }
+        size_t used() const { return _used; }
+        size_t capacity() const { return _blockCount; }
+
+        // header placed in front of every frame to find the owning pool on release,
+        // frames with a null pool come from the heap
+        struct frame_header_t {
+            ServiceFramePool* pool;
+            alignas(max_align_t) uint8_t frame[1];
+        };
+        static constexpr size_t frameOffset = offsetof(frame_header_t, frame);
+
+        static void* allocateFrame(ServiceFramePool* pool, size_t size);
+        static void releaseFrame(void* frame);
+        // pool used for coroutines that do not take a ServiceFramePool& as first argument,
+        // falls back to the heap when unset
+        static void setDefault(ServiceFramePool* pool);
+        static ServiceFramePool* getDefault();
+};
+
+template <size_t BlockSize, size_t BlockCount>
+class StaticServiceFramePool : public ServiceFramePool {
+    private:
+        // rounded up, so every block holds BlockSize bytes
+        static constexpr size_t BLOCK = (BlockSize + alignof(max_align_t) - 1) / alignof(max_align_t) * alignof(max_align_t);
+        alignas(max_align_t) uint8_t _blocks[BLOCK * BlockCount];
+    public:
+        StaticServiceFramePool() : ServiceFramePool(_blocks, BLOCK, BlockCount) {}
+};
+
+#if defined(__cpp_impl_coroutine)
+#include <coroutine>
+
+// result of co_await endpoint.get(...), available after the request finished
+struct service_result_t {
+    service_request_status_t status = srsUninitialized; // srsCompleted or srsFailed
+    bool timedOut = false;
+    service_response_t response;    // contentReader is not valid anymore
+    size_t contentRead = 0;         // bytes copied into the buffer passed to withContent()
+
+    bool ok() const { return status == srsCompleted; }
+};
+
+class ServiceScheduler;
+
+// single request awaited by a coroutine. The endpoint lock is acquired without blocking,
+// the coroutine is resumed by ServiceScheduler::poll() once the request finished. The request
+// takes a slot of the endpoint's request pool until then, see ServiceEndpoint::withRequestPool()
+class ServiceAwaitable {
+    friend class ServiceScheduler;
+    private:
+        ServiceEndpoint* _endpoint;
+        const char* _method;
+        const char* _relativeUri;
+        uint8_t* _body = nullptr;
+        size_t _bodyLength = 0;
+        uint32_t _timeout = 1000;
+        char* _buffer = nullptr;
+        size_t _bufferSize = 0;
+        long _t0 = 0;
+
+        ServiceRequestHandle _request;
+        service_result_t _result;
+        std::coroutine_handle<> _continuation;
+        ServiceScheduler* _scheduler = nullptr;
+        ServiceAwaitable* _next = nullptr;
+        bool _started = false;
+
+        bool tryStart();
+        bool step();
+        void suspend(std::coroutine_handle<> continuation);
+        void captureResponse(service_request_status_t status, service_response_t r);
+    public:
+        ServiceAwaitable(ServiceEndpoint* endpoint, const char* method, const char* relativeUri,
+            uint8_t* body = nullptr, size_t bodyLength = 0);
+        // only valid before the awaitable is suspended on
+        ServiceAwaitable(ServiceAwaitable&& other);
+        ServiceAwaitable(const ServiceAwaitable&) = delete;
+        ServiceAwaitable& operator=(const ServiceAwaitable&) = delete;
+        ~ServiceAwaitable();
+
+        // the request timeout also limits the time spent waiting for the endpoint lock
+        ServiceAwaitable& withTimeout(uint32_t timeout) & { _timeout = timeout; return *this; }
+        ServiceAwaitable&& withTimeout(uint32_t timeout) && { return std::move(withTimeout(timeout)); }
+        // content is copied into buffer as it arrives, the coroutine resumes once it is complete
+        // or the buffer is full
+        ServiceAwaitable& withContent(char* buffer, size_t size) & { _buffer = buffer; _bufferSize = size; return *this; }
+        ServiceAwaitable&& withContent(char* buffer, size_t size) && { return std::move(withContent(buffer, size)); }
+        ServiceAwaitable& on(ServiceScheduler& scheduler) & { _scheduler = &scheduler; return *this; }
+        ServiceAwaitable&& on(ServiceScheduler& scheduler) && { return std::move(on(scheduler)); }
+
+        bool await_ready() { return false; }
+        template <typename Promise>
+        void await_suspend(std::coroutine_handle<Promise> continuation);
+        service_result_t await_resume() { return _result; }
+};
+
+// drives awaited requests and resumes their coroutines, poll() it from the loop of the
+// task the coroutines run on. Requests on an endpoint with a ServiceWorker are dispatched here too
+class ServiceScheduler {
+    friend class ServiceAwaitable;
+    friend class ServiceTask;
+    private:
+        ServiceAwaitable* _head = nullptr;
+        // thrown out of a ServiceTask, rethrown by the next poll()
+        std::exception_ptr _escaped;
+
+        void add(ServiceAwaitable* awaitable);
+        void remove(ServiceAwaitable* awaitable);
+        void rethrowEscaped();
+    public:
+        // returns the number of resumed coroutines. Rethrows an exception a ServiceTask did not
+        // catch, the task itself has ended then
+        int poll();
+        bool idle() { return _head == nullptr; }
+
+        static ServiceScheduler& global();
+};
+
+// fire-and-forget coroutine type. Frames come from the ServiceFramePool passed as first
+// argument, the default pool or the heap. Evaluates to false if no frame could be allocated.
+// An exception leaving the coroutine ends it and is rethrown by the next poll() of the scheduler
+// it last awaited a request on, of ServiceScheduler::global() if it threw before its first co_await
+class ServiceTask {
+    private:
+        bool _started;
+    public:
+        struct promise_type {
+            ServiceTask get_return_object() { return ServiceTask(true); }
+            static ServiceTask get_return_object_on_allocation_failure() { return ServiceTask(false); }
+            std::suspend_never initial_suspend() noexcept { return {}; }
+            std::suspend_never final_suspend() noexcept { return {}; }
+            // set by every co_await on a request
+            ServiceScheduler* scheduler = nullptr;
+
+            void return_void() {}
+            void unhandled_exception() {
+                (scheduler != nullptr ? *scheduler : ServiceScheduler::global())._escaped = std::current_exception();
+            }
+
+            static void* operator new(size_t size) noexcept {
+                return ServiceFramePool::allocateFrame(ServiceFramePool::getDefault(), size);
+            }
+            template <typename... Args>
+            static void* operator new(size_t size, ServiceFramePool& pool, Args&...) noexcept {
+                return ServiceFramePool::allocateFrame(&pool, size);
+            }
+            static void operator delete(void* frame) noexcept {
+                ServiceFramePool::releaseFrame(frame);
+            }
+        };
+
+        explicit ServiceTask(bool started) : _started(started) {}
+        operator bool() const { return _started; }
+};
+
+template <typename Promise>
+void ServiceAwaitable::await_suspend(std::coroutine_handle<Promise> continuation) {
+    suspend(continuation);
+    if constexpr (std::is_same<Promise, ServiceTask::promise_type>::value)
+        continuation.promise().scheduler = _scheduler;
+}
+
+#endif /* __cpp_impl_coroutine */
+
+#endif /* SERVICECOROUTINE_H */
@@ -0,0 +1,97 @@
+#ifndef SERVICEEVENTSTREAM_H
+#define SERVICEEVENTSTREAM_H
+
+#include "fluenthttp.h"
+
+// max. data of a single event including the terminator, longer data is cut
+#ifndef FLUENTHTTP_EVENT_DATA_SIZE
+  #define FLUENTHTTP_EVENT_DATA_SIZE 256
+#endif
+
+// max. length of event type and id including the terminator
+#ifndef FLUENTHTTP_EVENT_NAME_SIZE
+  #define FLUENTHTTP_EVENT_NAME_SIZE 32
+#endif
+
+// bytes read from the client at once while streaming
+#ifndef FLUENTHTTP_EVENT_READ_SIZE
+  #define FLUENTHTTP_EVENT_READ_SIZE 64
+#endif
+
+struct service_event_t {
+    const char* event;      // "message" unless the server named it
+    const char* data;       // data lines joined with '\n'
+    size_t dataLength;
+    const char* id;         // last event id, "" if none was sent yet
+    bool truncated;         // data did not fit into FLUENTHTTP_EVENT_DATA_SIZE
+};
+
+typedef std::function<void (const service_event_t&)> service_event_callback_t;
+
+// text/event-stream parser for long-lived responses, see ServiceRequest::withEventStream().
+// Events are parsed from the content as it arrives and delivered to the callback from
+// yield(), nothing is allocated. The last event id and the reconnect delay survive
+// reconnects, so a stream object can also be reused for a later request. The id of an
+// event only becomes the last event id once the event is complete.
+class ServiceEventStream {
+    friend class ServiceRequest;
+    private:
+        service_event_callback_t _callback;
+        uint32_t _idleTimeout = 0;
+        uint32_t _reconnectDelay = 3000;
+        bool _opened = false;       // a response was streamed once, disconnects reconnect
+        bool _closed = false;       // the request finished, pending events are dropped
+
+        // chunked transfer coding
+        bool _chunked = false;
+        uint8_t _chunkState = 0;
+        uint32_t _chunkLeft = 0;
+
+        // line parser
+        uint8_t _state = 0;
+        bool _cr = false;
+        char _field[6];
+        uint8_t _fieldLength = 0;   // > sizeof(_field) for unknown fields
+        uint8_t _target = 0;        // field the current value belongs to
+        uint32_t _retry = 0;
+        uint8_t _retryDigits = 0;
+        bool _retryValid = false;
+
+        char _data[FLUENTHTTP_EVENT_DATA_SIZE];
+        size_t _dataLength = 0;
+        bool _truncated = false;
+        char _event[FLUENTHTTP_EVENT_NAME_SIZE];
+        uint8_t _eventLength = 0;
+        char _id[FLUENTHTTP_EVENT_NAME_SIZE];          // last event id, taken over on dispatch
+        char _idBuffer[FLUENTHTTP_EVENT_NAME_SIZE];    // id of the event being parsed
+        uint8_t _idLength = 0;
+
+        void parse(const uint8_t* data, size_t length);
+        void endField();
+        void endLine();
+        void putValue(char c);
+        void dispatch();
+        void close() { _opened = false; _closed = true; }
+    public:
+        ServiceEventStream(service_event_callback_t callback);
+
+        // reconnects once no byte arrived for ms, independent of the request timeout. 0 = never
+        ServiceEventStream& withIdleTimeout(uint32_t ms) { _idleTimeout = ms; return *this; }
+        // delay before reconnecting, replaced by the "retry" field of the server
+        ServiceEventStream& withReconnectDelay(uint32_t ms) { _reconnectDelay = ms; return *this; }
+        // resumes from an id stored earlier, sent as Last-Event-ID
+        ServiceEventStream& withLastEventId(const char* id);
+
+        uint32_t idleTimeout() const { return _idleTimeout; }
+        uint32_t reconnectDelay() const { return _reconnectDelay; }
+        const char* lastEventId() const { return _id; }
+        bool opened() const { return _opened; }
+
+        // starts the content of a new response, events of an interrupted one are dropped
+        void begin(bool chunked);
+        // parses content bytes and delivers the complete events, false once the
+        // chunked content ended or is malformed
+        bool feed(const uint8_t* data, size_t length);
+};
+
+#endif /* SERVICEEVENTSTREAM_H */
@@ -0,0 +1,88 @@
+#ifndef SERVICEMETRICS_H
+#define SERVICEMETRICS_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// per request timestamps and per endpoint histograms/counters,
+// compiled out completely unless FLUENTHTTP_METRICS is set to 1
+#ifndef FLUENTHTTP_METRICS
+  #define FLUENTHTTP_METRICS 0
+#endif
+
+#define FLUENTHTTP_HISTOGRAM_BUCKETS 14
+
+enum service_timing_point_t {
+    stpLocked = 0,      // endpoint lock acquired
+    stpConnected = 1,   // connection established or reused
+    stpHeadSent = 2,    // head and content written to the client
+    stpFirstByte = 3,   // first response byte available
+    stpHeadersDone = 4, // response header parsed
+    stpBodyDone = 5,    // response callback returned, request finalized
+    stpCount = 6
+};
+
+struct service_request_timing_t {
+    uint32_t at[stpCount] = { 0 }; // micros() timestamps, 0 = not reached
+
+    bool reached(service_timing_point_t point) const { return at[point] != 0; }
+    // keeps the first time a point is reached, a reading of 0 (micros() wrapped) is taken as 1
+    void mark(service_timing_point_t point, uint32_t now) {
+        if (at[point] == 0) at[point] = now != 0 ? now : 1;
+    }
+    // micros between two reached points, 0 if one of them was not reached
+    uint32_t elapsed(service_timing_point_t from, service_timing_point_t to) const {
+        return reached(from) && reached(to) ? at[to] - at[from] : 0;
+    }
+};
+
+// fixed bucket latency histogram, bucket i counts samples <= bucketLimit(i) micros
+struct service_latency_histogram_t {
+    uint32_t buckets[FLUENTHTTP_HISTOGRAM_BUCKETS] = { 0 };
+    uint32_t count = 0;
+    uint32_t maxMicros = 0;
+    uint64_t sumMicros = 0;
+
+    void record(uint32_t micros);
+    uint32_t meanMicros() const { return count > 0 ? (uint32_t)(sumMicros / count) : 0; }
+    // upper bucket limit below which percent of the samples are
+    uint32_t percentileMicros(uint8_t percent) const;
+
+    static uint32_t bucketLimit(uint8_t bucket);
+};
+
+struct service_endpoint_stats_t {
+    // time spent in each phase of a request
+    service_latency_histogram_t connect;    // locked -> connected
+    service_latency_histogram_t send;       // connected -> head sent
+    service_latency_histogram_t firstByte;  // head sent -> first byte
+    service_latency_histogram_t headers;    // first byte -> headers done
+    service_latency_histogram_t content;    // headers done -> body done
+    service_latency_histogram_t total;      // locked -> finalized
+    service_latency_histogram_t handshake;  // tls handshakes, see ServiceTlsClient
+
+    uint32_t requests = 0;
+    uint32_t completed = 0;
+    uint32_t failures = 0;      // finalized as failed, including timeouts
+    uint32_t timeouts = 0;
+    uint32_t retries = 0;       // attempts repeated after a failure
+    uint32_t hedgesFired = 0;   // requests repeated on the second connection
+    uint32_t hedgesWon = 0;     // hedges that answered first
+    uint32_t connects = 0;      // connections opened
+    uint32_t reconnects = 0;    // connections opened again while keep-alive was on
+    uint32_t compressedBodies = 0; // request bodies sent compressed
+    uint64_t compressIn = 0;    // their size before
+    uint64_t compressOut = 0;   // and after compression
+    uint32_t tlsHandshakes = 0;
+    uint32_t tlsResumed = 0;    // handshakes that resumed the previous session
+    uint64_t bytesOut = 0;
+    uint64_t bytesIn = 0;       // response head plus declared content length
+
+    void recordRequest(const service_request_timing_t& timing, bool completed);
+    // compressed size of request bodies in percent of their original size
+    uint16_t compressionRatio() const { return compressIn > 0 ? (uint16_t)(compressOut * 100 / compressIn) : 0; }
+    // percent of the tls handshakes that were resumed
+    uint8_t tlsResumptionRate() const { return tlsHandshakes > 0 ? (uint8_t)(tlsResumed * 100 / tlsHandshakes) : 0; }
+};
+
+#endif /* SERVICEMETRICS_H */
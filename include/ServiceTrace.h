@@ -0,0 +1,116 @@
+#ifndef SERVICETRACE_H
+#define SERVICETRACE_H
+
+#include <Arduino.h>
+#include <atomic>
+
+// structured trace events of the request state machine, routed to a policy type
+// chosen at compile time. The default policy is empty and compiles away, build with
+//   -D FLUENTHTTP_TRACE_RING=64
+// to keep the last 64 events in memory (policy ServiceTraceRing<64>), or name an own type
+// with the same static event() function in FLUENTHTTP_TRACE_POLICY (declared in a header
+// force included with -include).
+#ifndef FLUENTHTTP_TRACE_POLICY
+  #ifdef FLUENTHTTP_TRACE_RING
+    #define FLUENTHTTP_TRACE_POLICY ServiceTraceRing<FLUENTHTTP_TRACE_RING>
+  #else
+    #define FLUENTHTTP_TRACE_POLICY ServiceTraceOff
+  #endif
+#endif
+
+// characters of an event text kept by the ring recorder, including the terminator
+#ifndef FLUENTHTTP_TRACE_TEXT_SIZE
+  #define FLUENTHTTP_TRACE_TEXT_SIZE 24
+#endif
+
+enum service_trace_event_t {
+    steStatus = 0,      // state transition, value = new service_request_status_t
+    steRequestLine = 1, // request started, text = method and uri
+    steHeaderOut = 2,   // request header field added, text = key
+    steBytesOut = 3,    // bytes written to the client, value = count
+    steBytesIn = 4,     // response head bytes read from the client, value = count
+    steResponse = 5,    // status line parsed, value = status code
+    steHeaderIn = 6,    // response header field parsed, text = key, value = bytes
+    steTimeout = 7,     // no response within the request timeout, value = timeout
+    steFailure = 8,     // request failed, text = message
+    steRetry = 9,       // attempt failed and is repeated, text = reason, value = backoff ms
+    steCount = 10
+};
+
+const char* serviceTraceEventName(service_trace_event_t event);
+
+// no-op policy, calls inline to nothing
+struct ServiceTraceOff {
+    static void event(const void* request, service_trace_event_t event, int32_t value,
+        const char* text, size_t length) {}
+};
+
+struct service_trace_record_t {
+    uint32_t micros;
+    uint16_t request;   // low bits of the request address, tells interleaved requests apart
+    uint8_t event;
+    int32_t value;
+    char text[FLUENTHTTP_TRACE_TEXT_SIZE];
+};
+
+// recorder policy, keeps the last N events (N a power of two) in a static ring.
+// Writers only claim a slot atomically, a record written while dumping may show up torn.
+template <size_t N>
+class ServiceTraceRing {
+    static_assert(N > 0 && (N & (N - 1)) == 0, "ServiceTraceRing size must be a power of two");
+
+    static service_trace_record_t _records[N];
+    static std::atomic<uint32_t> _next;
+
+    public:
+        static void event(const void* request, service_trace_event_t event, int32_t value,
+                const char* text, size_t length) {
+            service_trace_record_t& r = _records[_next.fetch_add(1, std::memory_order_relaxed) & (N - 1)];
+            r.micros = micros();
+            r.request = (uint16_t)(size_t)request;
+            r.event = event;
+            r.value = value;
+            if (length >= sizeof(r.text)) length = sizeof(r.text) - 1;
+            if (length > 0) memcpy(r.text, text, length);
+            r.text[length] = 0;
+        }
+
+        // number of records held, at most N
+        static size_t count() {
+            uint32_t next = _next.load(std::memory_order_relaxed);
+            return next < N ? next : N;
+        }
+
+        // i-th record held, 0 = oldest
+        static const service_trace_record_t& at(size_t i) {
+            uint32_t next = _next.load(std::memory_order_relaxed);
+            return _records[(next - count() + i) & (N - 1)];
+        }
+
+        static void clear() {
+            _next.store(0, std::memory_order_relaxed);
+        }
+
+        // prints the held records oldest first, one line each
+        static void dump(Print& out) {
+            char line[64 + FLUENTHTTP_TRACE_TEXT_SIZE];
+            size_t n = count();
+            for (size_t i = 0; i < n; i++) {
+                const service_trace_record_t& r = at(i);
+                snprintf(line, sizeof(line), "%10lu [%04X] %-10s %ld %s",
+                    (unsigned long)r.micros, r.request,
+                    serviceTraceEventName((service_trace_event_t)r.event), (long)r.value, r.text);
+                out.println(line);
+            }
+        }
+};
+
+template <size_t N>
+service_trace_record_t ServiceTraceRing<N>::_records[N];
+
+template <size_t N>
+std::atomic<uint32_t> ServiceTraceRing<N>::_next(0);
+
+typedef FLUENTHTTP_TRACE_POLICY service_trace_policy_t;
+
+#endif /* SERVICETRACE_H */
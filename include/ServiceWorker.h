@@ -0,0 +1,98 @@
+#ifndef SERVICEWORKER_H
+#define SERVICEWORKER_H
+
+#include "fluenthttp.h"
+#include "SpscRing.h"
+#include <atomic>
+#ifndef ARDUINO_ARCH_ESP32
+  #include <thread>
+#endif
+
+// max. number of requests driven at once, one per endpoint using the worker (power of two)
+#ifndef FLUENTHTTP_WORKER_SLOTS
+  #define FLUENTHTTP_WORKER_SLOTS 4
+#endif
+
+// bytes of response content buffered between worker and application task per request (power of two)
+#ifndef FLUENTHTTP_WORKER_PIPE_SIZE
+  #define FLUENTHTTP_WORKER_PIPE_SIZE 1024
+#endif
+
+enum service_worker_completion_kind_t {
+    swcResponse = 0, // header received, content follows through the slot's body stream
+    swcTimeout = 1,
+    swcFailed = 2,
+    swcDone = 3      // content consumed, the worker let go of the request
+};
+
+struct service_worker_completion_t {
+    ServiceRequest* request;
+    uint8_t slot;
+    service_worker_completion_kind_t kind;
+};
+
+// application side end of the content pipe, filled by the worker from the socket
+class ServiceWorkerBodyStream : public Stream {
+    friend class ServiceWorker;
+    private:
+        SpscRing<uint8_t, FLUENTHTTP_WORKER_PIPE_SIZE> _pipe;
+    public:
+        int available() { return _pipe.size(); }
+        int read() { uint8_t b; return _pipe.pop(b) ? b : -1; }
+        int peek() { uint8_t b; return _pipe.peek(b) ? b : -1; }
+        size_t write(uint8_t) { return 0; }
+        void flush() {}
+};
+
+// drives the requests of attached endpoints on its own task (pinned to a core on the ESP32,
+// a std::thread on host builds). Requests and completions travel through lock-free rings,
+// their application side is serialized, so any task may fire requests and dispatch. Callbacks
+// run on the task whose dispatch() picked up the completion. Requests are finalized there too,
+// the worker does not touch a request anymore once it reports it finished
+class ServiceWorker {
+    friend class ServiceRequest;
+    private:
+        struct worker_slot_t {
+            ServiceRequest* request = nullptr;
+            std::atomic<bool> consumed{false};
+            ServiceWorkerBodyStream body;
+        };
+
+        worker_slot_t _slots[FLUENTHTTP_WORKER_SLOTS];
+        // application -> worker
+        SpscRing<ServiceRequest*, FLUENTHTTP_WORKER_SLOTS> _submissions;
+        // worker -> application
+        SpscRing<service_worker_completion_t, FLUENTHTTP_WORKER_SLOTS * 2> _completions;
+        std::atomic<bool> _running{false};
+        // serialize the application side of the rings, which are single producer/consumer
+        SemaphoreHandle_t _submitLock;
+        SemaphoreHandle_t _dispatchLock;
+        #ifdef ARDUINO_ARCH_ESP32
+        TaskHandle_t _task = nullptr;
+        std::atomic<bool> _exited{true};
+        static void taskMain(void* arg);
+        #else
+        std::thread _thread;
+        #endif
+
+        bool submit(ServiceRequest* request);
+        void run();
+        bool step();
+        bool stepSlot(uint8_t index);
+        void complete(uint8_t index, service_worker_completion_kind_t kind);
+    public:
+        ServiceWorker();
+        ~ServiceWorker();
+
+        // starts the worker task, core and priority are only used on FreeRTOS
+        bool begin(int core = 1, uint32_t stackSize = 4096, int priority = 5);
+        // returns once the worker task left, requests it still drove are not finished
+        void end();
+        bool running() { return _running; }
+
+        // invokes the callbacks of completed requests, returns the number of completions handled.
+        // Called from any task, also by yield()/await() of requests driven by this worker
+        int dispatch();
+};
+
+#endif /* SERVICEWORKER_H */
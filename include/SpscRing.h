@@ -0,0 +1,77 @@
+#ifndef SPSCRING_H
+#define SPSCRING_H
+
+#include <stddef.h>
+#include <atomic>
+
+// lock-free single-producer/single-consumer ring buffer of fixed capacity,
+// exactly one task may push and exactly one (other) task may pop
+template <typename T, size_t N>
+class SpscRing {
+    static_assert(N >= 2 && (N & (N - 1)) == 0, "SpscRing capacity must be a power of two");
+    private:
+        T _items[N];
+        std::atomic<size_t> _head{0}; // next slot to write, owned by the producer
+        std::atomic<size_t> _tail{0}; // next slot to read, owned by the consumer
+    public:
+        bool push(const T& item) {
+            size_t head = _head.load(std::memory_order_relaxed);
+            if (head - _tail.load(std::memory_order_acquire) == N)
+                return false;
+            _items[head & (N - 1)] = item;
+            _head.store(head + 1, std::memory_order_release);
+            return true;
+        }
+
+        bool pop(T& item) {
+            size_t tail = _tail.load(std::memory_order_relaxed);
+            if (_head.load(std::memory_order_acquire) == tail)
+                return false;
+            item = _items[tail & (N - 1)];
+            _tail.store(tail + 1, std::memory_order_release);
+            return true;
+        }
+
+        bool peek(T& item) {
+            size_t tail = _tail.load(std::memory_order_relaxed);
+            if (_head.load(std::memory_order_acquire) == tail)
+                return false;
+            item = _items[tail & (N - 1)];
+            return true;
+        }
+
+        // bulk variants, return the number of items actually transferred
+        size_t push(const T* items, size_t count) {
+            size_t head = _head.load(std::memory_order_relaxed);
+            size_t space = N - (head - _tail.load(std::memory_order_acquire));
+            if (count > space) count = space;
+            for (size_t i = 0; i < count; i++)
+                _items[(head + i) & (N - 1)] = items[i];
+            _head.store(head + count, std::memory_order_release);
+            return count;
+        }
+
+        size_t pop(T* items, size_t count) {
+            size_t tail = _tail.load(std::memory_order_relaxed);
+            size_t used = _head.load(std::memory_order_acquire) - tail;
+            if (count > used) count = used;
+            for (size_t i = 0; i < count; i++)
+                items[i] = _items[(tail + i) & (N - 1)];
+            _tail.store(tail + count, std::memory_order_release);
+            return count;
+        }
+
+        size_t size() const {
+            return _head.load(std::memory_order_acquire) - _tail.load(std::memory_order_acquire);
+        }
+        size_t space() const { return N - size(); }
+        bool empty() const { return size() == 0; }
+
+        // only safe while neither side is active
+        void clear() {
+            _head.store(0, std::memory_order_relaxed);
+            _tail.store(0, std::memory_order_relaxed);
+        }
+};
+
+#endif /* SPSCRING_H */
@@ -0,0 +1,56 @@
+#ifndef URIBUILDER_H
+#define URIBUILDER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// the parts of a request target that differ in which characters must be percent-encoded
+enum uri_component_t {
+    ucTarget = 1,   // a complete relative uri, only characters illegal on the wire get encoded
+    ucSegment = 2,  // a single path segment, '/' '?' '#' get encoded
+    ucQuery = 4     // a query key or value, '&' '=' '+' '#' get encoded
+};
+
+// fixed-capacity uri builder that writes into caller provided storage,
+// so a request uri never has to be materialized on the heap
+class UriBuilder {
+    private:
+        char* _buffer;
+        size_t _capacity;
+        size_t _length;
+        bool _hasQuery;
+        bool _failed = false;
+
+        void put(char c);
+        void putEncoded(const char* s, uri_component_t component);
+        void beginQueryParameter(const char* key);
+    public:
+        UriBuilder(char* buffer, size_t capacity, size_t length = 0, bool hasQuery = false);
+
+        // appends an already composed uri (path and optional query)
+        UriBuilder& append(const char* uri);
+        // appends '/' and the encoded segment, must precede any query parameter
+        UriBuilder& path(const char* segment);
+        // appends '?' or '&' and the encoded key=value pair
+        UriBuilder& query(const char* key, const char* value);
+        UriBuilder& query(const char* key, long value);
+
+        void reset() { _length = 0; _hasQuery = false; _failed = false; }
+
+        // the buffer is kept zero terminated as long as there is room for the terminator
+        const char* c_str() const { return _buffer; }
+        size_t length() const { return _length; }
+        bool hasQuery() const { return _hasQuery; }
+        // false if something did not fit (the content is truncated then)
+        // or a path segment was appended after the query
+        bool ok() const { return !_failed; }
+
+        // table driven check whether c may be written verbatim in the given component
+        static bool isUnescaped(char c, uri_component_t component);
+        // room for the decimal representation of any long and its terminator
+        static const size_t INTEGER_SIZE = sizeof(long) * 3 + 2;
+        // writes the decimal representation of value to buffer (at least INTEGER_SIZE bytes), returns its length
+        static size_t formatInteger(char* buffer, long value);
+};
+
+#endif /* URIBUILDER_H */
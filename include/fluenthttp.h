@@ -2,13 +2,38 @@
 #define FLUENTHTTP_H
 
 #include <Arduino.h>
+#include <atomic>
 #include <functional>
 #include <RTOS.h>
+#include "UriBuilder.h"
+#include "ServiceMetrics.h"
+#include "ServiceTrace.h"
 
 #ifndef MAX_CONTENTSTRING_STACK_SIZE
   #define MAX_CONTENTSTRING_STACK_SIZE 256
 #endif
 
+// request line and headers are collected here and sent with a single write,
+// the uri must fit, headers exceeding it are flushed early
+#ifndef FLUENTHTTP_HEAD_BUFFER_SIZE
+  #define FLUENTHTTP_HEAD_BUFFER_SIZE 512
+#endif
+
+// stack buffer a streamed request body is sent through, max. 0xFFFF
+#ifndef FLUENTHTTP_BODY_BUFFER_SIZE
+  #define FLUENTHTTP_BODY_BUFFER_SIZE 256
+#endif
+
+// serialized tls session an endpoint keeps for resumption, allocated with the first tls client
+#ifndef FLUENTHTTP_TLS_SESSION_SIZE
+  #define FLUENTHTTP_TLS_SESSION_SIZE 2048
+#endif
+
+// request slots of ServiceEndpoint::request() if withRequestPool() was not called, max. 255
+#ifndef FLUENTHTTP_REQUEST_POOL
+  #define FLUENTHTTP_REQUEST_POOL 2
+#endif
+
 struct service_response_t {
     uint16_t statusCode = 0;
     String statusMessage;
@@ -18,7 +43,24 @@ struct service_response_t {
     Stream* contentReader = nullptr;
     // TODO: Header Fields
 
+    // size of the next chunk of chunked content, 0 at its end. Never waits: 0 is also returned
+    // while the size line did not fully arrive yet, chunkPending() tells both apart then
     int nextChunk();
+    // the size line of the next chunk is still on its way, call nextChunk() again later
+    bool chunkPending() const { return _chunkPending; }
+    // a chunk size did not fit an int, the content can not be read on
+    bool chunkMalformed() const { return _chunkMalformed; }
+
+    private:
+        friend class JsonReader;
+        uint32_t _chunkSize = 0;        // size line read so far
+        bool _chunkSized = false;       // a digit was read, leading zeros included
+        bool _chunkExtension = false;   // behind the size, skipped up to the line break
+        bool _chunkPending = false;
+        bool _chunkMalformed = false;
+
+        // size once the line is complete, else 0 with _chunkPending set
+        int chunkSizeByte(int c);
 };
 
 enum service_request_status_t {
@@ -30,18 +72,90 @@ enum service_request_status_t {
     srsReadingContent = 5,
     srsCompleted = 6,
     srsPrefailed = 7,
-    srsFailed = 8
+    srsFailed = 8,
+    srsQueued = 9,      // fired, waiting for the service worker to send it
+    srsDispatching = 10, // handed over from the service worker to the application task
+    srsBackoff = 11,     // attempt failed, waiting before the next one
+    srsAwaitContinue = 12, // head sent with "Expect: 100-continue", body held back
+    srsStreaming = 13   // event stream open, events are delivered from yield()
+};
+
+// failures that lead to another attempt of the request
+enum service_retry_condition_t {
+    srcConnectFailed = 1,       // the connection could not be established
+    srcResetBeforeResponse = 2, // connection closed or write failed before the first response byte
+    srcServiceUnavailable = 4,  // 503 or 429, waiting for Retry-After (seconds) when sent
+    srcAll = 7
+};
+
+struct service_retry_policy_t {
+    uint8_t maxAttempts = 1;    // including the first one, 1 = no retries
+    uint16_t backoff = 100;     // ms before the second attempt, doubled for each further one
+    uint16_t maxBackoff = 5000; // ms, a longer Retry-After is not waited for, the request fails
+    uint8_t retryOn = srcAll;   // service_retry_condition_t flags
+};
+
+// Content-Encoding of compressed request bodies, see ServiceEndpoint::withCompression()
+enum service_content_coding_t {
+    sccIdentity = 0,    // not compressed
+    sccGzip = 1,
+    sccDeflate = 2      // zlib format
+};
+
+// request body produced while it is sent, see MultipartEncoder
+class ServiceBodySource {
+    public:
+        virtual ~ServiceBodySource() {}
+        // total size in bytes, -1 if unknown, the body is sent chunked then
+        virtual long size() = 0;
+        // copies up to length bytes of the body, 0 once it ended
+        virtual size_t read(uint8_t* buffer, size_t length) = 0;
+};
+
+// tls client able to resume sessions, e.g. a wrapper around the mbedTLS session api. An endpoint begun with
+// one keeps the session of the last connection and offers it on the next connect
+class ServiceTlsClient : public Client {
+    public:
+        // copies the session of the current connection, returns its length, 0 if there is none or it does not fit
+        virtual size_t saveSession(uint8_t* buffer, size_t size) = 0;
+        // session offered on the next connect, length 0 for a full handshake
+        virtual void offerSession(const uint8_t* session, size_t length) = 0;
+        // whether the last connect resumed the offered session
+        virtual bool sessionResumed() = 0;
+        // micros the last handshake took, 0 if the client does not measure it
+        virtual uint32_t handshakeMicros() { return 0; }
 };
 
 typedef std::function<void (service_response_t)> service_endpoint_callback_t;
 typedef std::function<void ()> timeout_callback_t;
 
 class ServiceEndpoint;
+class ServiceWorker;
+class ServiceAwaitable;
+class ServiceEventStream;
+class ServiceBatch;
+class ServiceRequestHandle;
+class DeflateEncoder;
+
+// status of a request, written by the task of a ServiceWorker while it drives the request and
+// read by the application. Copies like a plain value
+struct service_status_t {
+    std::atomic<service_request_status_t> value;
+
+    service_status_t() : value(srsUninitialized) {}
+    service_status_t(const service_status_t& other) : value(other.value.load()) {}
+    service_status_t& operator=(const service_status_t& other) { value.store(other.value.load()); return *this; }
+    service_status_t& operator=(service_request_status_t status) { value.store(status); return *this; }
+    operator service_request_status_t() const { return value.load(); }
+};
 
 class ServiceRequest {
     friend class ServiceEndpoint;
+    friend class ServiceWorker;
+    friend class ServiceRequestHandle;
     private:
         ServiceEndpoint* _endpoint; // will be pushed from endpoint
+        ServiceWorker* _worker = nullptr; // set when a service worker drives this request
 
         service_endpoint_callback_t _successCallback = 0;
         service_endpoint_callback_t _failCallback = 0;
@@ -49,20 +163,114 @@ class ServiceRequest {
         long _t0 = 0;
         int _timeout = 1000;
         Client* _client;
-        service_request_status_t _status = srsUninitialized;
+        service_status_t _status;
         service_response_t _response = service_response_t();
         bool _keepAlive = false;
 
+        // the head is kept after sending so a retry can replay it, unless it had to be flushed early
+        service_retry_policy_t _retry;
+        bool _idempotent = false;
+        bool _reconnect = false;
+        bool _headFlushed = false;
+        uint8_t _attempts = 0;
+        uint32_t _retryDelay = 0;
+        uint32_t _retryAfter = 0;
+
+        // hedging, see ServiceEndpoint::withHedging()
+        bool _hedged = false;       // a hedge of this request is in flight
+        bool _hedgeFired = false;
+        bool _isHedge = false;      // this is the endpoint's hedge, it neither locks nor counts
+
+        bool _expectContinue = false; // sent with "Expect: 100-continue"
+        bool _bodyHeld = false;       // body held back until the server sent 100
+        bool _interim = false;        // reading the header block of a 1xx response
+
+        bool _compress = false;             // body sent compressed, see ServiceEndpoint::withCompression()
+        uint16_t _contentHeadLength = 0;    // head up to the body headers, rewritten when falling back
+
+        // long-lived response, see withEventStream()
+        ServiceEventStream* _events = nullptr;
+        uint16_t _eventHeadLength = 0; // head up to the Last-Event-ID line, rewritten on reconnect
+
+        char _head[FLUENTHTTP_HEAD_BUFFER_SIZE];
+        uint16_t _headLength = 0;
+        uint16_t _uriStart = 0;
+        bool _uriOpen = false;
+        bool _uriHasQuery = false;
+
+        // body sent after the head, kept until sent since a worker sends it later
+        const uint8_t* _content = nullptr;
+        size_t _contentLength = 0;
+        String _contentString;
+        ServiceBodySource* _body = nullptr;
+
+        // content copied while it arrives, see withContentBuffer()
+        uint8_t* _capture = nullptr;
+        size_t _captureSize = 0;
+        size_t _captured = 0;
+        uint32_t _captureLeft = 0;  // of the content or the current chunk
+
+        #if FLUENTHTTP_METRICS
+        service_request_timing_t _timing;
+        #endif
+
+        void markTiming(service_timing_point_t point) {
+            #if FLUENTHTTP_METRICS
+            _timing.mark(point, micros());
+            #endif
+        }
+
+        void trace(service_trace_event_t event, int32_t value = 0, const char* text = nullptr, size_t length = 0) {
+            service_trace_policy_t::event(this, event, value, text, length);
+        }
+
+        void setStatus(service_request_status_t status) {
+            _status = status;
+            trace(steStatus, status);
+        }
+
         void handleResponseBegin();
         void handleResponseHeader();
         void handleResponseContent();
+        bool captureContent();
+        void invokeResponseCallback();
+        bool readResponseHead();
+        bool timedOut();
+        bool retryPending();
+        bool canRetry(service_retry_condition_t condition);
+        bool canReopen(service_retry_condition_t condition);
+        void retryOrFail(service_retry_condition_t condition, const char* message);
+        bool backoffElapsed() { return millis() - _t0 >= _retryDelay; }
+        void attempt();
+        bool hedgeDue();
+        void startHedge();
+        bool takeHedge();
+        void endHedge();
+        void expectContinue(size_t count);
+        bool continueDue();
+        void writeHeader(const char* key, const char* value);
+        void writeContentHead(long size);
+        void resendUncompressed();
+        void sendContent();
+        bool sendBody(ServiceBodySource& body);
+        void writeEventHead();
+        void openStream();
+        void readStream();
 
         void beginRequest();
         void call(const char* method, const char* relativeUri);
+        void headWrite(const char* data, size_t length);
+        void headWrite(const char* s) { headWrite(s, strlen(s)); }
+        void flushHead();
+        UriBuilder uriBuilder();
+        void commitUri(const UriBuilder& uri);
+        void closeUri();
+        void transmit();
+        void send();
         void innerYield();
 
         ServiceRequest(Client* s, ServiceEndpoint* endpoint);
-        void fail(const char* message);
+        void fail(const char* message, bool fireNow = true);
 
         void finalize(service_request_status_t status);
     public:
@@ -77,12 +285,39 @@ class ServiceRequest {
         ServiceRequest& onTimeout(timeout_callback_t callback);
         ServiceRequest& withKeepAlive(bool keepAlive) { _keepAlive = keepAlive; return *this; }
         ServiceRequest& withTimeout(uint32_t timeout);
+        // overrides the retry policy of the endpoint for this request
+        ServiceRequest& withRetry(const service_retry_policy_t& policy) { _retry = policy; return *this; }
+        // allows retries of POST and PATCH requests
+        ServiceRequest& withIdempotent(bool idempotent = true) { _idempotent = idempotent; return *this; }
 
+        // uri composition, only valid before the first header is added or the request is fired
+        ServiceRequest& withPathSegment(const char* segment);
+        ServiceRequest& withQuery(const char* key, const char* value);
+        ServiceRequest& withQuery(const char* key, long value);
         
         ServiceRequest& addHeader(const char* key, const char* value);
+        // keeps a 2xx response open and delivers its text/event-stream events from yield(),
+        // onSuccess is called each time the stream (re)opened. A stream that was open once
+        // reconnects with Last-Event-ID after disconnects, idle and reconnect timeouts, after
+        // the reconnect delay doubled for each failed reconnect up to the maxBackoff of the
+        // retry policy. It fails after maxAttempts reconnects in a row did not open it again,
+        // or once a reconnect is answered with an error status. The endpoint stays locked
+        // meanwhile, the stream must stay valid until the request finished. Call before
+        // fire(), not driven by a service worker
+        ServiceRequest& withEventStream(ServiceEventStream& events);
+        // content is copied into buffer from yield() as it arrives, the callbacks run once it is
+        // complete or the buffer is full and never wait for it. Their contentReader is nullptr,
+        // content beyond size is left unread. Call before fire(), not with an event stream
+        ServiceRequest& withContentBuffer(uint8_t* buffer, size_t size);
+        // bytes copied into the content buffer
+        size_t contentBuffered() const { return _captured; }
         ServiceRequest& fire();
+        // with a service worker or retries, data must stay valid until the request finished
         ServiceRequest& fireContent(size_t count, uint8_t* data);
         ServiceRequest& fireContent(String data);
+        // streams the body from the source through a fixed buffer, the source must stay valid
+        // until the request finished. Streamed bodies are not retried
+        ServiceRequest& fireContent(ServiceBodySource& body);
 
         void cancel(const char* message);
         void await();
@@ -91,10 +326,51 @@ class ServiceRequest {
         bool active() { return !finished() && _status != srsUninitialized; }
 
         service_request_status_t getStatus();
+        // timestamps of this request, false if FLUENTHTTP_METRICS is disabled
+        bool getTiming(service_request_timing_t& timing);
+};
+
+// refers to a request in the pool of an endpoint, see ServiceEndpoint::request(). Copies refer
+// to the same request. A handle goes stale once its request was released or its slot was
+// recycled for a later request, get() then returns nullptr instead of somebody else's request.
+// A handle and the request it returns are used by one task. request() on another task may
+// recycle the slot once the request finished, so with several tasks each one releases its
+// handle before its next request() and the pool has a slot per task
+class ServiceRequestHandle {
+    friend class ServiceEndpoint;
+    private:
+        ServiceEndpoint* _endpoint = nullptr;
+        uint16_t _generation = 0;
+        uint8_t _slot = 0;
+
+        ServiceRequestHandle(ServiceEndpoint* endpoint, uint8_t slot, uint16_t generation)
+            : _endpoint(endpoint), _generation(generation), _slot(slot) {}
+    public:
+        ServiceRequestHandle() {}
+
+        // the request, nullptr if the handle is empty or stale
+        ServiceRequest* get() const;
+        bool valid() const { return get() != nullptr; }
+        explicit operator bool() const { return valid(); }
+        // the request, which must be there: check valid() first where the handle may be empty or stale
+        ServiceRequest* operator->() const;
+        // returns the slot to the pool, a request still running is cancelled. Does nothing on stale handles
+        void release();
+};
+
+// slot of the request pool, the generation counts the requests issued from it
+struct service_request_slot_t {
+    ServiceRequest request;
+    uint16_t generation = 0;
+    bool used = false;
+    uint32_t issued = 0;    // order of issue, the oldest finished request is recycled first
 };
 
 class ServiceEndpoint {
     friend class ServiceRequest;
+    friend class ServiceWorker;
+    friend class ServiceBatch;
+    friend class ServiceRequestHandle;
     private:
         Client* _client = nullptr;
         String _hostname;
@@ -102,22 +378,150 @@ class ServiceEndpoint {
         uint16_t _port;
         bool _hasHostname = false;
         bool _keepAlive = false;
+        ServiceWorker* _worker = nullptr;
+        service_retry_policy_t _retry;
+
+        // second connection and request a stalled GET is repeated on
+        Client* _hedgeClient = nullptr;
+        ServiceRequest* _hedge = nullptr;
+        uint32_t _hedgeDelay = 0;
+
+        size_t _continueThreshold = 0;
+        uint16_t _continueWait = 0;
+
+        // request body compression, the encoder is shared as only one request runs at a time
+        DeflateEncoder* _deflate = nullptr;
+        service_content_coding_t _coding = sccIdentity;
+        size_t _compressThreshold = 0;
+        bool _compressRejected = false;     // the server answered a compressed body with 415
+
+        // session resumption, see begin(ServiceTlsClient*)
+        ServiceTlsClient* _tlsClient = nullptr;
+        uint8_t* _tlsSession = nullptr;
+        size_t _tlsSessionLength = 0;
+
+        // requests handed out by request(), see withRequestPool()
+        service_request_slot_t* _pool = nullptr;
+        uint8_t _poolSize = 0;
+        uint32_t _poolIssued = 0;
+        // guards the slot bookkeeping, release() runs without the request lock
+        SemaphoreHandle_t _poolLock;
+
+        // endpoint-level headers, serialized once as "Key: Value\r\n" lines
+        String _defaultHeaders;
+        // Host/Accept/Connection + default headers, spliced verbatim into each request head
+        String _headTemplate;
+        bool _headTemplateValid = false;
 
         SemaphoreHandle_t _waitHandle;
 
-        int connectClient();
+        #if FLUENTHTTP_METRICS
+        service_endpoint_stats_t _stats;
+        #endif
+
+        void recordConnect() {
+            #if FLUENTHTTP_METRICS
+            if (_keepAlive && _stats.connects > 0) _stats.reconnects++;
+            _stats.connects++;
+            #endif
+        }
+        void recordBytes(size_t out, size_t in) {
+            #if FLUENTHTTP_METRICS
+            _stats.bytesOut += out;
+            _stats.bytesIn += in;
+            #endif
+        }
+        void recordTimeout() {
+            #if FLUENTHTTP_METRICS
+            _stats.timeouts++;
+            #endif
+        }
+        void recordRetry() {
+            #if FLUENTHTTP_METRICS
+            _stats.retries++;
+            #endif
+        }
+        void recordHedge(bool won) {
+            #if FLUENTHTTP_METRICS
+            if (won) _stats.hedgesWon++;
+            else _stats.hedgesFired++;
+            #endif
+        }
+        void recordCompression(uint32_t in, uint32_t out) {
+            #if FLUENTHTTP_METRICS
+            _stats.compressedBodies++;
+            _stats.compressIn += in;
+            _stats.compressOut += out;
+            #endif
+        }
+        void recordHandshake(uint32_t micros, bool resumed) {
+            #if FLUENTHTTP_METRICS
+            _stats.handshake.record(micros);
+            _stats.tlsHandshakes++;
+            if (resumed) _stats.tlsResumed++;
+            #endif
+        }
+
+        bool compresses(long size) const {
+            return _coding != sccIdentity && !_compressRejected && (size < 0 || (size_t)size >= _compressThreshold);
+        }
+        ServiceRequest* pooled(uint8_t slot, uint16_t generation) {
+            if (slot >= _poolSize) return nullptr;
+            service_request_slot_t& s = _pool[slot];
+            return s.used && s.generation == generation ? &s.request : nullptr;
+        }
+        void release(uint8_t slot, uint16_t generation);
+        // with _poolLock taken
+        void resizePool(uint8_t slots);
+        void startRequest(const char* relativeUri, const char* httpMethod, ServiceRequest& request);
+        int connectClient() { return connectClient(_client); }
+        int connectClient(Client* client);
         void createSemaphores();
         bool unlock();
+        const String& headTemplate();
     public:
         ServiceEndpoint(const char* hostname);
         ServiceEndpoint(const char* hostname, uint16_t port);
         ServiceEndpoint(IPAddress ip);
         ServiceEndpoint(IPAddress ip, uint16_t port);
+        ~ServiceEndpoint();
 
         ServiceEndpoint& withKeepAlive(bool keepAliveHeader);
+        // adds a header that is sent with every request of this endpoint
+        ServiceEndpoint& withDefaultHeader(const char* key, const char* value);
+        ServiceEndpoint& clearDefaultHeaders();
+        // connect and socket i/o of all requests is done by the given worker task,
+        // callbacks run on the task calling yield()/await() or ServiceWorker::dispatch()
+        ServiceEndpoint& withWorker(ServiceWorker* worker);
+        // retry policy of all requests of this endpoint, requests may override it
+        ServiceEndpoint& withRetry(const service_retry_policy_t& policy);
+        // a GET without a first response byte after delay ms is sent once more over the second
+        // client, the first complete response head wins and the other request is cancelled.
+        // A request the hedge won for continues on the second client, the endpoint keeps
+        // sending over the first one. Not used with a worker
+        ServiceEndpoint& withHedging(Client* secondClient, uint32_t delay);
+        // bodies of at least threshold bytes are sent with "Expect: 100-continue" and held back
+        // until the server answered 100, or did not answer within wait ms. A final status
+        // before that ends the request without sending the body. 0 turns it off
+        ServiceEndpoint& withExpectContinue(size_t threshold, uint16_t wait = 1000);
+        // request bodies of at least threshold bytes and streamed ones of unknown size are
+        // compressed while they are sent, see DeflateEncoder, and go chunked. Once the server
+        // answers one with 415 bodies are sent as is: the rejected one again right away unless
+        // it came from a ServiceBodySource. sccIdentity turns it off. Not used by ServiceBatch
+        ServiceEndpoint& withCompression(service_content_coding_t coding, size_t threshold = 0);
+        // resizes the pool of requests handed out by request(), which is allocated with
+        // FLUENTHTTP_REQUEST_POOL slots by the first request() otherwise. Call at startup, does
+        // nothing while a handed out request was not released
+        ServiceEndpoint& withRequestPool(uint8_t slots = FLUENTHTTP_REQUEST_POOL);
 
         // close the underlying client
         void begin(Client* client);
+        // the session of each connection is kept and offered on the next connect, so reconnects
+        // skip the full handshake if the server still knows it. Handshake times and resumptions
+        // are recorded in the endpoint stats
+        void begin(ServiceTlsClient* client);
+        // the next connect does a full handshake
+        void forgetTlsSession() { _tlsSessionLength = 0; }
         void close();
 
         void forceUnlock();
@@ -125,6 +529,24 @@ class ServiceEndpoint {
         bool beginRequest(const char* relativeUri, const char* httpMethod, ServiceRequest& request, int lockTimeout = 0);
         bool get(const char* relativeUri, ServiceRequest& request, int lockTimeout = 0);
         bool post(const char* relativeUri, ServiceRequest& request, int lockTimeout = 0);
+        // like beginRequest() on a request owned by the endpoint, so it can not dangle and
+        // issuing it does not allocate. A free slot is taken, otherwise the one of the oldest
+        // finished request, whose handles go stale. The handle is empty if the lock was not
+        // acquired or all slots hold unfinished requests
+        ServiceRequestHandle request(const char* httpMethod, const char* relativeUri, int lockTimeout = 0);
+        // sends all requests of the batch under a single lock, false if the lock was not acquired.
+        // Driven by ServiceBatch::yield()/await() on the calling task, also with a worker
+        bool fire(ServiceBatch& batch, int lockTimeout = 0);
+
+        #if defined(__cpp_impl_coroutine)
+        // co_await endpoint.get("/x") from a ServiceTask coroutine, see ServiceCoroutine.h
+        ServiceAwaitable get(const char* relativeUri);
+        ServiceAwaitable post(const char* relativeUri, uint8_t* data, size_t count);
+        #endif
+
+        // copies the current statistics, false (and nothing copied) if FLUENTHTTP_METRICS is disabled.
+        // Not synchronized with a ServiceWorker recording at the same time
+        bool getStats(service_endpoint_stats_t& snapshot, bool reset = false);
 
         IPAddress getIPAdress() { return _ipaddr; }
         const char* getHostname() { return _hostname.c_str(); }
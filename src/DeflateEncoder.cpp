@@ -0,0 +1,312 @@
+#include "DeflateEncoder.h"
+
+#define DEFLATE_MIN_MATCH 3
+#define DEFLATE_MAX_MATCH 258
+
+enum deflate_state_t {
+    dsHeader = 0,
+    dsBody = 1,
+    dsOutput = 2,   // a block ended, its bytes are put out
+    dsLast = 3,     // the final block ended, the trailer follows its bytes
+    dsTrailer = 4,
+    dsDone = 5
+};
+
+// base values and extra bits of the length codes 257..285 and the distance codes 0..29
+static const uint16_t lengthBase[29] = {
+    3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+    35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+static const uint8_t lengthExtra[29] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+    3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+static const uint16_t distanceBase[30] = {
+    1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+    257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577 };
+static const uint8_t distanceExtra[30] = {
+    0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+    7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+
+// crc32 of gzip, four bits at a time
+static const uint32_t crcTable[16] = {
+    0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC, 0x76DC4190, 0x6B6B51F4, 0x4DB26158, 0x5005713C,
+    0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C, 0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C };
+
+// huffman codes go out starting with their most significant bit
+static uint32_t reverseBits(uint32_t code, uint8_t length) {
+    uint32_t reversed = 0;
+    while (length-- > 0) {
+        reversed = (reversed << 1) | (code & 1);
+        code >>= 1;
+    }
+    return reversed;
+}
+
+static inline uint32_t hash(const uint8_t* p) {
+    uint32_t key = (uint32_t)p[0] << 16 | (uint32_t)p[1] << 8 | p[2];
+    return (key * 2654435761u) >> (32 - FLUENTHTTP_DEFLATE_HASH_BITS);
+}
+
+void DeflateEncoder::begin(const uint8_t* data, size_t length) {
+    reset();
+    _data = data;
+    _dataLength = length;
+}
+
+void DeflateEncoder::begin(ServiceBodySource& source) {
+    reset();
+    _source = &source;
+}
+
+void DeflateEncoder::reset() {
+    _data = nullptr;
+    _dataLength = 0;
+    _source = nullptr;
+    _ended = false;
+    _mismatched = false;
+    _bufferStart = 0;
+    _fill = 0;
+    _pos = 0;
+    memset(_table, 0, sizeof(_table));
+    _blockStart = 0;
+    _outLength = 0;
+    _outPos = 0;
+    _bits = 0;
+    _bitCount = 0;
+    _crc = 0xFFFFFFFF;
+    _adler = 1;
+    _produced = 0;
+    writeHeader();
+    _state = dsHeader;
+}
+
+void DeflateEncoder::writeHeader() {
+    if (_coding == sccDeflate) {
+        // zlib: window size and a check value making the first two bytes a multiple of 31
+        uint8_t cmf = 0x08 | ((FLUENTHTTP_DEFLATE_WINDOW_BITS - 8) << 4);
+        _frame[0] = cmf;
+        _frame[1] = (31 - (cmf << 8) % 31) % 31;
+        _frameLength = 2;
+    }
+    else {
+        static const uint8_t gzip[10] = { 0x1F, 0x8B, 8, 0, 0, 0, 0, 0, 0, 0xFF };
+        memcpy(_frame, gzip, sizeof(gzip));
+        _frameLength = sizeof(gzip);
+    }
+    _framePos = 0;
+}
+
+void DeflateEncoder::writeTrailer() {
+    if (_coding == sccDeflate) {
+        for (uint8_t i = 0; i < 4; i++)
+            _frame[i] = (uint8_t)(_adler >> (24 - 8 * i));
+        _frameLength = 4;
+    }
+    else {
+        uint32_t crc = ~_crc;
+        for (uint8_t i = 0; i < 4; i++) {
+            _frame[i] = (uint8_t)(crc >> (8 * i));
+            _frame[4 + i] = (uint8_t)(_fill >> (8 * i));
+        }
+        _frameLength = 8;
+    }
+    _framePos = 0;
+    _state = dsTrailer;
+}
+
+void DeflateEncoder::checksum(const uint8_t* data, size_t length) {
+    if (_coding == sccDeflate) {
+        uint32_t s1 = _adler & 0xFFFF;
+        uint32_t s2 = _adler >> 16;
+        while (length > 0) {
+            // the sums can not overflow within 5552 bytes
+            size_t n = length < 5552 ? length : 5552;
+            length -= n;
+            while (n-- > 0) {
+                s1 += *data++;
+                s2 += s1;
+            }
+            s1 %= 65521;
+            s2 %= 65521;
+        }
+        _adler = s2 << 16 | s1;
+        return;
+    }
+    uint32_t crc = _crc;
+    for (size_t i = 0; i < length; i++) {
+        crc ^= data[i];
+        crc = (crc >> 4) ^ crcTable[crc & 15];
+        crc = (crc >> 4) ^ crcTable[crc & 15];
+    }
+    _crc = crc;
+}
+
+// reads more input behind the buffered one, the older half of the buffer is dropped when full
+void DeflateEncoder::fill() {
+    if (_fill - _bufferStart == sizeof(_buffer)) {
+        memmove(_buffer, _buffer + WINDOW, WINDOW);
+        _bufferStart += WINDOW;
+    }
+    uint8_t* to = _buffer + (_fill - _bufferStart);
+    size_t room = sizeof(_buffer) - (_fill - _bufferStart);
+    size_t n;
+    if (_source != nullptr) {
+        n = _source->read(to, room);
+    }
+    else {
+        n = _dataLength - _fill;
+        if (n > room) n = room;
+        memcpy(to, _data + _fill, n);
+    }
+    if (n == 0) {
+        _ended = true;
+        _mismatched = _source != nullptr && _source->size() >= 0 && (uint32_t)_source->size() != _fill;
+    }
+    checksum(to, n);
+    _fill += n;
+}
+
+void DeflateEncoder::putCode(uint16_t symbol) {
+    if (symbol < 144)
+        putBits(reverseBits(0x30 + symbol, 8), 8);
+    else if (symbol < 256)
+        putBits(reverseBits(0x190 + symbol - 144, 9), 9);
+    else if (symbol < 280)
+        putBits(reverseBits(symbol - 256, 7), 7);
+    else
+        putBits(reverseBits(0xC0 + symbol - 280, 8), 8);
+}
+
+void DeflateEncoder::putMatch(uint16_t length, uint16_t distance) {
+    uint8_t code = 28;
+    while (lengthBase[code] > length) code--;
+    putCode(257 + code);
+    if (lengthExtra[code] > 0)
+        putBits(length - lengthBase[code], lengthExtra[code]);
+    code = 29;
+    while (distanceBase[code] > distance) code--;
+    putBits(reverseBits(code, 5), 5);
+    if (distanceExtra[code] > 0)
+        putBits(distance - distanceBase[code], distanceExtra[code]);
+}
+
+// the header of a block with the fixed code: BFINAL = 0, BTYPE = 01. The final block is
+// only known when it ended, its BFINAL bit is set then
+void DeflateEncoder::openBlock() {
+    _blockBits = _bits;
+    _blockBitCount = _bitCount;
+    putBits(2, 3);
+}
+
+// ends the open block and keeps it coded or stores its input, whatever is smaller
+void DeflateEncoder::endBlock(bool final) {
+    if (_pos == _blockStart)
+        openBlock();
+    putCode(256);
+    uint32_t length = _pos - _blockStart;
+    uint32_t coded = _outLength * 8 + _bitCount - _blockBitCount;
+    // a stored block: BTYPE = 00, LEN and NLEN from the next byte boundary on, then the input
+    uint8_t pad = (8 - (_blockBitCount + 3) % 8) % 8;
+    uint32_t stored = 3 + pad + 32 + 8 * length;
+    if (stored < coded) {
+        _outLength = 0;
+        _bits = _blockBits;
+        _bitCount = _blockBitCount;
+        putBits(final ? 1 : 0, 3 + pad);
+        putBits(length | (~length & 0xFFFF) << 16, 32);
+    }
+    else {
+        if (final) {
+            if (_outLength > 0)
+                _out[0] |= 1 << _blockBitCount;
+            else
+                _bits |= 1 << _blockBitCount;
+        }
+        _blockStart = _pos;
+    }
+    // the trailer starts on a byte boundary
+    if (final)
+        putBits(0, (8 - _bitCount % 8) % 8);
+    flushBits();
+    _state = final ? dsLast : dsOutput;
+}
+
+// encodes a literal or a repeat, at most 31 bits
+void DeflateEncoder::encode() {
+    if (_fill - _pos < DEFLATE_MAX_MATCH && !_ended) {
+        // a repeat may run up to the max. length. The input of the open block is kept until
+        // it was put out, the block ends before the buffer would drop it
+        if (_fill - _bufferStart == sizeof(_buffer) && _blockStart < _bufferStart + WINDOW)
+            endBlock(false);
+        else
+            fill();
+        return;
+    }
+    if (_pos == _fill) {
+        endBlock(true);
+        return;
+    }
+    if (_pos - _blockStart >= BLOCK) {
+        endBlock(false);
+        return;
+    }
+    if (_pos == _blockStart)
+        openBlock();
+    const uint8_t* p = _buffer + (_pos - _bufferStart);
+    uint32_t available = _fill - _pos;
+    if (available >= DEFLATE_MIN_MATCH) {
+        uint32_t h = hash(p);
+        uint32_t candidate = _table[h];
+        _table[h] = _pos + 1;
+        // entries may be stale, from before the buffer moved or beyond the window
+        if (candidate != 0 && candidate - 1 >= _bufferStart && _pos - (candidate - 1) <= WINDOW) {
+            const uint8_t* q = _buffer + (candidate - 1 - _bufferStart);
+            uint32_t limit = available < DEFLATE_MAX_MATCH ? available : DEFLATE_MAX_MATCH;
+            uint32_t length = 0;
+            while (length < limit && q[length] == p[length]) length++;
+            if (length >= DEFLATE_MIN_MATCH) {
+                putMatch(length, _pos - (candidate - 1));
+                flushBits();
+                // later repeats may start within this one
+                for (uint32_t i = 1; i < length && _pos + i + DEFLATE_MIN_MATCH <= _fill; i++)
+                    _table[hash(p + i)] = _pos + i + 1;
+                _pos += length;
+                return;
+            }
+        }
+    }
+    putCode(*p);
+    flushBits();
+    _pos++;
+}
+
+size_t DeflateEncoder::read(uint8_t* buffer, size_t length) {
+    size_t n = 0;
+    while (n < length && _state != dsDone) {
+        if (_state == dsHeader || _state == dsTrailer) {
+            while (n < length && _framePos < _frameLength)
+                buffer[n++] = _frame[_framePos++];
+            if (_framePos == _frameLength)
+                _state = _state == dsHeader ? dsBody : dsDone;
+            continue;
+        }
+        if (_state == dsBody) {
+            encode();
+            continue;
+        }
+        while (n < length && _outPos < _outLength)
+            buffer[n++] = _out[_outPos++];
+        // a stored block's input follows its head
+        while (n < length && _blockStart < _pos)
+            buffer[n++] = _buffer[_blockStart++ - _bufferStart];
+        if (_outPos < _outLength || _blockStart < _pos)
+            break;
+        _outLength = 0;
+        _outPos = 0;
+        if (_state == dsLast)
+            writeTrailer();
+        else
+            _state = dsBody;
+    }
+    _produced += n;
+    return n;
+}
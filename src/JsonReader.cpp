@@ -0,0 +1,357 @@
+#include "JsonReader.h"
+
+// what the tokenizer accepts next
+enum json_expect_t {
+    jeValue = 0,
+    jeKey = 1,
+    jeKeyOrEnd = 2,     // first key of an object or '}'
+    jeValueOrEnd = 3,   // first element of an array or ']'
+    jeCommaOrEnd = 4,
+    jeDone = 5          // the root value is complete
+};
+
+// position in the number grammar -?(0|[1-9][0-9]*)(.[0-9]+)?([eE][+-]?[0-9]+)?
+enum json_number_state_t {
+    jnSign = 0,         // '-' read, a digit must follow
+    jnZero = 1,
+    jnInteger = 2,
+    jnPoint = 3,        // a digit must follow
+    jnFraction = 4,
+    jnExponent = 5,     // 'e' read, a sign or digit must follow
+    jnExponentSign = 6, // a digit must follow
+    jnExponentDigits = 7,
+    jnInvalid = 8
+};
+
+static uint8_t numberState(uint8_t state, int c) {
+    bool digit = c >= '0' && c <= '9';
+    switch (state) {
+        case jnSign: return c == '0' ? jnZero : digit ? jnInteger : jnInvalid;
+        case jnZero: return c == '.' ? jnPoint : c == 'e' || c == 'E' ? jnExponent : jnInvalid;
+        case jnInteger: return digit ? jnInteger : c == '.' ? jnPoint : c == 'e' || c == 'E' ? jnExponent : jnInvalid;
+        case jnPoint: return digit ? jnFraction : jnInvalid;
+        case jnFraction: return digit ? jnFraction : c == 'e' || c == 'E' ? jnExponent : jnInvalid;
+        case jnExponent: return digit ? jnExponentDigits : c == '+' || c == '-' ? jnExponentSign : jnInvalid;
+        case jnExponentSign:
+        case jnExponentDigits: return digit ? jnExponentDigits : jnInvalid;
+        default: return jnInvalid;
+    }
+}
+
+JsonReader::JsonReader(Stream& stream, char* buffer, size_t capacity, long length)
+        : _stream(&stream), _left(length), _value(buffer), _capacity(capacity), _expect(jeValue) {
+    _value[0] = 0;
+    _path[0] = 0;
+    _base[0] = 0;
+    _index[0] = 0;
+}
+
+JsonReader::JsonReader(service_response_t& response, char* buffer, size_t capacity)
+        : JsonReader(*response.contentReader, buffer, capacity,
+            response.chunked ? 0 : response.contentLength > 0 ? (long)response.contentLength : -1) {
+    if (response.chunked)
+        _response = &response;
+}
+
+bool JsonReader::fill() {
+    if (_ended) return false;
+    if (_response != nullptr && _left == 0) {
+        // the rest of the size line is read like content, waiting up to the stream timeout
+        _left = _response->nextChunk();
+        char c;
+        while (_left == 0 && _response->chunkPending() && _stream->readBytes(&c, 1) == 1)
+            _left = _response->chunkSizeByte(c);
+        if (_left <= 0) {
+            // the CRLF closing the chunked content
+            if (_stream->available() > 0) _stream->readStringUntil('\n');
+            _ended = true;
+            return false;
+        }
+    }
+    if (_left == 0) {
+        _ended = true;
+        return false;
+    }
+    size_t n = sizeof(_buf);
+    if (_left > 0 && (size_t)_left < n) n = _left;
+    int available = _stream->available();
+    if (available > 0 && (size_t)available < n) n = available;
+    // waits up to the stream timeout if nothing arrived yet
+    n = _stream->readBytes((char*)_buf, n);
+    if (n == 0) {
+        _ended = true;
+        return false;
+    }
+    _pos = 0;
+    _fill = n;
+    if (_left > 0) _left -= n;
+    return true;
+}
+
+int JsonReader::get() {
+    if (_peek >= 0) {
+        int c = _peek;
+        _peek = -1;
+        return c;
+    }
+    if (_pos == _fill && !fill()) return -1;
+    return _buf[_pos++];
+}
+
+int JsonReader::skipSpace() {
+    int c;
+    do {
+        c = get();
+    } while (c == ' ' || c == '\t' || c == '\r' || c == '\n');
+    return c;
+}
+
+json_token_t JsonReader::fail() {
+    _token = jtError;
+    return jtError;
+}
+
+// path of the next value: the path of its container plus ".key" or "[index]"
+void JsonReader::setPath(const char* segment, size_t length, bool index) {
+    _pathLength = _base[_depth];
+    _path[_pathLength] = 0;
+    // an enclosing path was cut already
+    if (_overflowDepth != 0 && _overflowDepth < _depth) return;
+    _overflowDepth = 0;
+    bool dot = !index && _pathLength > 0;
+    if (_pathLength + dot + length >= sizeof(_path)) {
+        _overflowDepth = _depth;
+        return;
+    }
+    if (dot) _path[_pathLength++] = '.';
+    memcpy(_path + _pathLength, segment, length);
+    _pathLength += length;
+    _path[_pathLength] = 0;
+}
+
+void JsonReader::putValue(char c) {
+    if (_length + 1 < _capacity) {
+        _value[_length++] = c;
+        _value[_length] = 0;
+    }
+    else {
+        _truncated = true;
+    }
+}
+
+void JsonReader::putCodepoint(uint32_t cp) {
+    // utf-8
+    if (cp < 0x80) {
+        putValue(cp);
+    }
+    else if (cp < 0x800) {
+        putValue(0xC0 | (cp >> 6));
+        putValue(0x80 | (cp & 0x3F));
+    }
+    else if (cp < 0x10000) {
+        putValue(0xE0 | (cp >> 12));
+        putValue(0x80 | ((cp >> 6) & 0x3F));
+        putValue(0x80 | (cp & 0x3F));
+    }
+    else {
+        putValue(0xF0 | (cp >> 18));
+        putValue(0x80 | ((cp >> 12) & 0x3F));
+        putValue(0x80 | ((cp >> 6) & 0x3F));
+        putValue(0x80 | (cp & 0x3F));
+    }
+}
+
+// four hex digits of a \u escape, -1 if malformed
+long JsonReader::readHex() {
+    long result = 0;
+    for (int i = 0; i < 4; i++) {
+        int c = get();
+        int digit = c >= '0' && c <= '9' ? c - '0'
+            : c >= 'a' && c <= 'f' ? c - 'a' + 10
+            : c >= 'A' && c <= 'F' ? c - 'A' + 10
+            : -1;
+        if (digit < 0) return -1;
+        result = (result << 4) | digit;
+    }
+    return result;
+}
+
+json_token_t JsonReader::readString(json_token_t token) {
+    _length = 0;
+    _truncated = false;
+    _value[0] = 0;
+    while (true) {
+        int c = get();
+        if (c < 0) return fail();
+        if (c == '"') return token;
+        if (c < 0x20) return fail();
+        if (c != '\\') {
+            putValue(c);
+            continue;
+        }
+        c = get();
+        switch (c) {
+            case '"': case '\\': case '/': break;
+            case 'b': c = '\b'; break;
+            case 'f': c = '\f'; break;
+            case 'n': c = '\n'; break;
+            case 'r': c = '\r'; break;
+            case 't': c = '\t'; break;
+            case 'u': {
+                long cp = readHex();
+                if (cp < 0) return fail();
+                // a low surrogate without the high one in front
+                if (cp >= 0xDC00 && cp < 0xE000) return fail();
+                if (cp >= 0xD800 && cp < 0xDC00) {
+                    // surrogate pair
+                    if (get() != '\\' || get() != 'u') return fail();
+                    long low = readHex();
+                    if (low < 0xDC00 || low >= 0xE000) return fail();
+                    cp = 0x10000 + ((cp - 0xD800) << 10) + (low - 0xDC00);
+                }
+                putCodepoint(cp);
+                continue;
+            }
+            default:
+                return fail();
+        }
+        putValue(c);
+    }
+}
+
+json_token_t JsonReader::readNumber(int first) {
+    _length = 0;
+    _truncated = false;
+    uint8_t state = first == '-' ? jnSign : first == '0' ? jnZero : jnInteger;
+    putValue(first);
+    while (true) {
+        int c = get();
+        uint8_t next = numberState(state, c);
+        if (next != jnInvalid) {
+            putValue(c);
+            state = next;
+            continue;
+        }
+        // a number must end on a digit, and not run into what looks like more of it
+        bool complete = state == jnZero || state == jnInteger || state == jnFraction || state == jnExponentDigits;
+        bool numeric = (c >= '0' && c <= '9') || c == '.' || c == 'e' || c == 'E' || c == '+' || c == '-';
+        if (!complete || numeric) return fail();
+        // belongs to the next token
+        _peek = c;
+        return jtNumber;
+    }
+}
+
+json_token_t JsonReader::readLiteral(int first) {
+    const char* literal = first == 't' ? "true" : first == 'f' ? "false" : "null";
+    _length = 0;
+    _truncated = false;
+    putValue(first);
+    for (const char* p = literal + 1; *p != 0; p++) {
+        if (get() != *p) return fail();
+        putValue(*p);
+    }
+    return first == 't' ? jtTrue : first == 'f' ? jtFalse : jtNull;
+}
+
+json_token_t JsonReader::scalar(json_token_t token) {
+    if (token == jtError) return token;
+    _expect = _depth == 0 ? jeDone : jeCommaOrEnd;
+    return _token = token;
+}
+
+json_token_t JsonReader::begin(bool array) {
+    if (_depth == FLUENTHTTP_JSON_DEPTH) return fail();
+    _depth++;
+    _base[_depth] = _pathLength;
+    _index[_depth] = 0;
+    if (array)
+        _arrays |= 1u << _depth;
+    else
+        _arrays &= ~(1u << _depth);
+    _length = 0;
+    _value[0] = 0;
+    _expect = array ? jeValueOrEnd : jeKeyOrEnd;
+    return _token = array ? jtBeginArray : jtBeginObject;
+}
+
+json_token_t JsonReader::end() {
+    bool array = inArray();
+    // the path of the container itself
+    _pathLength = _base[_depth];
+    _path[_pathLength] = 0;
+    _depth--;
+    _expect = _depth == 0 ? jeDone : jeCommaOrEnd;
+    return _token = array ? jtEndArray : jtEndObject;
+}
+
+json_token_t JsonReader::next() {
+    if (_token == jtEnd || _token == jtError) return _token;
+    if (_expect == jeDone) {
+        // nothing is read behind the root value, the stream may stay open
+        return _token = jtEnd;
+    }
+    int c = skipSpace();
+    switch (_expect) {
+        case jeCommaOrEnd:
+            if (c == (inArray() ? ']' : '}')) return end();
+            if (c != ',') return fail();
+            c = skipSpace();
+            _expect = inArray() ? jeValue : jeKey;
+            break;
+        case jeKeyOrEnd:
+            if (c == '}') return end();
+            _expect = jeKey;
+            break;
+        case jeValueOrEnd:
+            if (c == ']') return end();
+            _expect = jeValue;
+            break;
+        default:
+            break;
+    }
+
+    if (_expect == jeKey) {
+        if (c != '"' || readString(jtKey) == jtError) return fail();
+        if (skipSpace() != ':') return fail();
+        // a cut key can not be found
+        setPath(_value, _truncated ? sizeof(_path) : _length, false);
+        _expect = jeValue;
+        return _token = jtKey;
+    }
+
+    if (inArray()) {
+        char index[8];
+        int length = snprintf(index, sizeof(index), "[%u]", (unsigned int)_index[_depth]++);
+        setPath(index, length, true);
+    }
+    switch (c) {
+        case '{': return begin(false);
+        case '[': return begin(true);
+        case '"': return scalar(readString(jtString));
+        case 't': case 'f': case 'n': return scalar(readLiteral(c));
+        default:
+            if (c == '-' || (c >= '0' && c <= '9'))
+                return scalar(readNumber(c));
+            return fail();
+    }
+}
+
+bool JsonReader::find(const char* path) {
+    json_token_t t;
+    while ((t = next()) != jtEnd && t != jtError) {
+        if (t == jtKey || t == jtEndObject || t == jtEndArray) continue;
+        if (_overflowDepth == 0 && strcmp(_path, path) == 0) return true;
+    }
+    return false;
+}
+
+void JsonReader::skip() {
+    if (_token == jtKey && next() != jtBeginObject && _token != jtBeginArray) return;
+    if (_token != jtBeginObject && _token != jtBeginArray) return;
+    uint8_t depth = _depth;
+    json_token_t t;
+    do {
+        t = next();
+    } while (t != jtEnd && t != jtError && _depth >= depth);
+}
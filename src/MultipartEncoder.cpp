@@ -0,0 +1,185 @@
+#include "MultipartEncoder.h"
+
+// fragments of each part, the content follows the last one
+#define MULTIPART_HEAD_FRAGMENTS 13
+// fragments of the closing delimiter
+#define MULTIPART_TAIL_FRAGMENTS 3
+
+MultipartEncoder::MultipartEncoder() {
+    // unlikely to show up in any content, unique enough without a random source
+    uint32_t seed = micros() ^ (uint32_t)(size_t)this;
+    uint32_t a = seed * 2654435761u;
+    uint32_t b = (seed ^ 0x9E3779B9u) * 2246822519u;
+    snprintf(_boundary, sizeof(_boundary), "----fluenthttp%08X%08X", (unsigned int)a, (unsigned int)b);
+    snprintf(_contentType, sizeof(_contentType), "multipart/form-data; boundary=%s", _boundary);
+}
+
+MultipartEncoder& MultipartEncoder::add(const multipart_part_t& part) {
+    if (_count == FLUENTHTTP_MULTIPART_PARTS) {
+        _failed = true;
+        return *this;
+    }
+    _parts[_count++] = part;
+    return *this;
+}
+
+MultipartEncoder& MultipartEncoder::addField(const char* name, const char* value) {
+    return add({ name, nullptr, nullptr, (const uint8_t*)value, nullptr, (long)strlen(value) });
+}
+
+MultipartEncoder& MultipartEncoder::addFile(const char* name, const char* filename, const char* contentType,
+        const uint8_t* data, size_t length) {
+    return add({ name, filename, contentType, data, nullptr, (long)length });
+}
+
+MultipartEncoder& MultipartEncoder::addFile(const char* name, const char* filename, const char* contentType,
+        Stream& stream, long length) {
+    return add({ name, filename, contentType, nullptr, &stream, length });
+}
+
+void MultipartEncoder::rewind() {
+    _part = 0;
+    _fragment = 0;
+    _offset = 0;
+}
+
+// names and filenames are quoted strings in the part head, quotes and line breaks
+// in them are percent-encoded like browsers do
+static bool escaped(char c) {
+    return c == '"' || c == '\r' || c == '\n';
+}
+
+static size_t escapedLength(const char* text) {
+    size_t length = 0;
+    for (; *text != 0; text++)
+        length += escaped(*text) ? 3 : 1;
+    return length;
+}
+
+// copies the escaped text from offset on, returns the number of bytes copied
+static size_t copyEscaped(const char* text, size_t offset, uint8_t* buffer, size_t length) {
+    static const char hex[] = "0123456789ABCDEF";
+    size_t pos = 0;
+    size_t n = 0;
+    for (; *text != 0 && n < length; text++) {
+        char encoded[3] = { *text, 0, 0 };
+        size_t size = 1;
+        if (escaped(*text)) {
+            encoded[0] = '%';
+            encoded[1] = hex[(uint8_t)*text >> 4];
+            encoded[2] = hex[*text & 15];
+            size = 3;
+        }
+        for (size_t i = 0; i < size && n < length; i++, pos++)
+            if (pos >= offset)
+                buffer[n++] = encoded[i];
+    }
+    return n;
+}
+
+// name and filename of a part
+static bool isEscapedFragment(uint8_t index) {
+    return index == 3 || index == 6;
+}
+
+// text of a fragment of the given part, "" for left out ones.
+// part == _count addresses the closing delimiter
+const char* MultipartEncoder::fragment(uint8_t part, uint8_t index) const {
+    if (part == _count) {
+        switch (index) {
+            case 0: return "\r\n--";
+            case 1: return _boundary;
+            default: return "--\r\n";
+        }
+    }
+    const multipart_part_t& p = _parts[part];
+    switch (index) {
+        // the CRLF in front of a delimiter belongs to it, not to the previous content
+        case 0: return part == 0 ? "--" : "\r\n--";
+        case 1: return _boundary;
+        case 2: return "\r\nContent-Disposition: form-data; name=\"";
+        case 3: return p.name;
+        case 4: return "\"";
+        case 5: return p.filename != nullptr ? "; filename=\"" : "";
+        case 6: return p.filename != nullptr ? p.filename : "";
+        case 7: return p.filename != nullptr ? "\"" : "";
+        case 8: return "\r\n";
+        case 9: return p.contentType != nullptr ? "Content-Type: " : "";
+        case 10: return p.contentType != nullptr ? p.contentType : "";
+        case 11: return p.contentType != nullptr ? "\r\n" : "";
+        default: return "\r\n";
+    }
+}
+
+size_t MultipartEncoder::fragmentLength(uint8_t part, uint8_t index) const {
+    const char* text = fragment(part, index);
+    return part < _count && isEscapedFragment(index) ? escapedLength(text) : strlen(text);
+}
+
+long MultipartEncoder::size() {
+    long total = 0;
+    for (uint8_t i = 0; i <= _count; i++) {
+        uint8_t fragments = i == _count ? MULTIPART_TAIL_FRAGMENTS : MULTIPART_HEAD_FRAGMENTS;
+        for (uint8_t f = 0; f < fragments; f++)
+            total += fragmentLength(i, f);
+        if (i < _count) {
+            if (_parts[i].length < 0) return -1;
+            total += _parts[i].length;
+        }
+    }
+    return total;
+}
+
+size_t MultipartEncoder::readContent(multipart_part_t& part, uint8_t* buffer, size_t length) {
+    if (part.length >= 0) {
+        size_t left = part.length - _offset;
+        if (length > left) length = left;
+    }
+    if (length == 0) return 0;
+    if (part.stream == nullptr) {
+        memcpy(buffer, part.data + _offset, length);
+        return length;
+    }
+    // take what is there, else wait up to the stream timeout for the next byte:
+    // a stream of unknown length ends once none arrived in time
+    int available = part.stream->available();
+    if (available <= 0 && part.length < 0) length = 1;
+    if (available > 0 && (size_t)available < length) length = available;
+    return part.stream->readBytes((char*)buffer, length);
+}
+
+size_t MultipartEncoder::read(uint8_t* buffer, size_t length) {
+    size_t n = 0;
+    while (n < length && _part <= _count) {
+        bool tail = _part == _count;
+        uint8_t fragments = tail ? MULTIPART_TAIL_FRAGMENTS : MULTIPART_HEAD_FRAGMENTS;
+        if (_fragment < fragments) {
+            const char* text = fragment(_part, _fragment);
+            size_t size = fragmentLength(_part, _fragment);
+            size_t left = size - _offset;
+            size_t take = left < length - n ? left : length - n;
+            if (!tail && isEscapedFragment(_fragment))
+                copyEscaped(text, _offset, buffer + n, take);
+            else
+                memcpy(buffer + n, text + _offset, take);
+            n += take;
+            _offset += take;
+            if (_offset == size) {
+                _fragment++;
+                _offset = 0;
+                if (tail && _fragment == fragments) _part++;
+            }
+            continue;
+        }
+        // part content, a short read of a known length ends the body early
+        size_t read = readContent(_parts[_part], buffer + n, length - n);
+        n += read;
+        _offset += read;
+        if (read == 0) {
+            _part++;
+            _fragment = 0;
+            _offset = 0;
+        }
+    }
+    return n;
+}
@@ -0,0 +1,370 @@
+#include "ServiceBatch.h"
+
+// response of the oldest item in flight
+enum batch_read_state_t {
+    brsStatus = 0,
+    brsHeaders = 1,
+    brsInterim = 2,     // header block of a 1xx response
+    brsContent = 3,
+    brsChunkSize = 4,
+    brsChunkData = 5,   // chunk data and its CRLF
+    brsTrailer = 6
+};
+
+static bool isIdempotent(const char* method) {
+    return strcmp(method, "POST") != 0 && strcmp(method, "PATCH") != 0;
+}
+
+ServiceBatch& ServiceBatch::add(const char* method, const char* relativeUri, const uint8_t* content,
+        size_t length, const char* contentType) {
+    if (_active) return *this;
+    if (_count == FLUENTHTTP_BATCH_SIZE) {
+        _overflow = true;
+        return *this;
+    }
+    service_batch_item_t& item = _items[_count++];
+    item = service_batch_item_t();
+    item.method = method;
+    item.uri = relativeUri;
+    item.contentType = contentType;
+    item.content = content;
+    item.contentLength = content != nullptr ? length : 0;
+    return *this;
+}
+
+void ServiceBatch::clear() {
+    if (_active) return;
+    _count = 0;
+    _overflow = false;
+    _finished = false;
+}
+
+uint8_t ServiceBatch::succeeded() const {
+    uint8_t n = 0;
+    for (uint8_t i = 0; i < _count; i++)
+        if (_items[i].done && _items[i].ok()) n++;
+    return n;
+}
+
+// first item at or behind index that is not done yet
+uint8_t ServiceBatch::pending(uint8_t index) const {
+    while (index < _count && _items[index].done) index++;
+    return index;
+}
+
+void ServiceBatch::markTiming(service_batch_item_t& item, service_timing_point_t point) {
+    #if FLUENTHTTP_METRICS
+    item.timing.mark(point, micros());
+    #endif
+}
+
+// called by ServiceEndpoint::fire() with the endpoint locked
+void ServiceBatch::start(ServiceEndpoint& endpoint) {
+    _endpoint = &endpoint;
+    _client = endpoint._client;
+    _active = true;
+    _finished = false;
+    _reconnect = true;
+    _next = 0;
+    _answered = 0;
+    _inflight = 0;
+    resetResponse();
+    for (uint8_t i = 0; i < _count; i++) {
+        service_batch_item_t& item = _items[i];
+        item.statusCode = 0;
+        item.error = nullptr;
+        item.sends = 0;
+        item.done = false;
+        #if FLUENTHTTP_METRICS
+        item.timing = service_request_timing_t();
+        #endif
+        markTiming(item, stpLocked);
+    }
+    if (_count == 0) {
+        finish();
+        return;
+    }
+    sendAhead();
+}
+
+// writes as many requests as the pipelining depth allows, all in as few writes as possible
+void ServiceBatch::sendAhead() {
+    if (_reconnect) {
+        if (!_endpoint->connectClient()) {
+            for (uint8_t i = pending(_next); i < _count; i = pending(i + 1))
+                settle(_items[i], 0, "failed to connect to server");
+            return;
+        }
+        _reconnect = false;
+        _t0 = millis();
+        for (uint8_t i = pending(_next); i < _count; i = pending(i + 1))
+            markTiming(_items[i], stpConnected);
+    }
+    else if (!_client->connected()) {
+        // closed by the server, the responses that arrived are read first
+        if (pending(_answered) < _next) return;
+        // nothing in flight, the rest goes out on a new connection
+        dropConnection(nullptr);
+        sendAhead();
+        return;
+    }
+    // without keep-alive the server closes behind every response
+    uint8_t depth = _endpoint->_keepAlive ? _pipeline : 1;
+    uint8_t first = _next;
+    bool sent = true;
+    _bufferLength = 0;
+    while (sent && _inflight < depth && (_next = pending(_next)) < _count) {
+        service_batch_item_t& item = _items[_next];
+        sent = serialize(item);
+        if (!item.done) {
+            item.sends++;
+            _inflight++;
+        }
+        _next++;
+    }
+    sent = sent && flush();
+    for (uint8_t i = first; i < _next; i++)
+        markTiming(_items[i], stpHeadSent);
+    if (!sent)
+        dropConnection("failed to send request");
+}
+
+bool ServiceBatch::serialize(service_batch_item_t& item) {
+    // the request line is encoded in place and has to fit into the buffer as a whole
+    size_t method = strlen(item.method);
+    while (true) {
+        size_t offset = _bufferLength + method + 1;
+        if (offset < sizeof(_buffer)) {
+            UriBuilder uri((char*)_buffer + offset, sizeof(_buffer) - offset);
+            uri.append(item.uri);
+            if (uri.ok()) {
+                memcpy(_buffer + _bufferLength, item.method, method);
+                _buffer[_bufferLength + method] = ' ';
+                _bufferLength = offset + uri.length();
+                break;
+            }
+        }
+        if (_bufferLength == 0) {
+            settle(item, 0, "request uri exceeds FLUENTHTTP_BATCH_BUFFER_SIZE or is malformed");
+            return true;
+        }
+        // try again in front of an empty buffer
+        if (!flush())
+            return false;
+    }
+    const String& head = _endpoint->headTemplate();
+    bool ok = write(" HTTP/1.1\r\n", 11) && write(head.c_str(), head.length());
+    if (ok && item.contentType != nullptr) {
+        ok = write("Content-Type: ", 14) && write(item.contentType, strlen(item.contentType))
+            && write("\r\n", 2);
+    }
+    if (ok && (item.content != nullptr || !isIdempotent(item.method))) {
+        char length[UriBuilder::INTEGER_SIZE];
+        size_t n = UriBuilder::formatInteger(length, item.contentLength);
+        ok = write("Content-Length: ", 16) && write(length, n) && write("\r\n", 2);
+    }
+    return ok && write("\r\n", 2) && write(item.content, item.contentLength);
+}
+
+// collects data in the buffer, larger blocks go out directly
+bool ServiceBatch::write(const void* data, size_t length) {
+    if (length == 0) return true;
+    if (_bufferLength + length > sizeof(_buffer) && !flush())
+        return false;
+    if (length > sizeof(_buffer)) {
+        bool sent = _client->write((const uint8_t*)data, length) == length;
+        _endpoint->recordBytes(length, 0);
+        return sent;
+    }
+    memcpy(_buffer + _bufferLength, data, length);
+    _bufferLength += length;
+    return true;
+}
+
+bool ServiceBatch::flush() {
+    if (_bufferLength == 0) return true;
+    size_t length = _bufferLength;
+    _bufferLength = 0;
+    bool sent = _client->write(_buffer, length) == length;
+    _endpoint->recordBytes(length, 0);
+    return sent;
+}
+
+void ServiceBatch::resetResponse() {
+    _readState = brsStatus;
+    _statusCode = 0;
+    _contentLeft = 0;
+    _chunked = false;
+    _close = false;
+}
+
+// reads what arrived of the oldest response, true once it is complete
+bool ServiceBatch::readResponse() {
+    service_batch_item_t& item = _items[_answered];
+    while (_client->available() > 0) {
+        if (_readState == brsContent || _readState == brsChunkData) {
+            if (!skipContent()) continue;
+            if (_readState == brsContent) return true;
+            _readState = brsChunkSize;
+            continue;
+        }
+        String line = _client->readStringUntil('\n');
+        _endpoint->recordBytes(0, line.length() + 1);
+        line.trim();
+        switch (_readState) {
+            case brsStatus: {
+                unsigned int httpSubversion = 1, statusCode = 0;
+                if (line.length() == 0) break;
+                markTiming(item, stpFirstByte);
+                sscanf(line.c_str(), "HTTP/1.%u %u", &httpSubversion, &statusCode);
+                if (statusCode == 0) {
+                    dropConnection("malformed response");
+                    return false;
+                }
+                _statusCode = statusCode;
+                _close = httpSubversion == 0;
+                _readState = statusCode < 200 ? brsInterim : brsHeaders;
+                break;
+            }
+            case brsInterim:
+                if (line.length() == 0) resetResponse();
+                break;
+            case brsHeaders: {
+                if (line.length() == 0) {
+                    markTiming(item, stpHeadersDone);
+                    bool empty = _statusCode == 204 || _statusCode == 304 || strcmp(item.method, "HEAD") == 0;
+                    if (empty || (!_chunked && _contentLeft == 0)) return true;
+                    _readState = _chunked ? brsChunkSize : brsContent;
+                    break;
+                }
+                int colon = line.indexOf(':');
+                if (colon < 0) break;
+                String key = line.substring(0, colon);
+                String val = line.substring(colon + 1);
+                val.trim();
+                if (key.equalsIgnoreCase("Content-Length"))
+                    _contentLeft = strtoul(val.c_str(), nullptr, 10);
+                else if (key.equalsIgnoreCase("Transfer-Encoding"))
+                    _chunked = val.equalsIgnoreCase("chunked");
+                else if (key.equalsIgnoreCase("Connection"))
+                    _close = _close || val.equalsIgnoreCase("close");
+                break;
+            }
+            case brsChunkSize:
+                if (line.length() == 0) break;
+                _contentLeft = strtoul(line.c_str(), nullptr, 16);
+                if (_contentLeft == 0) {
+                    _readState = brsTrailer;
+                    break;
+                }
+                // the data is followed by a CRLF
+                _contentLeft += 2;
+                _readState = brsChunkData;
+                break;
+            case brsTrailer:
+                if (line.length() == 0) return true;
+                break;
+        }
+    }
+    return false;
+}
+
+// skips content bytes that arrived, true once the current block is consumed
+bool ServiceBatch::skipContent() {
+    uint8_t buf[64];
+    int available;
+    while (_contentLeft > 0 && (available = _client->available()) > 0) {
+        size_t n = _contentLeft < sizeof(buf) ? _contentLeft : sizeof(buf);
+        if ((size_t)available < n) n = available;
+        int read = _client->read(buf, n);
+        if (read <= 0) break;
+        _contentLeft -= read;
+        _endpoint->recordBytes(0, read);
+    }
+    return _contentLeft == 0;
+}
+
+// the connection is gone, requests in flight are repeated if that is safe, otherwise they fail.
+// Without error the server announced the close, so it did not process any of them
+void ServiceBatch::dropConnection(const char* error) {
+    for (uint8_t i = pending(_answered); error != nullptr && i < _next; i = pending(i + 1)) {
+        service_batch_item_t& item = _items[i];
+        if (!isIdempotent(item.method) || item.sends > 1)
+            settle(item, 0, error);
+    }
+    _client->stop();
+    _reconnect = true;
+    _next = _answered;
+    _inflight = 0;
+    resetResponse();
+}
+
+void ServiceBatch::settle(service_batch_item_t& item, uint16_t statusCode, const char* error) {
+    item.statusCode = statusCode;
+    item.error = error;
+    item.done = true;
+    markTiming(item, stpBodyDone);
+    #if FLUENTHTTP_METRICS
+    _endpoint->_stats.recordRequest(item.timing, item.ok());
+    #endif
+}
+
+void ServiceBatch::finish() {
+    _active = false;
+    _finished = true;
+    if (!_endpoint->_keepAlive)
+        _client->stop();
+    // the endpoint is free again before the callback runs
+    _endpoint->unlock();
+    if (_completeCallback != 0)
+        _completeCallback(*this);
+}
+
+// settles all responses that arrived, so the next write refills the whole window.
+// True if any did
+bool ServiceBatch::readResponses() {
+    bool answered = false;
+    while (_answered < _next && readResponse()) {
+        answered = true;
+        _inflight--;
+        settle(_items[_answered], _statusCode, nullptr);
+        _t0 = millis();
+        bool close = _close || !_endpoint->_keepAlive;
+        resetResponse();
+        _answered = pending(_answered + 1);
+        if (close) {
+            dropConnection(nullptr);
+            break;
+        }
+    }
+    return answered;
+}
+
+bool ServiceBatch::yield() {
+    if (!_active) return _finished;
+    _answered = pending(_answered);
+    if (_answered < _next && !readResponses()) {
+        if (_client->available() == 0 && !_client->connected()) {
+            dropConnection("connection closed before response");
+        }
+        else if (millis() - _t0 >= _timeout) {
+            _endpoint->recordTimeout();
+            // nothing is repeated after a timeout
+            for (uint8_t i = _answered; i < _next; i = pending(i + 1))
+                settle(_items[i], 0, "timeout");
+            dropConnection("timeout");
+        }
+    }
+    if (pending(_next) < _count)
+        sendAhead();
+    if (pending(0) == _count)
+        finish();
+    return _finished;
+}
+
+void ServiceBatch::await() {
+    while (_active && !yield()) {
+        // responses of a pipelined batch follow each other closely
+        delay(1);
+    }
+}
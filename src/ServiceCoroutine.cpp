@@ -0,0 +1,210 @@
+#include "ServiceCoroutine.h"
+#include <new>
+
+static ServiceFramePool* defaultFramePool = nullptr;
+
+ServiceFramePool::ServiceFramePool(void* storage, size_t blockSize, size_t blockCount)
+    : _storage((uint8_t*)storage), _blockSize(blockSize / alignof(max_align_t) * alignof(max_align_t)),
+      _blockCount(blockCount) {
+    // thread all blocks into the free list
+    for (size_t i = blockCount; i > 0; i--) {
+        free_block_t* block = (free_block_t*)(_storage + (i - 1) * _blockSize);
+        block->next = _free;
+        _free = block;
+    }
+}
+
+void* ServiceFramePool::allocate(size_t size) {
+    if (size > _blockSize || _free == nullptr)
+        return nullptr;
+    free_block_t* block = _free;
+    _free = block->next;
+    _used++;
+    return block;
+}
+
+void ServiceFramePool::release(void* block) {
+    free_block_t* b = (free_block_t*)block;
+    b->next = _free;
+    _free = b;
+    _used--;
+}
+
+void* ServiceFramePool::allocateFrame(ServiceFramePool* pool, size_t size) {
+    size_t total = frameOffset + size;
+    frame_header_t* header = (frame_header_t*)(pool != nullptr
+        ? pool->allocate(total)
+        : ::operator new(total, std::nothrow));
+    if (header == nullptr)
+        return nullptr;
+    header->pool = pool;
+    return header->frame;
+}
+
+void ServiceFramePool::releaseFrame(void* frame) {
+    frame_header_t* header = (frame_header_t*)((uint8_t*)frame - frameOffset);
+    if (header->pool != nullptr)
+        header->pool->release(header);
+    else
+        ::operator delete(header);
+}
+
+void ServiceFramePool::setDefault(ServiceFramePool* pool) {
+    defaultFramePool = pool;
+}
+
+ServiceFramePool* ServiceFramePool::getDefault() {
+    return defaultFramePool;
+}
+
+#if defined(__cpp_impl_coroutine)
+
+ServiceAwaitable ServiceEndpoint::get(const char* relativeUri) {
+    return ServiceAwaitable(this, "GET", relativeUri);
+}
+
+ServiceAwaitable ServiceEndpoint::post(const char* relativeUri, uint8_t* data, size_t count) {
+    return ServiceAwaitable(this, "POST", relativeUri, data, count);
+}
+
+ServiceAwaitable::ServiceAwaitable(ServiceEndpoint* endpoint, const char* method, const char* relativeUri,
+        uint8_t* body, size_t bodyLength)
+    : _endpoint(endpoint), _method(method), _relativeUri(relativeUri), _body(body), _bodyLength(bodyLength) {
+}
+
+ServiceAwaitable::ServiceAwaitable(ServiceAwaitable&& other)
+    : _endpoint(other._endpoint), _method(other._method), _relativeUri(other._relativeUri),
+      _body(other._body), _bodyLength(other._bodyLength), _timeout(other._timeout),
+      _buffer(other._buffer), _bufferSize(other._bufferSize), _scheduler(other._scheduler) {
+}
+
+ServiceAwaitable::~ServiceAwaitable() {
+    // coroutine destroyed while suspended
+    if (_scheduler != nullptr)
+        _scheduler->remove(this);
+    ServiceRequest* request = _request.get();
+    if (request != nullptr && request->active())
+        request->cancel("awaiting coroutine destroyed");
+    _request.release();
+}
+
+void ServiceAwaitable::suspend(std::coroutine_handle<> continuation) {
+    _continuation = continuation;
+    _t0 = millis();
+    if (_scheduler == nullptr)
+        _scheduler = &ServiceScheduler::global();
+    _scheduler->add(this);
+    // send right away if the endpoint is free, poll() picks it up otherwise
+    tryStart();
+}
+
+bool ServiceAwaitable::tryStart() {
+    // empty while the endpoint is busy or all its pooled requests are unfinished
+    _request = _endpoint->request(_method, _relativeUri, 0);
+    ServiceRequest* request = _request.get();
+    if (request == nullptr)
+        return false;
+    _started = true;
+    // captures a single pointer only, fits into std::function without allocation
+    request->withTimeout(_timeout)
+        .onSuccess([this](service_response_t r) { captureResponse(srsCompleted, r); })
+        .onFailure([this](service_response_t r) { captureResponse(srsFailed, r); })
+        .onTimeout([this] {
+            _result.status = srsFailed;
+            _result.timedOut = true;
+        });
+    // filled from step() while the content arrives, the coroutine never waits for it
+    if (_buffer != nullptr)
+        request->withContentBuffer((uint8_t*)_buffer, _bufferSize);
+    if (_body != nullptr)
+        request->fireContent(_bodyLength, _body);
+    else
+        request->fire();
+    return true;
+}
+
+// called from the request callbacks, the content buffer is filled by then
+void ServiceAwaitable::captureResponse(service_request_status_t status, service_response_t r) {
+    _result.status = status;
+    _result.contentRead = _request->contentBuffered();
+    r.contentReader = nullptr;
+    _result.response = r;
+}
+
+// true once the coroutine can be resumed
+bool ServiceAwaitable::step() {
+    if (!_started) {
+        if (tryStart())
+            return false;
+        if (_timeout != 0 && millis() - _t0 >= _timeout) {
+            _result.status = srsFailed;
+            _result.timedOut = true;
+            _result.response.statusMessage = "endpoint busy";
+            return true;
+        }
+        return false;
+    }
+    // the slot of a finished request may be recycled before it was looked at here, the
+    // callbacks recorded the result then
+    ServiceRequest* request = _request.get();
+    if (request == nullptr)
+        return true;
+    if (!request->yield())
+        return false;
+    _result.status = request->getStatus();
+    return true;
+}
+
+void ServiceScheduler::rethrowEscaped() {
+    if (!_escaped) return;
+    std::exception_ptr escaped = _escaped;
+    _escaped = nullptr;
+    std::rethrow_exception(escaped);
+}
+
+ServiceScheduler& ServiceScheduler::global() {
+    static ServiceScheduler scheduler;
+    return scheduler;
+}
+
+void ServiceScheduler::add(ServiceAwaitable* awaitable) {
+    awaitable->_next = _head;
+    _head = awaitable;
+}
+
+void ServiceScheduler::remove(ServiceAwaitable* awaitable) {
+    for (ServiceAwaitable** link = &_head; *link != nullptr; link = &(*link)->_next) {
+        if (*link == awaitable) {
+            *link = awaitable->_next;
+            break;
+        }
+    }
+    awaitable->_next = nullptr;
+    awaitable->_scheduler = nullptr;
+}
+
+int ServiceScheduler::poll() {
+    // from a task that threw before its first co_await
+    rethrowEscaped();
+    int resumed = 0;
+    ServiceAwaitable** link = &_head;
+    while (*link != nullptr) {
+        ServiceAwaitable* awaitable = *link;
+        if (!awaitable->step()) {
+            link = &awaitable->_next;
+            continue;
+        }
+        // unlink before resuming, the coroutine destroys the awaitable when it continues
+        // and may add new awaitables at the head
+        *link = awaitable->_next;
+        awaitable->_next = nullptr;
+        awaitable->_scheduler = nullptr;
+        awaitable->_continuation.resume();
+        resumed++;
+        rethrowEscaped();
+        link = &_head;
+    }
+    return resumed;
+}
+
+#endif /* __cpp_impl_coroutine */
@@ -1,16 +1,32 @@
 #include "fluenthttp.h"
+#include "ServiceBatch.h"
+#include "DeflateEncoder.h"
+#include <assert.h>
 
-int ServiceEndpoint::connectClient() {
-    int result = _client->connected();
+int ServiceEndpoint::connectClient(Client* client) {
+    int result = client->connected();
     if (!result) {
+        bool tls = client == _tlsClient;
+        if (tls)
+            _tlsClient->offerSession(_tlsSession, _tlsSessionLength);
+        uint32_t t0 = micros();
         result = !_hasHostname 
-            ? _client->connect(_ipaddr, _port)
-            : _client->connect(_hostname.c_str(), _port); 
+            ? client->connect(_ipaddr, _port)
+            : client->connect(_hostname.c_str(), _port); 
+        if (result)
+            recordConnect();
+        if (result && tls) {
+            // connect time as a whole if the client does not measure the handshake itself
+            uint32_t handshake = _tlsClient->handshakeMicros();
+            recordHandshake(handshake != 0 ? handshake : micros() - t0, _tlsClient->sessionResumed());
+            // servers may hand out a new ticket with every handshake, the latest one is kept
+            _tlsSessionLength = _tlsClient->saveSession(_tlsSession, FLUENTHTTP_TLS_SESSION_SIZE);
+        }
     }
     else
     {
         // read all available data to start clean
-        while (_client->available()) _client->read(); // TODO: how to make this more efficient?
+        while (client->available()) client->read(); // TODO: how to make this more efficient?
     }
     return result;
 }
@@ -18,6 +34,8 @@ int ServiceEndpoint::connectClient() {
 void ServiceEndpoint::createSemaphores() {
     _waitHandle = xSemaphoreCreateBinary();
     xSemaphoreGive(_waitHandle);
+    _poolLock = xSemaphoreCreateBinary();
+    xSemaphoreGive(_poolLock);
 }
 
 ServiceEndpoint::ServiceEndpoint(const char* hostname) 
@@ -40,13 +58,130 @@ ServiceEndpoint::ServiceEndpoint(IPAddress ip, uint16_t port)
     createSemaphores();
 }
 
+ServiceEndpoint::~ServiceEndpoint() {
+    delete _hedge;
+    delete _deflate;
+    delete[] _tlsSession;
+    delete[] _pool;
+    vSemaphoreDelete(_waitHandle);
+    vSemaphoreDelete(_poolLock);
+}
+
 ServiceEndpoint& ServiceEndpoint::withKeepAlive(bool keepAliveHeader) {
-    _keepAlive = keepAliveHeader;
+    if (_keepAlive != keepAliveHeader) {
+        _keepAlive = keepAliveHeader;
+        _headTemplateValid = false;
+    }
+    return *this;
+}
+
+ServiceEndpoint& ServiceEndpoint::withDefaultHeader(const char* key, const char* value) {
+    _defaultHeaders += key;
+    _defaultHeaders += ": ";
+    _defaultHeaders += value;
+    _defaultHeaders += "\r\n";
+    _headTemplateValid = false;
+    return *this;
+}
+
+ServiceEndpoint& ServiceEndpoint::withWorker(ServiceWorker* worker) {
+    _worker = worker;
+    return *this;
+}
+
+ServiceEndpoint& ServiceEndpoint::withRetry(const service_retry_policy_t& policy) {
+    _retry = policy;
+    return *this;
+}
+
+ServiceEndpoint& ServiceEndpoint::withHedging(Client* secondClient, uint32_t delay) {
+    _hedgeClient = secondClient;
+    _hedgeDelay = delay;
+    // allocated once, reused by every hedge
+    if (_hedge == nullptr && secondClient != nullptr)
+        _hedge = new ServiceRequest();
+    return *this;
+}
+
+ServiceEndpoint& ServiceEndpoint::withExpectContinue(size_t threshold, uint16_t wait) {
+    _continueThreshold = threshold;
+    _continueWait = wait;
+    return *this;
+}
+
+ServiceEndpoint& ServiceEndpoint::withCompression(service_content_coding_t coding, size_t threshold) {
+    _coding = coding;
+    _compressThreshold = threshold;
+    _compressRejected = false;
+    // allocated once, reused by every request
+    if (_deflate == nullptr && coding != sccIdentity)
+        _deflate = new DeflateEncoder(coding);
+    if (_deflate != nullptr)
+        _deflate->withCoding(coding);
+    return *this;
+}
+
+ServiceEndpoint& ServiceEndpoint::withRequestPool(uint8_t slots) {
+    xSemaphoreTake(_poolLock, portMAX_DELAY);
+    resizePool(slots);
+    xSemaphoreGive(_poolLock);
+    return *this;
+}
+
+void ServiceEndpoint::resizePool(uint8_t slots) {
+    // slots whose request was not released are kept as they are
+    bool used = false;
+    uint16_t generation = 0;
+    for (uint8_t i = 0; i < _poolSize; i++) {
+        used |= _pool[i].used;
+        if (_pool[i].generation > generation)
+            generation = _pool[i].generation;
+    }
+    if (slots > 0 && slots != _poolSize && !used) {
+        delete[] _pool;
+        _pool = new service_request_slot_t[slots];
+        _poolSize = slots;
+        // every slot continues after the highest generation handed out, so handles
+        // of the old pool stay stale
+        for (uint8_t i = 0; i < slots; i++)
+            _pool[i].generation = generation;
+    }
+}
+
+ServiceEndpoint& ServiceEndpoint::clearDefaultHeaders() {
+    _defaultHeaders = String();
+    _headTemplateValid = false;
     return *this;
 }
 
+const String& ServiceEndpoint::headTemplate() {
+    // the fixed part of every request head only changes with the endpoint configuration,
+    // so it is serialized once and written as a single block afterwards
+    if (!_headTemplateValid) {
+        _headTemplate = String();
+        _headTemplate += "Host: ";
+        _headTemplate += _hasHostname ? _hostname : _ipaddr.toString();
+        _headTemplate += "\r\nAccept: */*\r\nConnection: ";
+        _headTemplate += _keepAlive ? "keep-alive" : "close";
+        _headTemplate += "\r\n";
+        _headTemplate += _defaultHeaders;
+        _headTemplateValid = true;
+    }
+    return _headTemplate;
+}
+
 void ServiceEndpoint::begin(Client* client) {
     _client = client;
+    _tlsClient = nullptr;
+}
+
+void ServiceEndpoint::begin(ServiceTlsClient* client) {
+    begin((Client*)client);
+    _tlsClient = client;
+    _tlsSessionLength = 0;
+    // allocated once, reused by every connect
+    if (_tlsSession == nullptr)
+        _tlsSession = new uint8_t[FLUENTHTTP_TLS_SESSION_SIZE];
 }
 
 bool ServiceEndpoint::unlock() {
@@ -61,25 +196,113 @@ void ServiceEndpoint::forceUnlock() {
 
 void ServiceEndpoint::close() {
     _client->stop();
+    if (_hedgeClient != nullptr)
+        _hedgeClient->stop();
 }
 
 bool ServiceEndpoint::beginRequest(const char* relativeUri, const char* httpMethod, ServiceRequest& request, int lockTimeout) {
     // acquire the semaphore first
     if (xSemaphoreTake(_waitHandle, lockTimeout) == pdFALSE)
         return false;
+    startRequest(relativeUri, httpMethod, request);
+    return true;
+}
 
-    request = ServiceRequest(_client, this);
-    if (!connectClient()) {
-        request.fail("failed to connect to server");
-        return true;
+ServiceRequestHandle ServiceEndpoint::request(const char* httpMethod, const char* relativeUri, int lockTimeout) {
+    if (xSemaphoreTake(_waitHandle, lockTimeout) == pdFALSE)
+        return ServiceRequestHandle();
+    xSemaphoreTake(_poolLock, portMAX_DELAY);
+    // allocated once with the first request(), reused by every later one
+    if (_pool == nullptr)
+        resizePool(FLUENTHTTP_REQUEST_POOL);
+    // a free slot, else the oldest finished one
+    service_request_slot_t* slot = nullptr;
+    for (uint8_t i = 0; i < _poolSize; i++) {
+        service_request_slot_t& s = _pool[i];
+        if (!s.used) {
+            slot = &s;
+            break;
+        }
+        if (s.request.finished() && (slot == nullptr || s.issued < slot->issued))
+            slot = &s;
     }
+    if (slot == nullptr) {
+        xSemaphoreGive(_poolLock);
+        unlock();
+        return ServiceRequestHandle();
+    }
+    // handles of the previous request go stale
+    slot->generation++;
+    slot->used = true;
+    slot->issued = ++_poolIssued;
+    xSemaphoreGive(_poolLock);
+    startRequest(relativeUri, httpMethod, slot->request);
+    return ServiceRequestHandle(this, slot - _pool, slot->generation);
+}
+
+void ServiceEndpoint::release(uint8_t slot, uint16_t generation) {
+    ServiceRequest* request = pooled(slot, generation);
+    if (request == nullptr)
+        return;
+    // cancelling gives the request lock back, request() may take the slot right after
+    if (request->active())
+        request->cancel("request released");
+    xSemaphoreTake(_poolLock, portMAX_DELAY);
+    if (pooled(slot, generation) != nullptr) {
+        _pool[slot].used = false;
+        _pool[slot].generation++;
+    }
+    xSemaphoreGive(_poolLock);
+}
+
+void ServiceEndpoint::startRequest(const char* relativeUri, const char* httpMethod, ServiceRequest& request) {
+    request = ServiceRequest(_client, this);
+    request._retry = _retry;
+    request.markTiming(stpLocked);
+    // a worker connects on its own task when the request is fired, a failed
+    // connect is reported or retried once the request is fired
+    if (_worker != nullptr || !connectClient())
+        request._reconnect = true;
+    else
+        request.markTiming(stpConnected);
     request.beginRequest();
+    // the endpoint head template is spliced in once the uri is complete
     request.call(httpMethod, relativeUri);
-    request.addHeader("Host", _hasHostname ? _hostname.c_str() : _ipaddr.toString().c_str());
-    request.addHeader("Accept", "*/*");
-    request.addHeader("Connection", _keepAlive ? "keep-alive" : "close");
     request.withKeepAlive(_keepAlive);
+}
+
+ServiceRequest* ServiceRequestHandle::get() const {
+    return _endpoint != nullptr ? _endpoint->pooled(_slot, _generation) : nullptr;
+}
+
+ServiceRequest* ServiceRequestHandle::operator->() const {
+    ServiceRequest* request = get();
+    assert(request != nullptr && "stale request handle");
+    return request;
+}
+
+void ServiceRequestHandle::release() {
+    if (_endpoint != nullptr)
+        _endpoint->release(_slot, _generation);
+}
+
+bool ServiceEndpoint::fire(ServiceBatch& batch, int lockTimeout) {
+    if (batch.active() || xSemaphoreTake(_waitHandle, lockTimeout) == pdFALSE)
+        return false;
+    // one lock and one connection for all requests of the batch
+    batch.start(*this);
+    return true;
+}
+
+bool ServiceEndpoint::getStats(service_endpoint_stats_t& snapshot, bool reset) {
+    #if FLUENTHTTP_METRICS
+    snapshot = _stats;
+    if (reset)
+        _stats = service_endpoint_stats_t();
     return true;
+    #else
+    return false;
+    #endif
 }
 
 bool ServiceEndpoint::get(const char* relativeUri, ServiceRequest& request, int lockTimeout) {
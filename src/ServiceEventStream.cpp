@@ -0,0 +1,261 @@
+#include "ServiceEventStream.h"
+
+// chunked transfer coding
+enum event_chunk_state_t {
+    ecsSize = 0,
+    ecsExtension = 1,   // rest of the size line
+    ecsData = 2,
+    ecsDataEnd = 3,     // CRLF behind the data
+    ecsDone = 4
+};
+
+// lines of the event stream
+enum event_parse_state_t {
+    epsField = 0,
+    epsValueStart = 1,  // behind the colon, a single space is skipped
+    epsValue = 2,
+    epsIgnore = 3       // comment or unknown field
+};
+
+enum event_field_t {
+    efNone = 0,
+    efEvent = 1,
+    efData = 2,
+    efId = 3,
+    efRetry = 4
+};
+
+ServiceEventStream::ServiceEventStream(service_event_callback_t callback)
+        : _callback(callback) {
+    _data[0] = 0;
+    _event[0] = 0;
+    _id[0] = 0;
+    _idBuffer[0] = 0;
+}
+
+ServiceEventStream& ServiceEventStream::withLastEventId(const char* id) {
+    _idLength = 0;
+    while (id[_idLength] != 0 && (size_t)_idLength + 1 < sizeof(_id)) {
+        _id[_idLength] = id[_idLength];
+        _idLength++;
+    }
+    _id[_idLength] = 0;
+    memcpy(_idBuffer, _id, _idLength + 1);
+    return *this;
+}
+
+void ServiceEventStream::begin(bool chunked) {
+    _opened = true;
+    _closed = false;
+    _chunked = chunked;
+    _chunkState = ecsSize;
+    _chunkLeft = 0;
+    _state = epsField;
+    _cr = false;
+    _fieldLength = 0;
+    _target = efNone;
+    _dataLength = 0;
+    _data[0] = 0;
+    _truncated = false;
+    _eventLength = 0;
+    _event[0] = 0;
+    // an id of the interrupted event does not count
+    _idLength = strlen(_id);
+    memcpy(_idBuffer, _id, _idLength + 1);
+}
+
+bool ServiceEventStream::feed(const uint8_t* data, size_t length) {
+    if (!_chunked) {
+        parse(data, length);
+        return true;
+    }
+    size_t i = 0;
+    while (i < length && !_closed) {
+        uint8_t c = data[i];
+        switch (_chunkState) {
+            case ecsSize: {
+                int digit = c >= '0' && c <= '9' ? c - '0'
+                    : c >= 'a' && c <= 'f' ? c - 'a' + 10
+                    : c >= 'A' && c <= 'F' ? c - 'A' + 10
+                    : -1;
+                i++;
+                if (digit >= 0) {
+                    if (_chunkLeft > 0x0FFFFFFF) return false;
+                    _chunkLeft = (_chunkLeft << 4) | digit;
+                }
+                else if (c == '\n') {
+                    _chunkState = _chunkLeft > 0 ? ecsData : ecsDone;
+                }
+                else {
+                    _chunkState = ecsExtension;
+                }
+                break;
+            }
+            case ecsExtension:
+                i++;
+                if (c == '\n')
+                    _chunkState = _chunkLeft > 0 ? ecsData : ecsDone;
+                break;
+            case ecsData: {
+                size_t n = length - i;
+                if (n > _chunkLeft) n = _chunkLeft;
+                parse(data + i, n);
+                i += n;
+                _chunkLeft -= n;
+                if (_chunkLeft == 0)
+                    _chunkState = ecsDataEnd;
+                break;
+            }
+            case ecsDataEnd:
+                i++;
+                if (c == '\n')
+                    _chunkState = ecsSize;
+                break;
+            default:
+                return false;
+        }
+    }
+    return _chunkState != ecsDone;
+}
+
+void ServiceEventStream::parse(const uint8_t* data, size_t length) {
+    for (size_t i = 0; i < length && !_closed; i++) {
+        char c = data[i];
+        // lines end with CRLF, LF or CR
+        if (_cr && c == '\n') {
+            _cr = false;
+            continue;
+        }
+        _cr = c == '\r';
+        if (c == '\r' || c == '\n') {
+            endLine();
+            continue;
+        }
+        switch (_state) {
+            case epsField:
+                if (c == ':') {
+                    // a line starting with a colon is a comment
+                    if (_fieldLength == 0)
+                        _state = epsIgnore;
+                    else
+                        endField();
+                }
+                else if (_fieldLength < sizeof(_field)) {
+                    _field[_fieldLength++] = c;
+                }
+                else {
+                    _fieldLength = sizeof(_field) + 1;
+                }
+                break;
+            case epsValueStart:
+                _state = epsValue;
+                if (c != ' ')
+                    putValue(c);
+                break;
+            case epsValue:
+                putValue(c);
+                break;
+            default:
+                break;
+        }
+    }
+}
+
+// the field name is complete, its value follows
+void ServiceEventStream::endField() {
+    _target = efNone;
+    if (_fieldLength == 5 && memcmp(_field, "event", 5) == 0) {
+        _target = efEvent;
+        _eventLength = 0;
+        _event[0] = 0;
+    }
+    else if (_fieldLength == 4 && memcmp(_field, "data", 4) == 0) {
+        _target = efData;
+    }
+    else if (_fieldLength == 2 && memcmp(_field, "id", 2) == 0) {
+        _target = efId;
+        _idLength = 0;
+        _idBuffer[0] = 0;
+    }
+    else if (_fieldLength == 5 && memcmp(_field, "retry", 5) == 0) {
+        _target = efRetry;
+        _retry = 0;
+        _retryDigits = 0;
+        _retryValid = true;
+    }
+    _state = _target == efNone ? epsIgnore : epsValueStart;
+}
+
+void ServiceEventStream::putValue(char c) {
+    switch (_target) {
+        case efEvent:
+            if ((size_t)_eventLength + 1 < sizeof(_event)) {
+                _event[_eventLength++] = c;
+                _event[_eventLength] = 0;
+            }
+            break;
+        case efData:
+            if (_dataLength + 1 < sizeof(_data)) {
+                _data[_dataLength++] = c;
+                _data[_dataLength] = 0;
+            }
+            else {
+                _truncated = true;
+            }
+            break;
+        case efId:
+            if ((size_t)_idLength + 1 < sizeof(_idBuffer)) {
+                _idBuffer[_idLength++] = c;
+                _idBuffer[_idLength] = 0;
+            }
+            break;
+        case efRetry:
+            if (c >= '0' && c <= '9' && _retryDigits < 9) {
+                _retry = _retry * 10 + (c - '0');
+                _retryDigits++;
+            }
+            else {
+                _retryValid = false;
+            }
+            break;
+    }
+}
+
+void ServiceEventStream::endLine() {
+    if (_state == epsField) {
+        if (_fieldLength == 0) {
+            // a blank line completes the event
+            dispatch();
+            return;
+        }
+        // a field without a colon has an empty value
+        endField();
+    }
+    if (_state != epsIgnore) {
+        if (_target == efData)
+            putValue('\n');
+        else if (_target == efRetry && _retryValid && _retryDigits > 0)
+            _reconnectDelay = _retry;
+    }
+    _state = epsField;
+    _fieldLength = 0;
+    _target = efNone;
+}
+
+void ServiceEventStream::dispatch() {
+    // the event is complete, a reconnect resumes behind it
+    memcpy(_id, _idBuffer, _idLength + 1);
+    if (_dataLength > 0) {
+        // the newline behind the last data line is not part of the data
+        if (!_truncated && _data[_dataLength - 1] == '\n')
+            _data[--_dataLength] = 0;
+        service_event_t event = { _eventLength > 0 ? _event : "message", _data, _dataLength, _id, _truncated };
+        if (_callback != 0)
+            _callback(event);
+    }
+    _dataLength = 0;
+    _data[0] = 0;
+    _truncated = false;
+    _eventLength = 0;
+    _event[0] = 0;
+}
@@ -0,0 +1,53 @@
+#include "ServiceMetrics.h"
+
+static const uint32_t bucketLimits[FLUENTHTTP_HISTOGRAM_BUCKETS] = {
+    500, 1000, 2000, 5000, 10000, 20000, 50000,
+    100000, 200000, 500000, 1000000, 2000000, 5000000, UINT32_MAX
+};
+
+uint32_t service_latency_histogram_t::bucketLimit(uint8_t bucket) {
+    return bucketLimits[bucket < FLUENTHTTP_HISTOGRAM_BUCKETS ? bucket : FLUENTHTTP_HISTOGRAM_BUCKETS - 1];
+}
+
+void service_latency_histogram_t::record(uint32_t micros) {
+    uint8_t bucket = 0;
+    while (micros > bucketLimits[bucket])
+        bucket++;
+    buckets[bucket]++;
+    count++;
+    sumMicros += micros;
+    if (micros > maxMicros)
+        maxMicros = micros;
+}
+
+uint32_t service_latency_histogram_t::percentileMicros(uint8_t percent) const {
+    if (count == 0) return 0;
+    uint32_t rank = (uint32_t)(((uint64_t)count * percent + 99) / 100);
+    uint32_t seen = 0;
+    for (uint8_t i = 0; i < FLUENTHTTP_HISTOGRAM_BUCKETS; i++) {
+        seen += buckets[i];
+        if (seen >= rank)
+            return bucketLimits[i] < maxMicros ? bucketLimits[i] : maxMicros;
+    }
+    return maxMicros;
+}
+
+void service_endpoint_stats_t::recordRequest(const service_request_timing_t& timing, bool completed) {
+    requests++;
+    if (completed)
+        this->completed++;
+    else
+        failures++;
+
+    if (timing.reached(stpConnected))
+        connect.record(timing.elapsed(stpLocked, stpConnected));
+    if (timing.reached(stpHeadSent))
+        send.record(timing.elapsed(stpConnected, stpHeadSent));
+    if (timing.reached(stpFirstByte))
+        firstByte.record(timing.elapsed(stpHeadSent, stpFirstByte));
+    if (timing.reached(stpHeadersDone))
+        headers.record(timing.elapsed(stpFirstByte, stpHeadersDone));
+    if (timing.reached(stpHeadersDone) && timing.reached(stpBodyDone))
+        content.record(timing.elapsed(stpHeadersDone, stpBodyDone));
+    total.record(timing.elapsed(stpLocked, stpBodyDone));
+}
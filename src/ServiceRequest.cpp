@@ -1,36 +1,83 @@
 #include "fluenthttp.h"
+#include "ServiceWorker.h"
+#include "ServiceEventStream.h"
+#include "DeflateEncoder.h"
 
-// TODO: ServiceRequest nicht mehr als Referenz liefern, die vom Service überprüft wird,
-// sondern als Copy-Objekt und im Objekt die Semaphore im Service steuern
-// Problem: Dangling References
+// requests passed by reference to ServiceEndpoint::beginRequest() are driven until they finished
+// and must outlive that. ServiceEndpoint::request() hands out pooled ones behind checked handles
 
 int service_response_t::nextChunk() {
-    if (this->contentReader->available() == 0) return 0;
     if (!this->chunked) {
+        if (this->contentReader->available() == 0) return 0;
         return this->contentLength;
     }
-    else
-    {
-        String chunkLenHex;
-        do {
-            if (this->contentReader->available() == 0) return 0;
-            chunkLenHex = this->contentReader->readStringUntil('\n');
-            chunkLenHex.trim();
-            chunkLenHex.toUpperCase();
-        } while (chunkLenHex.length() == 0);
-        int chunkLen = strtol(chunkLenHex.c_str(), nullptr, 16);
-        return chunkLen;
+    if (_chunkMalformed) return 0;
+    // the size line may arrive in pieces, what was read is kept for the next call
+    _chunkPending = true;
+    while (this->contentReader->available() > 0) {
+        int c = this->contentReader->read();
+        if (c < 0) break;
+        int size = chunkSizeByte(c);
+        if (!_chunkPending) return size;
+    }
+    return 0;
+}
+
+int service_response_t::chunkSizeByte(int c) {
+    _chunkPending = true;
+    if (c == '\n') {
+        // the empty line behind the previous chunk
+        if (!_chunkSized) {
+            _chunkExtension = false;
+            return 0;
+        }
+        int size = (int)_chunkSize;
+        _chunkSize = 0;
+        _chunkSized = false;
+        _chunkExtension = false;
+        _chunkPending = false;
+        return size;
+    }
+    if (_chunkExtension || c == '\r') return 0;
+    int digit = c >= '0' && c <= '9' ? c - '0'
+        : c >= 'a' && c <= 'f' ? c - 'a' + 10
+        : c >= 'A' && c <= 'F' ? c - 'A' + 10 : -1;
+    if (digit < 0) {
+        _chunkExtension = true;
+        return 0;
+    }
+    // leading zeros do not count, a size beyond an int ends the content
+    if (_chunkSize > (uint32_t)(INT32_MAX - digit) / 16) {
+        _chunkMalformed = true;
+        _chunkPending = false;
+        return 0;
     }
+    _chunkSize = _chunkSize * 16 + digit;
+    _chunkSized = true;
+    return 0;
+}
+
+// xorshift32, only has to spread the retries of several clients apart
+static uint32_t retryJitter() {
+    static uint32_t state = 0;
+    if (state == 0) state = micros() | 1;
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return state;
 }
 
 void ServiceRequest::beginRequest() {
-    _status = srsArmed;
+    setStatus(srsArmed);
 }
 
-void ServiceRequest::fail(const char* message)
+void ServiceRequest::fail(const char* message, bool fireNow)
 {
-    bool wasntUninitialized = _status != srsUninitialized;
-    _status = srsPrefailed;
+    // callbacks of worker driven requests run on the dispatching task
+    if (_worker != nullptr) fireNow = false;
+    bool wasntUninitialized = fireNow && _status != srsUninitialized;
+    setStatus(srsPrefailed);
+    trace(steFailure, 0, message, strlen(message));
     _response = service_response_t();
     _response.statusMessage = message;
     if (wasntUninitialized) {
@@ -43,38 +90,121 @@ void ServiceRequest::call(const char* method, const char* relativeUri)
 {
     if (_status != srsArmed)
         return;
-    //log_w("[%X]!> call vs %X", ((size_t)this), _client);
-    _status = srsIncomplete;
-    // check if client is connected, connect otherwise
-    _client->print(method);
-    _client->print(' ');
-    _client->print(relativeUri); // TODO: URL Encode
-    _client->println(" HTTP/1.1");
+    setStatus(srsIncomplete);
+    _idempotent = strcmp(method, "POST") != 0 && strcmp(method, "PATCH") != 0;
+    _headLength = 0;
+    headWrite(method);
+    headWrite(" ", 1);
+    _uriStart = _headLength;
+    _uriOpen = true;
+    _uriHasQuery = false;
+    UriBuilder uri = uriBuilder();
+    uri.append(relativeUri);
+    commitUri(uri);
+    trace(steRequestLine, 0, _head, _headLength);
+}
+
+void ServiceRequest::headWrite(const char* data, size_t length)
+{
+    while (length > 0) {
+        if (_headLength == sizeof(_head)) {
+            if (_endpoint->_worker != nullptr) {
+                // not connected yet, the worker sends the head as a whole
+                fail("request head exceeds FLUENTHTTP_HEAD_BUFFER_SIZE", false);
+                return;
+            }
+            // header block larger than the buffer, send what we have
+            flushHead();
+        }
+        size_t n = sizeof(_head) - _headLength;
+        if (n > length) n = length;
+        memcpy(_head + _headLength, data, n);
+        _headLength += n;
+        data += n;
+        length -= n;
+    }
+}
+
+void ServiceRequest::flushHead()
+{
+    if (_headLength > 0) {
+        _client->write((const uint8_t*)_head, _headLength);
+        _endpoint->recordBytes(_headLength, 0);
+        trace(steBytesOut, _headLength);
+        _headLength = 0;
+        // the head can not be replayed anymore
+        _headFlushed = true;
+    }
+}
+
+UriBuilder ServiceRequest::uriBuilder()
+{
+    // the builder works in place on the head buffer, behind the method
+    return UriBuilder(_head + _uriStart, sizeof(_head) - _uriStart, _headLength - _uriStart, _uriHasQuery);
+}
+
+void ServiceRequest::commitUri(const UriBuilder& uri)
+{
+    if (!uri.ok()) {
+        // reported once the request is fired, callbacks are not attached yet
+        fail("request uri exceeds FLUENTHTTP_HEAD_BUFFER_SIZE or is malformed", false);
+        return;
+    }
+    _headLength = _uriStart + uri.length();
+    _uriHasQuery = uri.hasQuery();
+}
 
-    //Serial.printf("[%X]> ", (uint8_t)((size_t)this));
-    //Serial.print(method);
-    //Serial.print(' ');
-    //Serial.print(relativeUri); // TODO: URL Encode
-    //Serial.println(" HTTP/1.1");
+void ServiceRequest::closeUri()
+{
+    if (!_uriOpen) return;
+    _uriOpen = false;
+    headWrite(" HTTP/1.1\r\n");
+    // fixed headers of the endpoint, serialized once
+    const String& head = _endpoint->headTemplate();
+    headWrite(head.c_str(), head.length());
 }
 
 void ServiceRequest::finalize(service_request_status_t status)
 {
-    //log_w("[%X]!> finalize vs %X", ((size_t)this), _client);
     if (!finished()) {
-        _status = status;
-        if (!_keepAlive && _client != nullptr) {
+        bool streamed = _events != nullptr;
+        if (_hedged)
+            endHedge();
+        #if FLUENTHTTP_METRICS
+        markTiming(stpBodyDone);
+        if (status == srsCompleted && !_response.chunked)
+            _endpoint->recordBytes(0, _response.contentLength);
+        if (!_isHedge && _endpoint != nullptr)
+            _endpoint->_stats.recordRequest(_timing, status == srsCompleted);
+        #endif
+        // kept for retries until now
+        _content = nullptr;
+        _contentLength = 0;
+        _contentString = String();
+        _body = nullptr;
+        if (_events != nullptr) {
+            _events->close();
+            _events = nullptr;
+        }
+        // a hedge ends with a response pending or on the stalled connection,
+        // an event stream may still be sending
+        if ((!_keepAlive || _isHedge || streamed) && _client != nullptr) {
             _client->stop();
         }
-        // unlock the endpoint
-        _endpoint->unlock();
+        // unlock the endpoint, a hedge runs under the lock of its request
+        if (!_isHedge)
+            _endpoint->unlock();
+        // last, a request finalized by ServiceWorker::dispatch() on another task may be
+        // gone as soon as its owner sees it finished
+        setStatus(status);
     }
 }
 
 void ServiceRequest::handleResponseBegin() 
 {
     String line = _client->readStringUntil('\n'); // next line
-    //Serial.printf("[%X]> %s", (uint8_t)((size_t)this), line.c_str());
+    _endpoint->recordBytes(0, line.length() + 1);
+    trace(steBytesIn, line.length() + 1);
     unsigned int statusCode = 0;
     int httpSubversion = 0;
     sscanf(line.c_str(), "HTTP/1.%u %u", &httpSubversion, &statusCode);
@@ -82,28 +212,53 @@ void ServiceRequest::handleResponseBegin()
         _response.statusMessage = line.substring(12);
         _response.statusMessage.trim();
         _response.statusCode = statusCode;
-        _status = srsReadingHeader;
+        trace(steResponse, statusCode);
+        setStatus(srsReadingHeader);
         if (httpSubversion == 0) {
             _keepAlive = false; // close after request
         }
+        if (statusCode < 200) {
+            // interim response, its header block is skipped
+            _interim = true;
+        }
+        else if (_bodyHeld) {
+            // final answer before the body was sent, the server may still expect it
+            _bodyHeld = false;
+            _keepAlive = false;
+        }
     }
 }
 
 void ServiceRequest::handleResponseHeader() {
     int peek = _client->peek();
-    //Serial.printf("[%X]> ", (uint8_t)((size_t)this));
     if (peek == '\r' || peek == '\n') {
         // header ends, content starts
         _client->readStringUntil('\n');
-        //Serial.println();
-        _status = srsReadingContent;
+        _endpoint->recordBytes(0, 2);
+        trace(steBytesIn, 2);
+        if (_interim) {
+            // wait for the final response, a 100 lets the held back body go
+            bool proceed = _response.statusCode == 100;
+            _interim = false;
+            _response = service_response_t();
+            if (_bodyHeld && proceed)
+                sendContent();
+            else
+                setStatus(_bodyHeld ? srsAwaitContinue : srsAwaitResponse);
+            return;
+        }
+        markTiming(stpHeadersDone);
+        _captured = 0;
+        _captureLeft = _response.chunked ? 0 : _response.contentLength;
+        setStatus(srsReadingContent);
         return;
     }
 
     // read next header field
     String key = _client->readStringUntil(':');
     String val = _client->readStringUntil('\n');
-    //Serial.printf("%s: %s\r\s", key.c_str(), val.c_str());
+    _endpoint->recordBytes(0, key.length() + val.length() + 2);
+    trace(steHeaderIn, key.length() + val.length() + 2, key.c_str(), key.length());
     val.trim();
     
     if (key == "Content-Length") {
@@ -112,6 +267,10 @@ void ServiceRequest::handleResponseHeader() {
     else if (key == "Content-Type") {
         _response.contentType = val;
     }
+    else if (key == "Retry-After" && (_response.statusCode == 503 || _response.statusCode == 429)) {
+        // delay in seconds, the HTTP-date form falls back to the backoff
+        _retryAfter = (uint32_t)atoi(val.c_str()) * 1000;
+    }
     else if (key == "Transfer-Encoding") {
         /*
         Transfer-Encoding: chunked
@@ -134,18 +293,65 @@ void ServiceRequest::handleResponseHeader() {
 }
 
 void ServiceRequest::handleResponseContent() {
+    if (_events != nullptr && _response.statusCode >= 200 && _response.statusCode < 300
+            && _response.statusCode != 204) {
+        openStream();
+        return;
+    }
+    _response.contentReader = _capture != nullptr ? nullptr : _client;
+    invokeResponseCallback();
+    finalize(_response.statusCode >= 400 ? srsFailed : srsCompleted);
+}
+
+// copies the content that arrived into the content buffer, true once it is complete or the buffer full
+bool ServiceRequest::captureContent() {
     _response.contentReader = _client;
+    if (!_response.chunked && _response.contentLength == 0) {
+        // length unknown, what arrived so far is taken
+        int available = _client->available();
+        size_t n = _captureSize - _captured;
+        if (available > 0 && (size_t)available < n) n = available;
+        if (available > 0) {
+            int read = _client->read(_capture + _captured, n);
+            if (read > 0) _captured += read;
+        }
+        return true;
+    }
+    while (_captured < _captureSize) {
+        if (_captureLeft == 0) {
+            if (!_response.chunked) return true;
+            _captureLeft = _response.nextChunk();
+            if (_captureLeft == 0 && _response.chunkMalformed()) {
+                // the rest of the connection can not be made sense of
+                _keepAlive = false;
+                fail("chunk size exceeds int");
+                return false;
+            }
+            if (_captureLeft == 0) return !_response.chunkPending();
+        }
+        int available = _client->available();
+        if (available <= 0) return false;
+        size_t n = _captureSize - _captured;
+        if (n > (size_t)available) n = available;
+        if (n > _captureLeft) n = _captureLeft;
+        int read = _client->read(_capture + _captured, n);
+        if (read <= 0) return false;
+        _captured += read;
+        _captureLeft -= read;
+    }
+    return true;
+}
+
+void ServiceRequest::invokeResponseCallback() {
     if (_response.statusCode >= 400) {
         if (_failCallback != 0) {
             _failCallback(_response);
         }
-        finalize(srsFailed);
     }
     else {
         if (_successCallback != 0) {
             _successCallback(_response);
         }
-        finalize(srsCompleted);
     }
 }
 
@@ -180,7 +386,7 @@ char* ServiceRequest::cstrContent(service_response_t r) {
 }
 
 ServiceRequest::ServiceRequest() 
-        : _client(nullptr) {
+        : _endpoint(nullptr), _client(nullptr) {
 }
 
 ServiceRequest::ServiceRequest(Client* s, ServiceEndpoint* endpoint) 
@@ -209,6 +415,11 @@ ServiceRequest& ServiceRequest::withTimeout(uint32_t timeout) {
 }
 
 bool ServiceRequest::yield() {
+    if (_worker != nullptr) {
+        // the worker drives the state machine, only pick up its completions here
+        _worker->dispatch();
+        return finished();
+    }
     // block parallel yield calls
     switch (_status) {
         case srsUninitialized:
@@ -236,45 +447,289 @@ bool ServiceRequest::yield() {
 }
 
 void ServiceRequest::innerYield()
+{
+    if (_status == srsBackoff) {
+        if (backoffElapsed())
+            attempt();
+        return;
+    }
+
+    if (_status == srsStreaming) {
+        readStream();
+        return;
+    }
+
+    if (continueDue())
+        sendContent();
+
+    bool headDone = readResponseHead() || (_hedged && takeHedge());
+    if (headDone && _hedged)
+        endHedge();
+    if (retryPending())
+        return;
+    // a content buffer is filled first, the request timeout still applies meanwhile
+    if (headDone && (_capture == nullptr || captureContent())) {
+        handleResponseContent();
+        return;
+    }
+    if (finished()) return;
+
+    if (hedgeDue())
+        startHedge();
+
+    if (timedOut()) {
+        trace(steTimeout, _timeout);
+        _endpoint->recordTimeout();
+        if (_events != nullptr && _events->opened()) {
+            // an open stream does not time out, it reconnects
+            retryOrFail(srcResetBeforeResponse, "event stream timed out");
+            return;
+        }
+        if (_timeoutCallback != 0)
+            _timeoutCallback();
+        finalize(srsFailed);
+        return;
+    }
+}
+
+// parses status line and header fields as far as available, true once the content can be read
+bool ServiceRequest::readResponseHead()
 {
     size_t btr = 0;
     while ((btr = _client->available()) != 0 || 
             // trigger callback when contentlength was not specified or 0
             (_status == srsReadingContent && _response.contentLength == 0)) {
         switch (_status) {
-            case srsAwaitResponse: handleResponseBegin(); break;
+            case srsAwaitResponse:
+            case srsAwaitContinue:
+                markTiming(stpFirstByte);
+                handleResponseBegin();
+                break;
             case srsReadingHeader: handleResponseHeader(); break;
             // content with length >0
             case srsReadingContent:
-                handleResponseContent();
-                return;
+                return true;
             default:
-                return;
+                return false;
         }
     }
+    return false;
+}
 
-    // check timeout
-    if  (_timeout != 0 && (millis() - _t0) >= _timeout) {
-        if (_timeoutCallback != 0)
-            _timeoutCallback();
-        finalize(srsFailed);
+bool ServiceRequest::timedOut()
+{
+    return _timeout != 0 && (millis() - _t0) >= _timeout;
+}
+
+// detects a failed attempt that may be repeated, true if the request went into backoff or failed
+bool ServiceRequest::retryPending()
+{
+    if ((_status == srsAwaitResponse || _status == srsAwaitContinue)
+            && !_hedged && _client->available() == 0 && !_client->connected()) {
+        // dead keep-alive connection or reset, nothing of the response was read yet
+        retryOrFail(srcResetBeforeResponse, "connection closed before response");
+        return true;
+    }
+    // an event stream answered with an error is not reconnected
+    bool streamed = _events != nullptr && _events->opened();
+    // a server asking to wait longer than maxBackoff gets its response as failure, not an early retry
+    bool unavailable = _response.statusCode == 503 || _response.statusCode == 429;
+    if (_status == srsReadingContent && unavailable && !streamed && canRetry(srcServiceUnavailable)
+            && _retryAfter <= _retry.maxBackoff) {
+        retryOrFail(srcServiceUnavailable, _response.statusCode == 503 ? "service unavailable" : "too many requests");
+        return true;
+    }
+    if (_status == srsReadingContent && _response.statusCode == 415 && _compress) {
+        // Unsupported Media Type, later requests of the endpoint go uncompressed
+        _endpoint->_compressRejected = true;
+        if (!_headFlushed && _body == nullptr) {
+            resendUncompressed();
+            return true;
+        }
+    }
+    return false;
+}
+
+bool ServiceRequest::canReopen(service_retry_condition_t condition)
+{
+    return (_retry.retryOn & condition) != 0
+        && _attempts < _retry.maxAttempts && !_headFlushed;
+}
+
+bool ServiceRequest::canRetry(service_retry_condition_t condition)
+{
+    return (_retry.retryOn & condition) != 0
+        && _attempts + 1 < _retry.maxAttempts
+        && _idempotent && !_headFlushed && _body == nullptr;
+}
+
+void ServiceRequest::retryOrFail(service_retry_condition_t condition, const char* message)
+{
+    // an event stream that was open once reconnects, up to maxAttempts times in a row
+    bool reopen = _events != nullptr && _events->opened();
+    if (reopen ? !canReopen(condition) : !canRetry(condition)) {
+        fail(message);
         return;
     }
+    if (_hedged)
+        endHedge();
+    // exponential backoff with equal jitter, a Retry-After of the server is taken as is
+    uint32_t delay = _retryAfter;
+    if (reopen) {
+        // the delay of the server, doubled for each reconnect that failed since the stream was open
+        _attempts++;
+        delay = _events->reconnectDelay();
+        uint32_t limit = delay > _retry.maxBackoff ? delay : _retry.maxBackoff;
+        for (uint8_t i = 1; i < _attempts && delay < limit; i++)
+            delay <<= 1;
+        if (delay > limit) delay = limit;
+    }
+    else {
+        _attempts++;
+        if (delay == 0) {
+            delay = _attempts <= 16 ? (uint32_t)_retry.backoff << (_attempts - 1) : _retry.maxBackoff;
+            if (delay > _retry.maxBackoff) delay = _retry.maxBackoff;
+            delay = delay / 2 + retryJitter() % (delay / 2 + 1);
+        }
+    }
+    _retryDelay = delay;
+    _retryAfter = 0;
+    _response = service_response_t();
+    _interim = false;
+    _bodyHeld = false;
+    // the connection is unusable or still carries the rejected response
+    _client->stop();
+    _reconnect = true;
+    _t0 = millis();
+    _endpoint->recordRetry();
+    trace(steRetry, delay, message, strlen(message));
+    setStatus(srsBackoff);
+}
+
+// connects if needed and sends the kept head and content, again after a backoff
+void ServiceRequest::attempt()
+{
+    if (_reconnect) {
+        // after a won hedge too, attempts go out over the endpoint's client
+        _client = _endpoint->_client;
+        if (!_endpoint->connectClient()) {
+            retryOrFail(srcConnectFailed, "failed to connect to server");
+            return;
+        }
+        _reconnect = false;
+        markTiming(stpConnected);
+    }
+    if (_events != nullptr)
+        writeEventHead();
+    send();
+}
+
+bool ServiceRequest::hedgeDue()
+{
+    ServiceEndpoint* e = _endpoint;
+    return !_hedgeFired && _status == srsAwaitResponse && _worker == nullptr
+        && e->_hedge != nullptr && e->_hedgeClient != nullptr && !e->_hedge->active()
+        && millis() - _t0 >= e->_hedgeDelay
+        // only plain GETs, the head must still be complete in the buffer
+        && !_headFlushed && strncmp(_head, "GET ", 4) == 0
+        && _contentLength == 0 && _contentString.length() == 0 && _body == nullptr && _events == nullptr;
+}
+
+// sends the kept head once more over the endpoint's second connection
+void ServiceRequest::startHedge()
+{
+    _hedgeFired = true;
+    ServiceRequest* hedge = _endpoint->_hedge;
+    *hedge = ServiceRequest(_endpoint->_hedgeClient, _endpoint);
+    hedge->_isHedge = true;
+    hedge->_keepAlive = _keepAlive;
+    // bound to the timeout of this request
+    hedge->_timeout = 0;
+    if (!_endpoint->connectClient(hedge->_client))
+        return;
+    hedge->beginRequest();
+    memcpy(hedge->_head, _head, _headLength);
+    hedge->_headLength = _headLength;
+    hedge->send();
+    _hedged = hedge->_status == srsAwaitResponse;
+    _endpoint->recordHedge(false);
+}
+
+// drives the hedge, true once its response head is complete and this request took it over
+bool ServiceRequest::takeHedge()
+{
+    ServiceRequest* hedge = _endpoint->_hedge;
+    if (hedge->finished() || (hedge->_status == srsAwaitResponse
+            && hedge->_client->available() == 0 && !hedge->_client->connected())) {
+        // this request carries on alone
+        endHedge();
+        return false;
+    }
+    if (!hedge->readResponseHead())
+        return false;
+
+    // the hedge won, this request continues on its connection and the stalled one is
+    // closed when the hedge is cancelled. The endpoint keeps its clients
+    Client* stalled = _client;
+    _client = hedge->_client;
+    hedge->_client = stalled;
+    _response = hedge->_response;
+    _keepAlive = hedge->_keepAlive;
+    #if FLUENTHTTP_METRICS
+    _timing.at[stpFirstByte] = hedge->_timing.at[stpFirstByte];
+    _timing.at[stpHeadersDone] = hedge->_timing.at[stpHeadersDone];
+    #endif
+    setStatus(hedge->_status);
+    _endpoint->recordHedge(true);
+    return true;
+}
+
+void ServiceRequest::endHedge()
+{
+    _hedged = false;
+    // the loser, closes its connection
+    _endpoint->_hedge->cancel("hedge lost");
+}
+
+ServiceRequest& ServiceRequest::withPathSegment(const char* segment) {
+    if (_status != srsIncomplete || !_uriOpen) return *this;
+    UriBuilder uri = uriBuilder();
+    uri.path(segment);
+    commitUri(uri);
+    return *this;
+}
+
+ServiceRequest& ServiceRequest::withQuery(const char* key, const char* value) {
+    if (_status != srsIncomplete || !_uriOpen) return *this;
+    UriBuilder uri = uriBuilder();
+    uri.query(key, value);
+    commitUri(uri);
+    return *this;
+}
+
+ServiceRequest& ServiceRequest::withQuery(const char* key, long value) {
+    if (_status != srsIncomplete || !_uriOpen) return *this;
+    UriBuilder uri = uriBuilder();
+    uri.query(key, value);
+    commitUri(uri);
+    return *this;
 }
 
 ServiceRequest& ServiceRequest::addHeader(const char* key, const char* value) {
     if (_status != srsIncomplete) return *this;
-    _client->print(key);
-    _client->print(": ");
-    _client->println(value);
-
-    //Serial.printf("[%X]> ", (uint8_t)((size_t)this));
-    //Serial.print(key);
-    //Serial.print(": ");
-    //Serial.println(value);
+    writeHeader(key, value);
     return *this;
 }
 
+void ServiceRequest::writeHeader(const char* key, const char* value) {
+    closeUri();
+    headWrite(key);
+    headWrite(": ", 2);
+    headWrite(value);
+    headWrite("\r\n", 2);
+    trace(steHeaderOut, 0, key, strlen(key));
+}
+
 ServiceRequest& ServiceRequest::fire() {
     if (_status == srsPrefailed) {
         // call failed callback directly
@@ -287,33 +742,296 @@ ServiceRequest& ServiceRequest::fire() {
         finalize(srsFailed);
     }
     else if (_status == srsIncomplete) {
-        _client->println();
-         //Serial.printf("[%X]> ", (uint8_t)((size_t)this));
-         //Serial.println();
-        _t0 = millis();
-        _status = srsAwaitResponse;
+        closeUri();
+        if (_events != nullptr) {
+            _eventHeadLength = _headLength;
+            writeEventHead();
+        }
+        else {
+            headWrite("\r\n", 2);
+        }
+        transmit();
     }
     return *this;
 }
 
 ServiceRequest& ServiceRequest::fireContent(size_t count, uint8_t* data) {
-    addHeader("Content-Length", String(count).c_str());
-    _client->println();
-    _client->write(data, count);
-    _t0 = millis();
-    _status = srsAwaitResponse;
+    if (_status != srsIncomplete) return fire();
+    writeContentHead(count);
+    _content = data;
+    _contentLength = count;
+    transmit();
     return *this;
 }
 
 ServiceRequest& ServiceRequest::fireContent(String data) {
-    addHeader("Content-Length", String(data.length()).c_str());
-    _client->println();
-    _client->print(data);
+    if (_status != srsIncomplete) return fire();
+    writeContentHead(data.length());
+    _contentString = std::move(data);
+    transmit();
+    return *this;
+}
+
+ServiceRequest& ServiceRequest::fireContent(ServiceBodySource& body) {
+    if (_status != srsIncomplete) return fire();
+    writeContentHead(body.size());
+    _body = &body;
+    transmit();
+    return *this;
+}
+
+// sends head and content right away or hands the request over to the endpoint's worker
+void ServiceRequest::transmit() {
+    if (_status != srsIncomplete) {
+        // head did not fit
+        fire();
+        return;
+    }
+    ServiceWorker* worker = _endpoint->_worker;
+    if (worker == nullptr) {
+        if (_reconnect)
+            // connecting failed when the request began
+            retryOrFail(srcConnectFailed, "failed to connect to server");
+        else
+            send();
+        return;
+    }
+    setStatus(srsQueued);
+    _worker = worker;
+    if (!worker->submit(this)) {
+        _worker = nullptr;
+        fail("service worker queue is full");
+    }
+}
+
+void ServiceRequest::expectContinue(size_t count) {
+    size_t threshold = _endpoint->_continueThreshold;
+    _expectContinue = threshold > 0 && count >= threshold;
+    if (_expectContinue)
+        writeHeader("Expect", "100-continue");
+}
+
+// declares the body and ends the head. A compressed body goes chunked since its size is only
+// known once it was sent, size is that of the plain body, -1 if unknown
+void ServiceRequest::writeContentHead(long size) {
+    closeUri();
+    _contentHeadLength = _headLength;
+    _compress = _endpoint->compresses(size);
+    if (_compress) {
+        writeHeader("Content-Encoding", _endpoint->_deflate->contentEncoding());
+        writeHeader("Transfer-Encoding", "chunked");
+    }
+    else if (size >= 0) {
+        char length[UriBuilder::INTEGER_SIZE];
+        UriBuilder::formatInteger(length, size);
+        writeHeader("Content-Length", length);
+    }
+    else {
+        writeHeader("Transfer-Encoding", "chunked");
+    }
+    if (size >= 0)
+        expectContinue(size);
+    headWrite("\r\n", 2);
+}
+
+// the server takes no compressed bodies, the head is rewritten for the plain content
+// and sent again on a new connection
+void ServiceRequest::resendUncompressed() {
+    _headLength = _contentHeadLength;
+    writeContentHead(_contentString.length() > 0 ? _contentString.length() : _contentLength);
+    _response = service_response_t();
+    _interim = false;
+    _bodyHeld = false;
+    // the rejection is still unread
+    _client->stop();
+    _reconnect = true;
+    _retryDelay = 0;
     _t0 = millis();
-    _status = srsAwaitResponse;
+    _endpoint->recordRetry();
+    trace(steRetry, 0, "content encoding rejected", 25);
+    setStatus(srsBackoff);
+}
+
+bool ServiceRequest::continueDue() {
+    // servers not knowing the expectation never answer it, the body goes anyway
+    return _status == srsAwaitContinue && millis() - _t0 >= _endpoint->_continueWait;
+}
+
+void ServiceRequest::send() {
+    // head and content stay in place, a retry sends them again
+    bool sent = _client->write((const uint8_t*)_head, _headLength) == _headLength;
+    _endpoint->recordBytes(_headLength, 0);
+    trace(steBytesOut, _headLength);
+    if (!sent) {
+        _t0 = millis();
+        // the connection is out of step with the server
+        _client->stop();
+        retryOrFail(srcResetBeforeResponse, "failed to send request");
+        return;
+    }
+    if (_expectContinue) {
+        // every attempt waits for the server to agree
+        _bodyHeld = true;
+        _t0 = millis();
+        setStatus(srsAwaitContinue);
+        return;
+    }
+    sendContent();
+}
+
+void ServiceRequest::sendContent() {
+    _bodyHeld = false;
+    bool sent = true;
+    const uint8_t* content = _content;
+    size_t length = _contentLength;
+    if (_contentString.length() > 0) {
+        content = (const uint8_t*)_contentString.c_str();
+        length = _contentString.length();
+    }
+    if (_compress) {
+        // restarts with every attempt, a plain source can only be read once though
+        DeflateEncoder* deflate = _endpoint->_deflate;
+        if (_body != nullptr)
+            deflate->begin(*_body);
+        else
+            deflate->begin(content, length);
+        sent = sendBody(*deflate);
+        _endpoint->recordCompression(deflate->consumed(), deflate->produced());
+    }
+    else if (_body != nullptr) {
+        sent = sendBody(*_body);
+    }
+    else if (length > 0) {
+        sent = _client->write(content, length) == length;
+        _endpoint->recordBytes(length, 0);
+        trace(steBytesOut, length);
+    }
+    markTiming(stpHeadSent);
+    _t0 = millis();
+    if (!sent) {
+        // the connection is out of step with the server
+        _client->stop();
+        retryOrFail(srcResetBeforeResponse, "failed to send request");
+        return;
+    }
+    setStatus(srsAwaitResponse);
+}
+
+// pulls the body source through a stack buffer, one write per buffer.
+// False if a write failed or the source did not match its declared size
+bool ServiceRequest::sendBody(ServiceBodySource& body) {
+    long size = body.size();
+    bool chunked = size < 0;
+    // room for the chunk size line in front of and the CRLF behind the data
+    uint8_t buffer[6 + FLUENTHTTP_BODY_BUFFER_SIZE + 2];
+    uint8_t* data = buffer + 6;
+    long total = 0;
+    bool sent = true;
+    size_t n;
+    while (sent && (n = body.read(data, FLUENTHTTP_BODY_BUFFER_SIZE)) > 0) {
+        total += n;
+        uint8_t* start = data;
+        size_t length = n;
+        if (chunked) {
+            char line[8];
+            int l = snprintf(line, sizeof(line), "%X\r\n", (unsigned int)n);
+            start -= l;
+            memcpy(start, line, l);
+            data[n] = '\r';
+            data[n + 1] = '\n';
+            length += l + 2;
+        }
+        sent = _client->write(start, length) == length;
+        _endpoint->recordBytes(length, 0);
+        trace(steBytesOut, length);
+    }
+    // a compressed source is checked against its declared size before the body ends
+    if (sent && _compress && _endpoint->_deflate->mismatched())
+        sent = false;
+    if (sent && chunked) {
+        sent = _client->write((const uint8_t*)"0\r\n\r\n", 5) == 5;
+        _endpoint->recordBytes(5, 0);
+    }
+    return sent && (chunked || total == size);
+}
+
+ServiceRequest& ServiceRequest::withContentBuffer(uint8_t* buffer, size_t size) {
+    _capture = buffer;
+    _captureSize = size;
+    _captured = 0;
     return *this;
 }
 
+ServiceRequest& ServiceRequest::withEventStream(ServiceEventStream& events) {
+    if (_status != srsIncomplete) return *this;
+    if (_endpoint->_worker != nullptr) {
+        fail("event streams are not driven by a service worker", false);
+        return *this;
+    }
+    _events = &events;
+    // reconnects only once this request opened the stream
+    _events->_opened = false;
+    addHeader("Accept", "text/event-stream");
+    addHeader("Cache-Control", "no-cache");
+    return *this;
+}
+
+// ends the head with the current Last-Event-ID, a reconnect resumes from there
+void ServiceRequest::writeEventHead() {
+    _headLength = _eventHeadLength;
+    const char* id = _events->lastEventId();
+    if (*id != 0) {
+        headWrite("Last-Event-ID: ");
+        headWrite(id);
+        headWrite("\r\n", 2);
+    }
+    headWrite("\r\n", 2);
+}
+
+// the response stays open, readStream() parses its content from now on
+void ServiceRequest::openStream() {
+    _events->begin(_response.chunked);
+    // reconnects are counted from here
+    _attempts = 0;
+    markTiming(stpHeadersDone);
+    _t0 = millis();
+    setStatus(srsStreaming);
+    if (_successCallback != 0) {
+        // the content belongs to the stream
+        service_response_t response = _response;
+        response.contentReader = nullptr;
+        _successCallback(response);
+    }
+}
+
+// feeds what arrived to the stream, reconnects once it ended, closed or idled
+void ServiceRequest::readStream() {
+    uint8_t buffer[FLUENTHTTP_EVENT_READ_SIZE];
+    bool open = true;
+    int available;
+    while (open && (available = _client->available()) > 0) {
+        size_t n = (size_t)available < sizeof(buffer) ? available : sizeof(buffer);
+        int read = _client->read(buffer, n);
+        if (read <= 0) break;
+        _endpoint->recordBytes(0, read);
+        _t0 = millis();
+        open = _events->feed(buffer, read);
+        // cancelled from the event callback
+        if (finished()) return;
+    }
+    if (!open) {
+        retryOrFail(srcResetBeforeResponse, "event stream ended");
+    }
+    else if (!_client->connected() && _client->available() == 0) {
+        retryOrFail(srcResetBeforeResponse, "event stream closed");
+    }
+    else if (_events->idleTimeout() != 0 && millis() - _t0 >= _events->idleTimeout()) {
+        trace(steTimeout, _events->idleTimeout());
+        _endpoint->recordTimeout();
+        retryOrFail(srcResetBeforeResponse, "event stream idle");
+    }
+}
+
 void ServiceRequest::cancel(const char* message) {
     try {
         if (finished()) return;
@@ -342,4 +1060,13 @@ void ServiceRequest::await() {
 
 service_request_status_t ServiceRequest::getStatus() {
     return _status;
+}
+
+bool ServiceRequest::getTiming(service_request_timing_t& timing) {
+    #if FLUENTHTTP_METRICS
+    timing = _timing;
+    return true;
+    #else
+    return false;
+    #endif
 }
\ No newline at end of file
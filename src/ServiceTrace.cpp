@@ -0,0 +1,8 @@
+#include "ServiceTrace.h"
+
+const char* serviceTraceEventName(service_trace_event_t event) {
+    static const char* const names[steCount] = {
+        "status", "request", "header>", "bytes>", "bytes<", "response", "header<", "timeout", "failure", "retry"
+    };
+    return event < steCount ? names[event] : "?";
+}
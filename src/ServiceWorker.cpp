@@ -0,0 +1,217 @@
+#include "ServiceWorker.h"
+
+#ifndef FLUENTHTTP_WORKER_READ_SIZE
+  #define FLUENTHTTP_WORKER_READ_SIZE 128
+#endif
+
+ServiceWorker::ServiceWorker() {
+    _submitLock = xSemaphoreCreateBinary();
+    xSemaphoreGive(_submitLock);
+    _dispatchLock = xSemaphoreCreateBinary();
+    xSemaphoreGive(_dispatchLock);
+}
+
+ServiceWorker::~ServiceWorker() {
+    end();
+    vSemaphoreDelete(_submitLock);
+    vSemaphoreDelete(_dispatchLock);
+}
+
+#ifdef ARDUINO_ARCH_ESP32
+void ServiceWorker::taskMain(void* arg) {
+    ServiceWorker* worker = (ServiceWorker*)arg;
+    worker->run();
+    // the worker may be gone right after this, end() waits for it
+    worker->_exited = true;
+    vTaskDelete(nullptr);
+}
+#endif
+
+bool ServiceWorker::begin(int core, uint32_t stackSize, int priority) {
+    if (_running) return true;
+    _running = true;
+    #ifdef ARDUINO_ARCH_ESP32
+    _exited = false;
+    if (xTaskCreatePinnedToCore(taskMain, "fluenthttp", stackSize, this, priority, &_task, core) != pdPASS) {
+        _running = false;
+        _exited = true;
+        return false;
+    }
+    #else
+    _thread = std::thread([this] { run(); });
+    #endif
+    return true;
+}
+
+void ServiceWorker::end() {
+    if (!_running) return;
+    _running = false;
+    #ifdef ARDUINO_ARCH_ESP32
+    // the task deletes itself after leaving run(), like join() on the host
+    while (!_exited)
+        vTaskDelay(1);
+    _task = nullptr;
+    #else
+    if (_thread.joinable())
+        _thread.join();
+    #endif
+}
+
+bool ServiceWorker::submit(ServiceRequest* request) {
+    xSemaphoreTake(_submitLock, portMAX_DELAY);
+    bool queued = _submissions.push(request);
+    xSemaphoreGive(_submitLock);
+    return queued;
+}
+
+void ServiceWorker::run() {
+    while (_running) {
+        if (!step()) {
+            // nothing to do, give other tasks on this core a chance
+            #ifdef ARDUINO_ARCH_ESP32
+            vTaskDelay(1);
+            #else
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            #endif
+        }
+    }
+}
+
+// one pass over all pending submissions and active slots, true if anything progressed
+bool ServiceWorker::step() {
+    bool progress = false;
+    ServiceRequest* request;
+    for (uint8_t i = 0; i < FLUENTHTTP_WORKER_SLOTS; i++) {
+        worker_slot_t& slot = _slots[i];
+        if (slot.request == nullptr) {
+            if (!_submissions.pop(request)) continue;
+            slot.body._pipe.clear();
+            slot.consumed = false;
+            slot.request = request;
+            progress = true;
+        }
+        progress |= stepSlot(i);
+    }
+    return progress;
+}
+
+bool ServiceWorker::stepSlot(uint8_t index) {
+    worker_slot_t& slot = _slots[index];
+    ServiceRequest* r = slot.request;
+    switch (r->_status) {
+        case srsBackoff:
+            if (!r->backoffElapsed()) return false;
+            // fall through, connect again and send
+        case srsQueued:
+            r->attempt();
+            if (r->_status == srsPrefailed)
+                complete(index, swcFailed);
+            return true;
+        case srsDispatching: {
+            if (slot.consumed) {
+                // finalized by the application, the request may be gone right after
+                complete(index, swcDone);
+                return true;
+            }
+            // move content from the socket into the pipe while the application reads it
+            uint8_t buf[FLUENTHTTP_WORKER_READ_SIZE];
+            size_t n = slot.body._pipe.space();
+            int available = r->_client->available();
+            if (available <= 0 || n == 0) return false;
+            if (n > (size_t)available) n = available;
+            if (n > sizeof(buf)) n = sizeof(buf);
+            int read = r->_client->read(buf, n);
+            if (read > 0)
+                slot.body._pipe.push(buf, read);
+            return read > 0;
+        }
+        default:
+            break;
+    }
+
+    if (r->continueDue())
+        r->sendContent();
+    bool headDone = r->readResponseHead();
+    // a content buffer is filled here, the application gets the complete content
+    if (!r->retryPending() && headDone && (r->_capture == nullptr || r->captureContent())) {
+        r->_response.contentReader = r->_capture != nullptr ? nullptr : &slot.body;
+        r->setStatus(srsDispatching);
+        complete(index, swcResponse);
+        return true;
+    }
+    if (r->_status == srsPrefailed) {
+        complete(index, swcFailed);
+        return true;
+    }
+    if (r->_status == srsBackoff)
+        return true;
+    if (r->timedOut()) {
+        r->trace(steTimeout, r->_timeout);
+        r->setStatus(srsDispatching);
+        complete(index, swcTimeout);
+        return true;
+    }
+    return false;
+}
+
+void ServiceWorker::complete(uint8_t index, service_worker_completion_kind_t kind) {
+    worker_slot_t& slot = _slots[index];
+    service_worker_completion_t completion = { slot.request, index, kind };
+    // at most one completion per slot and endpoint is outstanding, so this only spins
+    // when the application task stopped dispatching
+    while (!_completions.push(completion)) {
+        #ifdef ARDUINO_ARCH_ESP32
+        vTaskDelay(1);
+        #else
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        #endif
+    }
+    if (kind != swcResponse) {
+        // the application finalizes the request, the slot is not needed anymore
+        slot.request = nullptr;
+    }
+}
+
+int ServiceWorker::dispatch() {
+    int n = 0;
+    service_worker_completion_t c;
+    while (true) {
+        // callbacks run without the lock, they may fire or await other requests
+        xSemaphoreTake(_dispatchLock, portMAX_DELAY);
+        bool popped = _completions.pop(c);
+        xSemaphoreGive(_dispatchLock);
+        if (!popped) break;
+        ServiceRequest* r = c.request;
+        try {
+            switch (c.kind) {
+                case swcResponse:
+                    r->invokeResponseCallback();
+                    break;
+                case swcTimeout:
+                    r->_endpoint->recordTimeout();
+                    if (r->_timeoutCallback != 0)
+                        r->_timeoutCallback();
+                    r->finalize(srsFailed);
+                    break;
+                case swcFailed:
+                    // invokes the failure callback and finalizes
+                    r->fire();
+                    break;
+                case swcDone:
+                    r->finalize(r->_response.statusCode >= 400 ? srsFailed : srsCompleted);
+                    break;
+            }
+        }
+        catch (const std::exception& e) {
+            // something failed on user code
+            if (c.kind != swcResponse && c.kind != swcDone)
+                r->finalize(srsFailed);
+        }
+        if (c.kind == swcResponse) {
+            // the worker lets go of the request once the application is done with the content
+            _slots[c.slot].consumed = true;
+        }
+        n++;
+    }
+    return n;
+}
@@ -0,0 +1,109 @@
+#include "UriBuilder.h"
+
+// bit mask of uri_component_t values per ascii character in which it can be sent unescaped,
+// everything above 0x7F is always encoded
+static const uint8_t uriCharacterTable[128] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 7, 0, 0, 7, 1, 3, 7, 7, 7, 7, 3, 7, 7, 7, 5,
+    7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 0, 3, 0, 5,
+    7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7,
+    7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 1, 0, 1, 0, 7,
+    0, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7,
+    7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 0, 0, 0, 7, 0,
+};
+
+static const char hexDigits[] = "0123456789ABCDEF";
+
+bool UriBuilder::isUnescaped(char c, uri_component_t component) {
+    uint8_t u = (uint8_t)c;
+    return u < 128 && (uriCharacterTable[u] & component) != 0;
+}
+
+size_t UriBuilder::formatInteger(char* buffer, long value) {
+    char digits[INTEGER_SIZE];
+    size_t n = 0;
+    unsigned long v = value < 0 ? 0UL - (unsigned long)value : (unsigned long)value;
+    do {
+        digits[n++] = '0' + (v % 10);
+        v /= 10;
+    } while (v != 0);
+    size_t len = 0;
+    if (value < 0) buffer[len++] = '-';
+    while (n > 0) buffer[len++] = digits[--n];
+    buffer[len] = 0;
+    return len;
+}
+
+UriBuilder::UriBuilder(char* buffer, size_t capacity, size_t length, bool hasQuery)
+    : _buffer(buffer), _capacity(capacity), _length(length), _hasQuery(hasQuery) {
+    if (_length < _capacity) _buffer[_length] = 0;
+}
+
+void UriBuilder::put(char c) {
+    if (_failed) return;
+    // keep one byte for the terminator
+    if (_length + 1 >= _capacity) {
+        _failed = true;
+        return;
+    }
+    _buffer[_length++] = c;
+    _buffer[_length] = 0;
+}
+
+void UriBuilder::putEncoded(const char* s, uri_component_t component) {
+    for (; *s != 0 && !_failed; s++) {
+        if (isUnescaped(*s, component)) {
+            put(*s);
+        }
+        else {
+            uint8_t u = (uint8_t)*s;
+            put('%');
+            put(hexDigits[u >> 4]);
+            put(hexDigits[u & 0x0F]);
+        }
+    }
+}
+
+void UriBuilder::beginQueryParameter(const char* key) {
+    put(_hasQuery ? '&' : '?');
+    _hasQuery = true;
+    putEncoded(key, ucQuery);
+    put('=');
+}
+
+UriBuilder& UriBuilder::append(const char* uri) {
+    for (const char* c = uri; *c != 0; c++) {
+        if (*c == '?') {
+            _hasQuery = true;
+            break;
+        }
+    }
+    putEncoded(uri, ucTarget);
+    return *this;
+}
+
+UriBuilder& UriBuilder::path(const char* segment) {
+    if (_hasQuery) {
+        _failed = true;
+        return *this;
+    }
+    if (_length > 0 && _buffer[_length - 1] != '/')
+        put('/');
+    putEncoded(segment, ucSegment);
+    return *this;
+}
+
+UriBuilder& UriBuilder::query(const char* key, const char* value) {
+    beginQueryParameter(key);
+    putEncoded(value, ucQuery);
+    return *this;
+}
+
+UriBuilder& UriBuilder::query(const char* key, long value) {
+    char digits[INTEGER_SIZE];
+    formatInteger(digits, value);
+    beginQueryParameter(key);
+    putEncoded(digits, ucQuery);
+    return *this;
+}
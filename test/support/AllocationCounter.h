@@ -0,0 +1,55 @@
+#ifndef ALLOCATIONCOUNTER_H
+#define ALLOCATIONCOUNTER_H
+
+// counts heap allocations of the whole process by interposing malloc & co. (glibc only).
+// Include from exactly one translation unit of a host test
+#include <stddef.h>
+#include <stdint.h>
+
+struct allocation_stats_t {
+    uint64_t allocations = 0;
+    uint64_t bytes = 0;
+};
+
+static allocation_stats_t allocationStats;
+
+#if defined(__GLIBC__)
+#define ALLOCATION_COUNTER_ENABLED 1
+
+extern "C" {
+    void* __libc_malloc(size_t size);
+    void* __libc_calloc(size_t count, size_t size);
+    void* __libc_realloc(void* ptr, size_t size);
+    void __libc_free(void* ptr);
+
+    void* malloc(size_t size) {
+        allocationStats.allocations++;
+        allocationStats.bytes += size;
+        return __libc_malloc(size);
+    }
+
+    void* calloc(size_t count, size_t size) {
+        allocationStats.allocations++;
+        allocationStats.bytes += count * size;
+        return __libc_calloc(count, size);
+    }
+
+    void* realloc(void* ptr, size_t size) {
+        allocationStats.allocations++;
+        allocationStats.bytes += size;
+        return __libc_realloc(ptr, size);
+    }
+
+    void free(void* ptr) {
+        __libc_free(ptr);
+    }
+}
+#else
+#define ALLOCATION_COUNTER_ENABLED 0
+#endif
+
+inline allocation_stats_t allocationSnapshot() {
+    return allocationStats;
+}
+
+#endif /* ALLOCATIONCOUNTER_H */
@@ -0,0 +1,73 @@
+#ifndef HOSTARDUINO_H
+#define HOSTARDUINO_H
+
+#include <Arduino.h>
+#include <chrono>
+#include <thread>
+
+// wall clock for host runs, independent of the (possibly mocked) arduino time api
+inline uint64_t hostNanos() {
+    using namespace std::chrono;
+    return duration_cast<nanoseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+#if __has_include(<ArduinoFake.h>)
+#include <ArduinoFake.h>
+
+// stream whose non-virtual helpers are served by the fakes below
+static Stream* hostStream = nullptr;
+
+inline String hostReadStringUntil(char terminator) {
+    String result;
+    unsigned long t0 = millis();
+    while (millis() - t0 < hostStream->getTimeout()) {
+        int c = hostStream->read();
+        if (c < 0) continue;
+        if (c == terminator) break;
+        result += (char)c;
+        t0 = millis();
+    }
+    return result;
+}
+
+inline size_t hostReadBytes(char* buffer, size_t length) {
+    size_t n = 0;
+    unsigned long t0 = millis();
+    while (n < length && millis() - t0 < hostStream->getTimeout()) {
+        int c = hostStream->read();
+        if (c < 0) continue;
+        buffer[n++] = (char)c;
+        t0 = millis();
+    }
+    return n;
+}
+
+// ArduinoFake mocks the arduino api and routes the non-virtual Stream helpers to a mock,
+// back them with real implementations on top of the virtual read() of the stream in use
+inline void installHostArduino(Stream* stream) {
+    using namespace fakeit;
+    hostStream = stream;
+    When(Method(ArduinoFake(), millis)).AlwaysDo([]() -> unsigned long { return hostNanos() / 1000000; });
+    When(Method(ArduinoFake(), micros)).AlwaysDo([]() -> unsigned long { return hostNanos() / 1000; });
+    When(Method(ArduinoFake(), delay)).AlwaysDo([](unsigned long ms) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+    });
+    When(Method(ArduinoFake(Stream), readStringUntil)).AlwaysDo(hostReadStringUntil);
+    When(Method(ArduinoFake(Stream), readString)).AlwaysDo([]() { return hostReadStringUntil(-1); });
+    When(OverloadedMethod(ArduinoFake(Stream), readBytes, size_t(char*, size_t))).AlwaysDo(hostReadBytes);
+    When(OverloadedMethod(ArduinoFake(Stream), readBytes, size_t(uint8_t*, size_t))).AlwaysDo(
+        [](uint8_t* buffer, size_t length) { return hostReadBytes((char*)buffer, length); });
+}
+
+// the fakes do not know the instance they are called on, tests reading from more than
+// one stream select the one about to be read
+inline void hostSelectStream(Stream* stream) {
+    hostStream = stream;
+}
+#else
+// the arduino core in use implements Stream on its own
+inline void installHostArduino(Stream* stream) {}
+inline void hostSelectStream(Stream* stream) {}
+#endif
+
+#endif /* HOSTARDUINO_H */
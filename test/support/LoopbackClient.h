@@ -0,0 +1,145 @@
+#ifndef LOOPBACKCLIENT_H
+#define LOOPBACKCLIENT_H
+
+#include <Arduino.h>
+#include <string.h>
+
+// in-memory Client for host tests: every complete request written to it (head plus
+// Content-Length bytes of body) is answered with the configured canned response.
+// Works on fixed storage only, so it does not show up in allocation counts
+class LoopbackClient : public Client {
+    protected:
+        const uint8_t* _response = nullptr;
+        size_t _responseLength = 0;
+        size_t _rxPos = 0;
+        size_t _rxLength = 0;
+        uint32_t _queuedResponses = 0;
+
+        // request parser state
+        char _line[128];
+        size_t _lineLength = 0;
+        bool _inBody = false;
+        size_t _bodyRemaining = 0;
+
+        bool _connected = false;
+
+        void respond() {
+            if (_rxPos < _rxLength) {
+                // previous response not consumed yet (pipelining)
+                _queuedResponses++;
+                return;
+            }
+            startResponse();
+        }
+
+        void nextResponse() {
+            if (_rxPos >= _rxLength && _queuedResponses > 0) {
+                _queuedResponses--;
+                startResponse();
+            }
+        }
+
+        // a new response becomes readable
+        virtual void startResponse() {
+            _rxPos = 0;
+            _rxLength = _responseLength;
+        }
+
+        void consume(uint8_t b) {
+            bytesWritten++;
+            if (_inBody) {
+                if (--_bodyRemaining == 0) {
+                    _inBody = false;
+                    requests++;
+                    respond();
+                }
+                return;
+            }
+            if (b != '\n') {
+                if (b != '\r' && _lineLength < sizeof(_line) - 1)
+                    _line[_lineLength++] = (char)b;
+                return;
+            }
+            _line[_lineLength] = 0;
+            if (_lineLength == 0) {
+                // end of head
+                if (_bodyRemaining > 0) {
+                    _inBody = true;
+                }
+                else {
+                    requests++;
+                    respond();
+                }
+            }
+            else if (strncasecmp(_line, "Content-Length:", 15) == 0) {
+                _bodyRemaining = strtoul(_line + 15, nullptr, 10);
+            }
+            _lineLength = 0;
+        }
+
+    public:
+        uint32_t connects = 0;
+        uint32_t requests = 0;
+        uint64_t bytesWritten = 0;
+        uint64_t bytesRead = 0;
+
+        // data must stay valid while the client is used
+        void setResponse(const char* data) { setResponse((const uint8_t*)data, strlen(data)); }
+        void setResponse(const uint8_t* data, size_t length) {
+            _response = data;
+            _responseLength = length;
+        }
+
+        virtual void reset() {
+            _rxPos = _rxLength = 0;
+            _queuedResponses = 0;
+            _lineLength = 0;
+            _inBody = false;
+            _bodyRemaining = 0;
+            connects = requests = 0;
+            bytesWritten = bytesRead = 0;
+        }
+
+        int connect(IPAddress ip, uint16_t port) { _connected = true; connects++; return 1; }
+        int connect(const char* host, uint16_t port) { _connected = true; connects++; return 1; }
+
+        size_t write(uint8_t b) { consume(b); return 1; }
+        size_t write(const uint8_t* buf, size_t size) {
+            for (size_t i = 0; i < size; i++) consume(buf[i]);
+            return size;
+        }
+
+        int available() {
+            nextResponse();
+            return (int)(_rxLength - _rxPos);
+        }
+        int read() {
+            nextResponse();
+            if (_rxPos >= _rxLength) return -1;
+            bytesRead++;
+            return _response[_rxPos++];
+        }
+        int read(uint8_t* buf, size_t size) {
+            nextResponse();
+            size_t n = _rxLength - _rxPos;
+            if (n > size) n = size;
+            memcpy(buf, _response + _rxPos, n);
+            _rxPos += n;
+            bytesRead += n;
+            return (int)n;
+        }
+        int peek() {
+            nextResponse();
+            return _rxPos < _rxLength ? _response[_rxPos] : -1;
+        }
+        void flush() {}
+        void stop() {
+            _connected = false;
+            _rxPos = _rxLength = 0;
+            _queuedResponses = 0;
+        }
+        uint8_t connected() { return _connected; }
+        operator bool() { return _connected; }
+};
+
+#endif /* LOOPBACKCLIENT_H */
@@ -0,0 +1,35 @@
+#ifndef OUTCOME_H
+#define OUTCOME_H
+
+#include <fluenthttp.h>
+
+// what the callbacks of the requests of a test reported, reset it in setUp()
+struct outcome_t {
+    int succeeded = 0;
+    int failed = 0;
+    int timedOut = 0;
+    uint16_t statusCode = 0;
+    String message;     // status message of the last response or failure
+    String content;     // content of the last successful response
+};
+
+static outcome_t outcome;
+
+// records the callbacks of the request in outcome
+inline ServiceRequest& track(ServiceRequest& request, uint32_t timeout = 1000) {
+    return request.withTimeout(timeout)
+        .onSuccess([](service_response_t r) {
+            outcome.succeeded++;
+            outcome.statusCode = r.statusCode;
+            outcome.message = r.statusMessage;
+            outcome.content = ServiceRequest::stringContent(r);
+        })
+        .onFailure([](service_response_t r) {
+            outcome.failed++;
+            outcome.statusCode = r.statusCode;
+            outcome.message = r.statusMessage;
+        })
+        .onTimeout([] { outcome.timedOut++; });
+}
+
+#endif /* OUTCOME_H */
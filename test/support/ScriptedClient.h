@@ -0,0 +1,130 @@
+#ifndef SCRIPTEDCLIENT_H
+#define SCRIPTEDCLIENT_H
+
+#include <Arduino.h>
+#include <string>
+#include <vector>
+#include "HostArduino.h"
+
+// scripted server for host tests on std::string buffers: requests written to it are split at
+// the end of their body (Content-Length or chunked) and answered one after the other through
+// answer(), so pipelined requests are answered in order. Suites script the server by
+// overriding answer() and partial(). Selects itself for the Stream helpers when read
+class ScriptedClient : public Client {
+    protected:
+        std::string _in;        // written, not a complete request yet
+        std::string _rx;
+        size_t _rxPos = 0;
+        bool _connected = false;
+
+        // length of the complete request at the start of _in, 0 while it did not fully arrive.
+        // The body comes back without its transfer coding
+        size_t complete(std::string& body) {
+            size_t end = _in.find("\r\n\r\n");
+            if (end == std::string::npos) return 0;
+            size_t pos = end + 4;
+            body.clear();
+            size_t chunked = _in.find("Transfer-Encoding: chunked\r\n");
+            if (chunked != std::string::npos && chunked < end) {
+                while (true) {
+                    size_t line = _in.find("\r\n", pos);
+                    if (line == std::string::npos) return 0;
+                    size_t size = strtoul(_in.c_str() + pos, nullptr, 16);
+                    if (_in.size() < line + 2 + size + 2) return 0;
+                    body.append(_in, line + 2, size);
+                    pos = line + 2 + size + 2;
+                    if (size == 0) return pos;
+                }
+            }
+            size_t field = _in.find("Content-Length: ");
+            size_t length = field != std::string::npos && field < end ? strtoul(_in.c_str() + field + 16, nullptr, 10) : 0;
+            if (_in.size() < pos + length) return 0;
+            body = _in.substr(pos, length);
+            return pos + length;
+        }
+
+        // a complete request arrived, the head ends with the line break of its last header
+        virtual void answer(const std::string& head, const std::string& body) { _rx += response; }
+        // bytes of a request arrived that is not complete yet
+        virtual void partial() {}
+
+    public:
+        std::string response = "HTTP/1.1 200 OK\r\nContent-Length: 2\r\n\r\nok";
+        std::string written;                // every byte written since reset()
+        std::vector<std::string> requests;  // complete requests as written
+        std::vector<std::string> heads;
+        std::vector<std::string> bodies;    // without transfer coding
+        int connects = 0;
+        int writes = 0;
+        int refuseConnects = 0;             // connects that fail before the next one succeeds
+
+        virtual void reset() {
+            stop();
+            _in.clear();
+            written.clear();
+            requests.clear();
+            heads.clear();
+            bodies.clear();
+            connects = writes = refuseConnects = 0;
+        }
+        // more response bytes on the current connection
+        void push(const std::string& data) { _rx += data; }
+        // the server closes the connection without telling, unread bytes stay readable
+        void hangUp() { _connected = false; }
+
+        // head and body of the first request written since reset()
+        std::string head() const { return written.substr(0, written.find("\r\n\r\n") + 4); }
+        std::string body() const { return written.substr(written.find("\r\n\r\n") + 4); }
+
+        int connect(IPAddress ip, uint16_t port) { return connect((const char*)nullptr, port); }
+        int connect(const char* host, uint16_t port) {
+            if (refuseConnects > 0) {
+                refuseConnects--;
+                return 0;
+            }
+            _connected = true;
+            _in.clear();
+            _rx.clear();
+            _rxPos = 0;
+            connects++;
+            return 1;
+        }
+        size_t write(uint8_t b) { return write(&b, 1); }
+        size_t write(const uint8_t* buf, size_t size) {
+            writes++;
+            if (!_connected) return 0;
+            written.append((const char*)buf, size);
+            _in.append((const char*)buf, size);
+            std::string body;
+            size_t length;
+            // requests behind one the server closed the connection at are lost
+            while (_connected && (length = complete(body)) > 0) {
+                std::string request = _in.substr(0, length);
+                _in.erase(0, length);
+                std::string head = request.substr(0, request.find("\r\n\r\n") + 2);
+                requests.push_back(request);
+                heads.push_back(head);
+                bodies.push_back(body);
+                answer(head, body);
+            }
+            if (!_in.empty())
+                partial();
+            return size;
+        }
+        int available() { hostSelectStream(this); return (int)(_rx.size() - _rxPos); }
+        int read() { return _rxPos < _rx.size() ? (uint8_t)_rx[_rxPos++] : -1; }
+        int read(uint8_t* buf, size_t size) {
+            size_t n = _rx.size() - _rxPos;
+            if (n > size) n = size;
+            memcpy(buf, _rx.data() + _rxPos, n);
+            _rxPos += n;
+            return (int)n;
+        }
+        int peek() { hostSelectStream(this); return _rxPos < _rx.size() ? (uint8_t)_rx[_rxPos] : -1; }
+        void flush() {}
+        void stop() { _connected = false; _rx.clear(); _rxPos = 0; }
+        uint8_t connected() { return _connected; }
+        operator bool() { return _connected; }
+};
+
+#endif /* SCRIPTEDCLIENT_H */
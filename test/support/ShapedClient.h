@@ -0,0 +1,126 @@
+#ifndef SHAPEDCLIENT_H
+#define SHAPEDCLIENT_H
+
+#include "LoopbackClient.h"
+#include "HostArduino.h"
+
+struct network_shape_t {
+    uint32_t latencyMicros = 0;     // until the first response byte arrives
+    uint32_t bytesPerSecond = 0;    // 0 = unlimited
+    uint16_t fragmentSize = 0;      // max. bytes per available()/read(), 0 = unlimited
+    uint16_t stallPermille = 0;     // chance per response to pause once in the middle
+    uint32_t stallMicros = 0;
+    int32_t stallOffset = -1;       // response byte at which the stall starts, -1 = random
+    uint16_t resetPermille = 0;     // chance per response to lose the connection in the middle
+};
+
+// LoopbackClient that delivers its responses like a real network would: after a latency,
+// limited in bandwidth, fragmented, with random stalls and connection resets.
+// Random decisions are reproducible through the seed
+class ShapedClient : public LoopbackClient {
+    private:
+        network_shape_t _shape;
+        uint32_t _seed;
+        uint64_t _start = 0;
+        size_t _stallOffset = 0;
+        uint64_t _stallAt = 0;
+        bool _stall = false;
+        size_t _resetOffset = 0;
+        bool _reset = false;
+
+        uint32_t random32() {
+            // xorshift32
+            _seed ^= _seed << 13;
+            _seed ^= _seed >> 17;
+            _seed ^= _seed << 5;
+            return _seed;
+        }
+
+        bool chance(uint16_t permille) {
+            return permille > 0 && random32() % 1000 < permille;
+        }
+
+        static uint64_t now() { return hostNanos() / 1000; }
+
+        size_t bytesAt(uint64_t elapsed) {
+            if (_shape.bytesPerSecond == 0) return _rxLength;
+            uint64_t n = elapsed * _shape.bytesPerSecond / 1000000;
+            return n > _rxLength ? _rxLength : (size_t)n;
+        }
+
+        // number of response bytes that arrived by now
+        size_t arrived() {
+            uint64_t t = now();
+            if (t < _start) return 0;
+            uint64_t elapsed = t - _start;
+            if (_stall && elapsed >= _stallAt) {
+                if (elapsed < _stallAt + _shape.stallMicros) {
+                    size_t n = bytesAt(elapsed);
+                    return n > _stallOffset ? _stallOffset : n;
+                }
+                elapsed -= _shape.stallMicros;
+            }
+            return bytesAt(elapsed);
+        }
+
+        size_t visible() {
+            nextResponse();
+            if (!_connected) return 0;
+            size_t limit = arrived();
+            if (_reset && limit >= _resetOffset) {
+                limit = _resetOffset;
+                if (_rxPos >= _resetOffset) {
+                    // peer is gone, everything after the cut is lost
+                    resets++;
+                    _reset = false;
+                    stop();
+                    return 0;
+                }
+            }
+            size_t n = limit > _rxPos ? limit - _rxPos : 0;
+            if (_shape.fragmentSize > 0 && n > _shape.fragmentSize)
+                n = _shape.fragmentSize;
+            return n;
+        }
+
+    protected:
+        void startResponse() {
+            LoopbackClient::startResponse();
+            _start = now() + _shape.latencyMicros;
+            _stall = chance(_shape.stallPermille);
+            _stallOffset = _shape.stallOffset >= 0 ? (size_t)_shape.stallOffset
+                : _rxLength > 0 ? random32() % _rxLength : 0;
+            _stallAt = _shape.bytesPerSecond > 0 ? (uint64_t)_stallOffset * 1000000 / _shape.bytesPerSecond : 0;
+            _reset = chance(_shape.resetPermille);
+            _resetOffset = _rxLength > 0 ? random32() % _rxLength : 0;
+        }
+
+    public:
+        uint32_t resets = 0;
+
+        ShapedClient(uint32_t seed = 0x2545F491) : _seed(seed) {}
+
+        void setShape(const network_shape_t& shape) { _shape = shape; }
+
+        void reset() {
+            LoopbackClient::reset();
+            resets = 0;
+            _stall = _reset = false;
+        }
+
+        int available() { return (int)visible(); }
+        int read() {
+            if (visible() == 0) return -1;
+            return LoopbackClient::read();
+        }
+        int read(uint8_t* buf, size_t size) {
+            size_t n = visible();
+            return LoopbackClient::read(buf, size < n ? size : n);
+        }
+        int peek() {
+            if (visible() == 0) return -1;
+            return LoopbackClient::peek();
+        }
+};
+
+#endif /* SHAPEDCLIENT_H */
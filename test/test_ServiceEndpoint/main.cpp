@@ -1,6 +1,7 @@
 #include <Arduino.h>
 #include <unity.h>
 #include <fluenthttp.h>
+#include <ServiceWorker.h>
 #include <env.h>
 
 #ifdef WIFI_CLIENT
@@ -16,6 +17,7 @@ EthernetClient client;
 
 ServiceEndpoint endpoint(TEST_ENDPOINT);
 ServiceRequest* _currentRequest = nullptr;
+ServiceWorker worker;
 
 const int TIMEOUT = 500;
 
@@ -83,6 +85,38 @@ ServiceRequest* get_request(int timeout, bool sync) {
   return nullptr;
 }
 
+// like get_request() on a request from the endpoint's pool, released instead of deleted
+ServiceRequestHandle get_pooled_request(int timeout, bool sync) {
+  static int n = 0;
+  ServiceRequestHandle request = endpoint.request("GET", "/publickey/");
+  if (request) {
+    n++;
+    printf("get pooled request %d\r\n", n);
+    bool success = false;
+    bool* successPtr = &success;
+    request->withTimeout(timeout)
+        .onSuccess([=](service_response_t r) {
+            *successPtr = true;
+            printf("pooled request %d succeeded at %d, content length %d\r\n", n, millis(), r.contentLength);
+        })
+        .onFailure([=](service_response_t r) {
+          printf("pooled request failed with code %d: %s\r\n", r.statusCode, r.statusMessage.c_str());
+        })
+        .onTimeout([=] {
+          printf("pooled request timed out\r\n");
+        });
+
+    request->fire();
+    if (sync) {
+      request->await();
+      TEST_ASSERT_TRUE(success);
+      request.release();
+      return ServiceRequestHandle();
+    }
+  }
+  return request;
+}
+
 void get_request_chunked(int timeout, bool sync) {
   ServiceRequest request;
   if (endpoint.get("/firmware/Tester/image/chunk?start=0&len=4096", request)) {
@@ -94,7 +128,13 @@ void get_request_chunked(int timeout, bool sync) {
             int chunk = r.nextChunk();
             byte buffer[4096];
             int n = 1;
-            while (chunk != 0) {
+            while (chunk != 0 || r.chunkPending()) {
+              // size line not complete yet
+              if (chunk == 0) {
+                delay(1);
+                chunk = r.nextChunk();
+                continue;
+              }
               printf("chunk %d: %d bytes\r\n", n, chunk);
               r.contentReader->readBytes(buffer, chunk);
               log_print_buf(buffer, chunk);
@@ -167,6 +207,7 @@ void test_sync_explicit_await_calls_with_close() {
 }
 
 volatile bool doParallel = false;
+volatile bool doPooled = false;
 
 void yield_task(void* arg) {
   while (true)
@@ -207,6 +248,27 @@ void parallel_task(void* arg) {
   }
 }
 
+void pooled_task(void* arg) {
+  ServiceRequestHandle req;
+  while (true)
+  {
+    if (req) {
+      // driven to its end also once the test stopped issuing, released before the next
+      // request() so no task recycles the slot of another
+      ServiceRequest* r = req.get();
+      if (r == nullptr || r->yield())
+        req.release();
+    }
+    else if (doPooled) {
+      req = get_pooled_request(500, false);
+      if (req) {
+        printf("gotcha pooled task %d\r\n", (int)arg);
+      }
+    }
+    vTaskDelay(10 / portTICK_PERIOD_MS);
+  }
+}
+
 void test_parallel_explicit_await_calls() {
   endpoint.withKeepAlive(false);
   doParallel = true;
@@ -249,6 +311,66 @@ void test_chunked_transferencoding() {
   get_request_chunked(1000, true);
 }
 
+void test_uri_builder() {
+  // the same target as get_request_chunked, composed from its parts
+  endpoint.withKeepAlive(false);
+  ServiceRequest request;
+  TEST_ASSERT_TRUE(endpoint.get("/firmware", request));
+  bool success = false;
+  bool* successPtr = &success;
+  request.withPathSegment("Tester")
+      .withPathSegment("image")
+      .withPathSegment("chunk")
+      .withQuery("start", 0L)
+      .withQuery("len", 4096L)
+      .withTimeout(1000)
+      .onSuccess([=](service_response_t r) { *successPtr = true; })
+      .fire();
+  request.await();
+  TEST_ASSERT_TRUE(success);
+}
+
+void test_worker_explicit_await_calls() {
+  // socket i/o on the second core, callbacks on this task
+  TEST_ASSERT_TRUE(worker.begin(1));
+  endpoint.withWorker(&worker);
+  endpoint.withKeepAlive(true);
+  for (int k = 0; k < count; k++) {
+    get_request(TIMEOUT, true);
+  }
+  get_request_chunked(1000, true);
+  endpoint.withWorker(nullptr);
+  worker.end();
+}
+
+void test_pooled_explicit_await_calls() {
+  endpoint.withKeepAlive(true);
+  for (int k = 0; k < count; k++) {
+    get_pooled_request(TIMEOUT, true);
+  }
+  // a released request is gone for its handles, the slot is issued again
+  ServiceRequestHandle request = get_pooled_request(TIMEOUT, false);
+  TEST_ASSERT_TRUE(request.valid());
+  ServiceRequestHandle copy = request;
+  request->await();
+  request.release();
+  TEST_ASSERT_FALSE(copy.valid());
+  TEST_ASSERT_NULL(copy.get());
+}
+
+void test_parallel_pooled_calls() {
+  // the pool has a slot per task, as the tasks release their handles
+  endpoint.withKeepAlive(false);
+  doPooled = true;
+  delay(30000);
+  doPooled = false;
+  // let the tasks release their last requests
+  delay(1000);
+  for (int k = 0; k < count; k++) {
+    get_pooled_request(TIMEOUT, true);
+  }
+}
+
 void setup()
 {
   // NOTE!!! Wait for >2 secs
@@ -276,18 +398,28 @@ void setup()
   #endif
 
   endpoint.begin(&client);
+  // a slot for each task issuing pooled requests and one for this task
+  endpoint.withRequestPool(4);
 
   TaskHandle_t handle1, handle2, handle3, yieldHandle;
   xTaskCreate(parallel_task, "t1", 12000, (void*)1, 5, &handle1);
   xTaskCreate(parallel_task, "t2", 12000, (void*)2, 5, &handle2);
   xTaskCreate(parallel_task, "t3", 12000, (void*)3, 5, &handle3);
+  TaskHandle_t pooled1, pooled2, pooled3;
+  xTaskCreate(pooled_task, "p1", 12000, (void*)1, 5, &pooled1);
+  xTaskCreate(pooled_task, "p2", 12000, (void*)2, 5, &pooled2);
+  xTaskCreate(pooled_task, "p3", 12000, (void*)3, 5, &pooled3);
   //xTaskCreate(yield_task, "t2", 32000, nullptr, 5, &yieldHandle);
 
   RUN_TEST(test_parallel_explicit_await_calls);
   RUN_TEST(test_chunked_transferencoding);
+  RUN_TEST(test_uri_builder);
   RUN_TEST(test_sync_explicit_await_calls_with_close);
   RUN_TEST(test_sync_explicit_await_calls_with_keepalive);
   RUN_TEST(test_timeout_continue);
+  RUN_TEST(test_worker_explicit_await_calls);
+  RUN_TEST(test_pooled_explicit_await_calls);
+  RUN_TEST(test_parallel_pooled_calls);
 
   // tests with yield in a different thread
   xTaskCreate(yield_task, "t2", 32000, nullptr, 5, &yieldHandle);
@@ -0,0 +1,198 @@
+#include <Arduino.h>
+#include <unity.h>
+#include <fluenthttp.h>
+#include <ServiceBatch.h>
+#include "../support/ScriptedClient.h"
+
+// ServiceBatch against a server answering pipelined requests in order, with
+// announced closes and resets in the middle of a batch
+
+class PipelineClient : public ScriptedClient {
+    protected:
+        void answer(const std::string& head, const std::string& body) {
+            int n = (int)requests.size() - 1;
+            if (n == resetAt) {
+                _connected = false;
+                return;
+            }
+            std::string response = n < (int)responses.size() && !responses[n].empty()
+                ? responses[n]
+                : "HTTP/1.1 201 Created\r\nContent-Length: 2\r\n\r\nok";
+            if (n == closeAt)
+                response.insert(response.find("\r\n") + 2, "Connection: close\r\n");
+            _rx += response;
+            // the response is still read, the connection just goes away
+            if (n == closeAt || n == hangUpAt)
+                _connected = false;
+        }
+
+    public:
+        std::vector<std::string> responses;   // by request number, "" for the default
+        int closeAt = -1;   // request answered with "Connection: close"
+        int hangUpAt = -1;  // request the server closes behind without announcing it
+        int resetAt = -1;   // request the connection drops at without an answer
+
+        void reset() {
+            ScriptedClient::reset();
+            responses.clear();
+            closeAt = hangUpAt = resetAt = -1;
+        }
+};
+
+PipelineClient client;
+ServiceEndpoint endpoint("batch.local");
+static const char* sample = "{\"t\":21.5,\"h\":40}";
+static int completions;
+
+void setUp(void)
+{
+    client.reset();
+    endpoint.withKeepAlive(true);
+    completions = 0;
+}
+
+void tearDown(void)
+{
+}
+
+void test_pipelines_requests_into_few_writes() {
+    ServiceBatch batch;
+    for (int i = 0; i < 10; i++)
+        batch.post("/telemetry", (const uint8_t*)sample, strlen(sample), "application/json");
+    batch.onComplete([](ServiceBatch& b) { completions++; });
+    TEST_ASSERT_TRUE(endpoint.fire(batch));
+    // the endpoint stays locked until the batch finished
+    ServiceRequest request;
+    TEST_ASSERT_FALSE(endpoint.get("/other", request));
+    TEST_ASSERT_FALSE(endpoint.fire(batch));
+    batch.await();
+
+    TEST_ASSERT_EQUAL(1, completions);
+    TEST_ASSERT_EQUAL(10, batch.succeeded());
+    TEST_ASSERT_EQUAL(10, client.requests.size());
+    TEST_ASSERT_EQUAL(1, client.connects);
+    // FLUENTHTTP_BATCH_PIPELINE requests per write
+    TEST_ASSERT_EQUAL((10 + FLUENTHTTP_BATCH_PIPELINE - 1) / FLUENTHTTP_BATCH_PIPELINE, client.writes);
+    for (int i = 0; i < 10; i++) {
+        TEST_ASSERT_EQUAL(201, batch.item(i).statusCode);
+        TEST_ASSERT_TRUE(client.requests[i].find("POST /telemetry HTTP/1.1\r\n") == 0);
+        TEST_ASSERT_TRUE(client.requests[i].find("Content-Type: application/json\r\n") != std::string::npos);
+        TEST_ASSERT_TRUE(client.requests[i].find(std::string("\r\n\r\n") + sample) != std::string::npos);
+    }
+    TEST_ASSERT_TRUE(endpoint.get("/other", request));
+    request.cancel("not needed");
+}
+
+void test_reads_mixed_responses_in_order() {
+    client.responses = {
+        "HTTP/1.1 200 OK\r\nContent-Type: application/json\r\nContent-Length: 13\r\n\r\n{\"ok\": true }",
+        "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n4\r\nabcd\r\n3\r\nefg\r\n0\r\n\r\n",
+        "HTTP/1.1 404 Not Found\r\nContent-Length: 9\r\n\r\nnot found",
+        "HTTP/1.1 204 No Content\r\n\r\n",
+        "HTTP/1.1 100 Continue\r\n\r\nHTTP/1.1 201 Created\r\nContent-Length: 0\r\n\r\n",
+        "HTTP/1.1 200 OK\r\nContent-Length: 10\r\n\r\n"
+    };
+    ServiceBatch batch;
+    batch.get("/json").get("/chunked").get("/missing").add("DELETE", "/item/1")
+        .post("/upload", (const uint8_t*)sample, strlen(sample)).add("HEAD", "/status")
+        .withPipelining(6);
+    TEST_ASSERT_TRUE(endpoint.fire(batch));
+    batch.await();
+    const uint16_t expected[] = { 200, 200, 404, 204, 201, 200 };
+    for (int i = 0; i < 6; i++) {
+        TEST_ASSERT_EQUAL(expected[i], batch.item(i).statusCode);
+        TEST_ASSERT_TRUE(batch.item(i).error == nullptr);
+    }
+    TEST_ASSERT_FALSE(batch.item(2).ok());
+    TEST_ASSERT_EQUAL(5, batch.succeeded());
+    TEST_ASSERT_EQUAL(1, client.writes);
+}
+
+void test_announced_close_sends_the_rest_again() {
+    client.closeAt = 2;
+    ServiceBatch batch;
+    for (int i = 0; i < 6; i++)
+        batch.post("/telemetry", (const uint8_t*)sample, strlen(sample));
+    TEST_ASSERT_TRUE(endpoint.fire(batch));
+    batch.await();
+    // the request sent behind the close was not processed and is sent again
+    TEST_ASSERT_EQUAL(6, batch.succeeded());
+    TEST_ASSERT_EQUAL(2, client.connects);
+    TEST_ASSERT_EQUAL(6, client.requests.size());
+}
+
+void test_silent_close_between_windows_reconnects() {
+    client.hangUpAt = 3;
+    ServiceBatch batch;
+    batch.withPipelining(4);
+    for (int i = 0; i < 10; i++)
+        batch.post("/telemetry", (const uint8_t*)sample, strlen(sample));
+    TEST_ASSERT_TRUE(endpoint.fire(batch));
+    uint32_t start = millis();
+    batch.await();
+    // the first window was answered completely, the rest goes out on a new connection
+    TEST_ASSERT_LESS_THAN(500, millis() - start);
+    TEST_ASSERT_EQUAL(10, batch.succeeded());
+    TEST_ASSERT_EQUAL(2, client.connects);
+    TEST_ASSERT_EQUAL(10, client.requests.size());
+}
+
+void test_reset_repeats_gets_and_fails_posts() {
+    client.resetAt = 1;
+    ServiceBatch batch;
+    batch.get("/a").post("/b", (const uint8_t*)sample, strlen(sample)).get("/c")
+        .post("/d", (const uint8_t*)sample, strlen(sample));
+    TEST_ASSERT_TRUE(endpoint.fire(batch));
+    batch.await();
+    TEST_ASSERT_EQUAL(201, batch.item(0).statusCode);
+    TEST_ASSERT_EQUAL_STRING("connection closed before response", batch.item(1).error);
+    TEST_ASSERT_EQUAL(201, batch.item(2).statusCode);
+    TEST_ASSERT_EQUAL(2, batch.item(2).sends);
+    TEST_ASSERT_EQUAL_STRING("connection closed before response", batch.item(3).error);
+    TEST_ASSERT_EQUAL(2, batch.succeeded());
+    TEST_ASSERT_EQUAL(2, client.connects);
+}
+
+void test_large_bodies_and_closing_endpoints() {
+    std::string body(3000, 'x');
+    endpoint.withKeepAlive(false);
+    ServiceBatch batch;
+    batch.post("/upload", (const uint8_t*)body.data(), body.size()).get("/status");
+    TEST_ASSERT_TRUE(endpoint.fire(batch));
+    batch.await();
+    TEST_ASSERT_EQUAL(2, batch.succeeded());
+    // one request per connection without keep-alive
+    TEST_ASSERT_EQUAL(2, client.connects);
+    TEST_ASSERT_TRUE(client.requests[0].find("Connection: close\r\n") != std::string::npos);
+    TEST_ASSERT_TRUE(client.requests[0].find("\r\n\r\n" + body) != std::string::npos);
+    TEST_ASSERT_EQUAL(3, client.writes);
+}
+
+void test_rejects_too_many_requests() {
+    ServiceBatch batch;
+    for (int i = 0; i < FLUENTHTTP_BATCH_SIZE; i++)
+        batch.get("/x");
+    TEST_ASSERT_TRUE(batch.ok());
+    batch.get("/x");
+    TEST_ASSERT_FALSE(batch.ok());
+    TEST_ASSERT_EQUAL(FLUENTHTTP_BATCH_SIZE, batch.size());
+    batch.clear();
+    TEST_ASSERT_TRUE(batch.ok());
+    TEST_ASSERT_EQUAL(0, batch.size());
+}
+
+int main(int argc, char** argv)
+{
+    installHostArduino(&client);
+    endpoint.begin(&client);
+
+    UNITY_BEGIN();
+    RUN_TEST(test_pipelines_requests_into_few_writes);
+    RUN_TEST(test_reads_mixed_responses_in_order);
+    RUN_TEST(test_announced_close_sends_the_rest_again);
+    RUN_TEST(test_silent_close_between_windows_reconnects);
+    RUN_TEST(test_reset_repeats_gets_and_fails_posts);
+    RUN_TEST(test_large_bodies_and_closing_endpoints);
+    RUN_TEST(test_rejects_too_many_requests);
+    return UNITY_END();
+}
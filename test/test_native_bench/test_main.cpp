@@ -0,0 +1,198 @@
+#include <Arduino.h>
+#include <unity.h>
+#include <fluenthttp.h>
+#include "../support/HostArduino.h"
+#include "../support/AllocationCounter.h"
+#include "../support/LoopbackClient.h"
+
+// host microbenchmarks for request serialization and response parsing over an in-memory
+// client. Every benchmark prints one json line prefixed with "BENCH ", so results can be
+// collected and compared between commits, e.g.
+//   pio test -e native -f test_native_bench | grep ^BENCH
+
+#ifndef BENCH_ITERATIONS
+  #define BENCH_ITERATIONS 5000
+#endif
+
+LoopbackClient client;
+ServiceEndpoint endpoint("bench.local");
+
+static char smallJsonResponse[] =
+    "HTTP/1.1 200 OK\r\n"
+    "Date: Mon, 19 Oct 2026 10:00:00 GMT\r\n"
+    "Server: nginx\r\n"
+    "Content-Type: application/json\r\n"
+    "Cache-Control: no-cache\r\n"
+    "Connection: keep-alive\r\n"
+    "Content-Length: 64\r\n"
+    "\r\n"
+    "{\"id\":42,\"status\":\"ok\",\"temperature\":21.5,\"values\":[1,2,3,4,56]}";
+
+static char emptyResponse[] =
+    "HTTP/1.1 204 No Content\r\n"
+    "Content-Length: 0\r\n"
+    "\r\n";
+
+static char largeResponse[256 + 4096];
+static char chunkedResponse[256 + 8 * (512 + 8)];
+
+static uint8_t postBody[512];
+static uint8_t contentBuffer[4096];
+
+struct bench_result_t {
+    const char* name;
+    uint32_t iterations;
+    uint64_t nanos;
+    uint64_t payloadBytes;
+    allocation_stats_t allocations;
+};
+
+void report(const bench_result_t& r) {
+    double nsPerOp = (double)r.nanos / r.iterations;
+    double mbPerSec = r.nanos > 0 ? (double)r.payloadBytes * 1000.0 / r.nanos : 0;
+    printf("BENCH {\"benchmark\":\"%s\",\"iterations\":%u,\"ns_per_op\":%.1f,\"ops_per_s\":%.0f,"
+           "\"mb_per_s\":%.2f,\"allocs_per_op\":%.2f,\"alloc_bytes_per_op\":%.1f,\"allocs_counted\":%s}\n",
+        r.name, r.iterations, nsPerOp, 1e9 / nsPerOp, mbPerSec,
+        (double)r.allocations.allocations / r.iterations,
+        (double)r.allocations.bytes / r.iterations,
+        ALLOCATION_COUNTER_ENABLED ? "true" : "false");
+}
+
+// runs op BENCH_ITERATIONS times after a short warm up, payloadBytes counts bytes per op on the wire
+template <typename Op>
+bench_result_t measure(const char* name, Op op) {
+    for (int i = 0; i < 100; i++) op();
+    client.reset();
+    allocation_stats_t a0 = allocationSnapshot();
+    uint64_t t0 = hostNanos();
+    for (int i = 0; i < BENCH_ITERATIONS; i++) op();
+    uint64_t t1 = hostNanos();
+    allocation_stats_t a1 = allocationSnapshot();
+
+    bench_result_t r;
+    r.name = name;
+    r.iterations = BENCH_ITERATIONS;
+    r.nanos = t1 - t0;
+    r.payloadBytes = client.bytesRead + client.bytesWritten;
+    r.allocations.allocations = a1.allocations - a0.allocations;
+    r.allocations.bytes = a1.bytes - a0.bytes;
+    report(r);
+    return r;
+}
+
+static uint32_t completed = 0;
+
+void readContent(service_response_t r) {
+    completed++;
+    if (r.chunked) {
+        int chunk;
+        while ((chunk = r.nextChunk()) > 0) {
+            r.contentReader->readBytes(contentBuffer, chunk);
+        }
+        // trailing empty line after the last chunk
+        r.contentReader->readStringUntil('\n');
+    }
+    else if (r.contentLength > 0) {
+        r.contentReader->readBytes(contentBuffer, r.contentLength);
+    }
+}
+
+void get(const char* uri) {
+    ServiceRequest request;
+    if (!endpoint.get(uri, request)) return;
+    request.onSuccess(readContent).fire();
+    request.await();
+}
+
+void setUp(void)
+{
+    completed = 0;
+}
+
+void tearDown(void)
+{
+}
+
+void test_parse_small_json() {
+    client.setResponse(smallJsonResponse);
+    bench_result_t r = measure("parse_small_json", [] { get("/status"); });
+    TEST_ASSERT_EQUAL_UINT32(r.iterations + 100, completed);
+}
+
+void test_parse_large_body() {
+    client.setResponse(largeResponse);
+    bench_result_t r = measure("parse_large_body_4k", [] { get("/image"); });
+    TEST_ASSERT_EQUAL_UINT32(r.iterations + 100, completed);
+}
+
+void test_parse_chunked() {
+    client.setResponse(chunkedResponse);
+    bench_result_t r = measure("parse_chunked_8x512", [] { get("/chunks"); });
+    TEST_ASSERT_EQUAL_UINT32(r.iterations + 100, completed);
+}
+
+void test_serialize_get() {
+    client.setResponse(emptyResponse);
+    bench_result_t r = measure("serialize_get_query", [] {
+        ServiceRequest request;
+        if (!endpoint.get("/firmware", request)) return;
+        request.withPathSegment("Tester")
+            .withPathSegment("image")
+            .withQuery("start", 4096L)
+            .withQuery("len", 4096L)
+            .addHeader("X-Device", "bench-01")
+            .onSuccess(readContent)
+            .fire();
+        request.await();
+    });
+    TEST_ASSERT_EQUAL_UINT32(r.iterations + 100, completed);
+}
+
+void test_serialize_post() {
+    client.setResponse(emptyResponse);
+    bench_result_t r = measure("serialize_post_512", [] {
+        ServiceRequest request;
+        if (!endpoint.post("/telemetry", request)) return;
+        request.addHeader("Content-Type", "application/json")
+            .onSuccess(readContent)
+            .fireContent(sizeof(postBody), postBody);
+        request.await();
+    });
+    TEST_ASSERT_EQUAL_UINT32(r.iterations + 100, completed);
+}
+
+void buildResponses() {
+    char* p = largeResponse;
+    p += sprintf(p, "HTTP/1.1 200 OK\r\nContent-Type: application/octet-stream\r\nContent-Length: 4096\r\n\r\n");
+    memset(p, 'x', 4096);
+    p[4096] = 0;
+
+    p = chunkedResponse;
+    p += sprintf(p, "HTTP/1.1 200 OK\r\nContent-Type: application/octet-stream\r\nTransfer-Encoding: chunked\r\n\r\n");
+    for (int i = 0; i < 8; i++) {
+        p += sprintf(p, "200\r\n");
+        memset(p, 'a' + i, 512);
+        p += 512;
+        p += sprintf(p, "\r\n");
+    }
+    sprintf(p, "0\r\n\r\n");
+
+    memset(postBody, '{', sizeof(postBody));
+}
+
+int main(int argc, char** argv)
+{
+    installHostArduino(&client);
+    buildResponses();
+    endpoint.begin(&client);
+    endpoint.withKeepAlive(true)
+        .withDefaultHeader("User-Agent", "fluenthttp-bench");
+
+    UNITY_BEGIN();
+    RUN_TEST(test_parse_small_json);
+    RUN_TEST(test_parse_large_body);
+    RUN_TEST(test_parse_chunked);
+    RUN_TEST(test_serialize_get);
+    RUN_TEST(test_serialize_post);
+    return UNITY_END();
+}
@@ -0,0 +1,406 @@
+#include <Arduino.h>
+#include <unity.h>
+#include <fluenthttp.h>
+#include <DeflateEncoder.h>
+#include <vector>
+#include "../support/ScriptedClient.h"
+#include "../support/Outcome.h"
+
+// compressed request bodies: DeflateEncoder output is inflated again and compared, the
+// endpoint sends bodies compressed and falls back to plain ones after a 415
+
+// inflates deflate blocks with the fixed huffman code and stored ones, all DeflateEncoder writes
+class Inflater {
+    const std::vector<uint8_t>& _in;
+    size_t _pos;
+    uint32_t _bits = 0;
+    uint8_t _count = 0;
+
+    uint32_t bits(uint8_t n) {
+        while (_count < n) {
+            _bits |= (uint32_t)(_pos < _in.size() ? _in[_pos] : 0) << _count;
+            _pos++;
+            _count += 8;
+        }
+        uint32_t value = _bits & ((1u << n) - 1);
+        _bits >>= n;
+        _count -= n;
+        return value;
+    }
+    // huffman codes arrive most significant bit first
+    uint32_t code(uint8_t n) {
+        uint32_t value = 0;
+        while (n-- > 0) value = (value << 1) | bits(1);
+        return value;
+    }
+    int symbol() {
+        uint32_t c = code(7);
+        if (c <= 0x17) return 256 + c;
+        c = (c << 1) | code(1);
+        if (c >= 0x30 && c <= 0xBF) return c - 0x30;
+        if (c >= 0xC0 && c <= 0xC7) return 280 + c - 0xC0;
+        c = (c << 1) | code(1);
+        return 144 + c - 0x190;
+    }
+
+    public:
+        Inflater(const std::vector<uint8_t>& in, size_t pos) : _in(in), _pos(pos) {}
+
+        // false on blocks with dynamic codes or broken ones
+        bool inflate(std::string& out) {
+            static const uint16_t lengthBase[] = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+                35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+            static const uint16_t distanceBase[] = { 1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+                257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577 };
+            bool final = false;
+            while (!final) {
+                final = bits(1) == 1;
+                uint32_t type = bits(2);
+                if (type == 0) {
+                    // stored: LEN and NLEN from the next byte on, then the bytes themselves
+                    _bits = 0;
+                    _count = 0;
+                    uint32_t length = bits(16);
+                    if ((bits(16) ^ 0xFFFF) != length) return false;
+                    for (uint32_t i = 0; i < length; i++)
+                        out += (char)bits(8);
+                    stored++;
+                    continue;
+                }
+                if (type != 1) return false;
+                while (true) {
+                    int s = symbol();
+                    if (s < 256) {
+                        out += (char)s;
+                        continue;
+                    }
+                    if (s == 256) break;
+                    s -= 257;
+                    uint8_t extra = s < 8 || s == 28 ? 0 : (s - 4) / 4;
+                    size_t length = lengthBase[s] + bits(extra);
+                    uint32_t d = code(5);
+                    uint8_t dextra = d < 4 ? 0 : (d - 2) / 2;
+                    size_t distance = distanceBase[d] + bits(dextra);
+                    if (distance > out.size()) return false;
+                    for (size_t i = 0; i < length; i++)
+                        out += out[out.size() - distance];
+                }
+            }
+            // the trailer starts on the next byte
+            _count = 0;
+            return true;
+        }
+        // stored blocks seen
+        int stored = 0;
+        size_t position() const { return _pos; }
+};
+
+static uint32_t crc32(const std::string& data) {
+    uint32_t crc = 0xFFFFFFFF;
+    for (unsigned char c : data) {
+        crc ^= c;
+        for (int k = 0; k < 8; k++) crc = (crc >> 1) ^ (0xEDB88320 & (0 - (crc & 1)));
+    }
+    return ~crc;
+}
+
+static uint32_t adler32(const std::string& data) {
+    uint32_t s1 = 1, s2 = 0;
+    for (unsigned char c : data) {
+        s1 = (s1 + c) % 65521;
+        s2 = (s2 + s1) % 65521;
+    }
+    return s2 << 16 | s1;
+}
+
+static uint32_t le32(const std::vector<uint8_t>& b, size_t at) {
+    return b[at] | b[at + 1] << 8 | b[at + 2] << 16 | (uint32_t)b[at + 3] << 24;
+}
+
+// stored blocks of the last stream inflated
+static int storedBlocks = 0;
+
+// inflates a gzip or zlib stream and checks its framing, "" and a failed assertion if it is broken
+static std::string decompress(const std::vector<uint8_t>& data, service_content_coding_t coding) {
+    std::string out;
+    storedBlocks = 0;
+    if (coding == sccGzip) {
+        TEST_ASSERT_TRUE(data.size() >= 18);
+        TEST_ASSERT_EQUAL_HEX8(0x1F, data[0]);
+        TEST_ASSERT_EQUAL_HEX8(0x8B, data[1]);
+        Inflater inflater(data, 10);
+        TEST_ASSERT_TRUE(inflater.inflate(out));
+        TEST_ASSERT_EQUAL(data.size(), inflater.position() + 8);
+        TEST_ASSERT_EQUAL_HEX32(crc32(out), le32(data, inflater.position()));
+        TEST_ASSERT_EQUAL(out.size(), le32(data, inflater.position() + 4));
+        storedBlocks = inflater.stored;
+    }
+    else {
+        TEST_ASSERT_TRUE(data.size() >= 6);
+        TEST_ASSERT_EQUAL(8, data[0] & 0x0F);
+        TEST_ASSERT_EQUAL(0, (data[0] << 8 | data[1]) % 31);
+        Inflater inflater(data, 2);
+        TEST_ASSERT_TRUE(inflater.inflate(out));
+        size_t at = inflater.position();
+        TEST_ASSERT_EQUAL(data.size(), at + 4);
+        uint32_t adler = (uint32_t)data[at] << 24 | data[at + 1] << 16 | data[at + 2] << 8 | data[at + 3];
+        TEST_ASSERT_EQUAL_HEX32(adler32(out), adler);
+        storedBlocks = inflater.stored;
+    }
+    return out;
+}
+
+static std::vector<uint8_t> drain(DeflateEncoder& encoder, size_t step) {
+    std::vector<uint8_t> out;
+    uint8_t buffer[512];
+    size_t n;
+    while ((n = encoder.read(buffer, step)) > 0)
+        out.insert(out.end(), buffer, buffer + n);
+    return out;
+}
+
+// body source handing out its data in small odd pieces, declaring a size if one is given
+class PieceSource : public ServiceBodySource {
+    const std::string& _data;
+    size_t _pos = 0;
+    long _size;
+    public:
+        PieceSource(const std::string& data, long size = -1) : _data(data), _size(size) {}
+        long size() { return _size; }
+        size_t read(uint8_t* buffer, size_t length) {
+            size_t n = _data.size() - _pos;
+            if (n > 37) n = 37;
+            if (n > length) n = length;
+            memcpy(buffer, _data.data() + _pos, n);
+            _pos += n;
+            return n;
+        }
+};
+
+static std::string telemetry(int samples) {
+    std::string json = "[";
+    for (int i = 0; i < samples; i++) {
+        json += "{\"sensor\":\"greenhouse-7\",\"t\":" + std::to_string(20 + i % 7) + ".5,\"h\":"
+            + std::to_string(40 + i % 3) + ",\"seq\":" + std::to_string(i) + "},";
+    }
+    json += "{}]";
+    return json;
+}
+
+// server rejecting compressed bodies while strict, bodies are kept still encoded
+class UploadClient : public ScriptedClient {
+    protected:
+        void answer(const std::string& head, const std::string& body) {
+            bool encoded = head.find("Content-Encoding: ") != std::string::npos;
+            _rx += strict && encoded
+                ? "HTTP/1.1 415 Unsupported Media Type\r\nContent-Length: 0\r\n\r\n"
+                : "HTTP/1.1 201 Created\r\nContent-Length: 2\r\n\r\nok";
+        }
+
+    public:
+        bool strict = false;
+
+        void reset() {
+            ScriptedClient::reset();
+            strict = false;
+        }
+};
+
+UploadClient client;
+ServiceEndpoint endpoint("upload.local");
+static void post(const std::string& body) {
+    ServiceRequest request;
+    TEST_ASSERT_TRUE(endpoint.post("/telemetry", request));
+    track(request, 2000).fireContent(String(body.c_str())).await();
+}
+
+void setUp(void)
+{
+    client.reset();
+    endpoint.withKeepAlive(true);
+    endpoint.withCompression(sccGzip, 128);
+    service_endpoint_stats_t stats;
+    endpoint.getStats(stats, true);
+    outcome = outcome_t();
+}
+
+void tearDown(void)
+{
+}
+
+void test_gzip_round_trip_beyond_the_window() {
+    std::string json = telemetry(200);
+    DeflateEncoder gzip;
+    gzip.begin((const uint8_t*)json.data(), json.size());
+    std::vector<uint8_t> out = drain(gzip, 7);
+    TEST_ASSERT_EQUAL_STRING(json.c_str(), decompress(out, sccGzip).c_str());
+    TEST_ASSERT_EQUAL(json.size(), gzip.consumed());
+    TEST_ASSERT_EQUAL(out.size(), gzip.produced());
+    TEST_ASSERT_TRUE(out.size() * 4 < json.size());
+    TEST_ASSERT_EQUAL_STRING("gzip", gzip.contentEncoding());
+}
+
+void test_deflate_round_trip_from_a_source() {
+    std::string json = telemetry(120);
+    PieceSource source(json);
+    DeflateEncoder zlib(sccDeflate);
+    zlib.begin(source);
+    TEST_ASSERT_EQUAL(-1, zlib.size());
+    std::vector<uint8_t> out = drain(zlib, 512);
+    TEST_ASSERT_EQUAL_STRING(json.c_str(), decompress(out, sccDeflate).c_str());
+    TEST_ASSERT_EQUAL_STRING("deflate", zlib.contentEncoding());
+}
+
+void test_incompressible_and_tiny_bodies() {
+    std::string noise;
+    uint32_t x = 7;
+    for (int i = 0; i < 3000; i++) {
+        x = x * 1103515245 + 12345;
+        noise += (char)(x >> 16);
+    }
+    const std::string bodies[] = { noise, "", "a", "ab", "abcabcabcabc", std::string(5000, 'x') };
+    DeflateEncoder gzip;
+    for (const std::string& body : bodies) {
+        gzip.begin((const uint8_t*)body.data(), body.size());
+        std::vector<uint8_t> out = drain(gzip, 100);
+        TEST_ASSERT_TRUE(decompress(out, sccGzip) == body);
+    }
+    // random bytes are stored as they are, 5 bytes a block more
+    gzip.begin((const uint8_t*)noise.data(), noise.size());
+    std::vector<uint8_t> out = drain(gzip, 100);
+    TEST_ASSERT_TRUE(decompress(out, sccGzip) == noise);
+    TEST_ASSERT_EQUAL(6, storedBlocks);
+    TEST_ASSERT_TRUE(out.size() <= noise.size() + 18 + 6 * 5);
+}
+
+void test_stored_and_coded_blocks_mix() {
+    std::string noise;
+    uint32_t x = 11;
+    for (int i = 0; i < 1500; i++) {
+        x = x * 1103515245 + 12345;
+        noise += (char)(x >> 16);
+    }
+    std::string body = telemetry(40) + noise + telemetry(60) + noise.substr(0, 700) + std::string(3000, 'x');
+    PieceSource source(body);
+    DeflateEncoder zlib(sccDeflate);
+    zlib.begin(source);
+    std::vector<uint8_t> out = drain(zlib, 61);
+    TEST_ASSERT_TRUE(decompress(out, sccDeflate) == body);
+    TEST_ASSERT_TRUE(storedBlocks > 0);
+    TEST_ASSERT_TRUE(out.size() < body.size() / 2);
+}
+
+// streams checked once with python's zlib.decompress and gzip.decompress
+void test_output_matches_zlib_checked_fixtures() {
+    const char* json = "{\"sensor\":\"greenhouse-7\",\"t\":21.5,\"h\":41,\"sensor\":\"greenhouse-8\"}";
+    const std::vector<uint8_t> gzipped = {
+        0x1F, 0x8B, 0x08, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xFF, 0xAB, 0x56, 0x2A, 0x4E, 0xCD, 0x2B,
+        0xCE, 0x2F, 0x52, 0xB2, 0x52, 0x4A, 0x2F, 0x4A, 0x4D, 0xCD, 0xCB, 0xC8, 0x2F, 0x2D, 0x4E, 0xD5,
+        0x35, 0x57, 0xD2, 0x51, 0x2A, 0x51, 0xB2, 0x32, 0x32, 0xD4, 0x33, 0xD5, 0x51, 0xCA, 0x50, 0xB2,
+        0x32, 0x31, 0xD4, 0xC1, 0xAA, 0xCE, 0x42, 0xA9, 0x16, 0x00, 0xD4, 0x4A, 0x9C, 0x46, 0x41, 0x00,
+        0x00, 0x00 };
+    DeflateEncoder gzip;
+    gzip.begin((const uint8_t*)json, strlen(json));
+    TEST_ASSERT_TRUE(drain(gzip, 5) == gzipped);
+
+    // bytes the fixed code would grow go into a stored block
+    uint8_t high[40];
+    for (int i = 0; i < 40; i++) high[i] = 200 + i;
+    std::vector<uint8_t> deflated = { 0x28, 0x15, 0x01, 0x28, 0x00, 0xD7, 0xFF };
+    deflated.insert(deflated.end(), high, high + 40);
+    deflated.insert(deflated.end(), { 0xAA, 0x8A, 0x22, 0x4D });
+    DeflateEncoder zlib(sccDeflate);
+    zlib.begin(high, sizeof(high));
+    TEST_ASSERT_TRUE(drain(zlib, 512) == deflated);
+}
+
+void test_endpoint_compresses_large_bodies() {
+    std::string json = telemetry(50);
+    post(json);
+    TEST_ASSERT_EQUAL(201, outcome.statusCode);
+    TEST_ASSERT_EQUAL(1, client.heads.size());
+    TEST_ASSERT_TRUE(client.heads[0].find("Content-Encoding: gzip\r\n") != std::string::npos);
+    TEST_ASSERT_TRUE(client.heads[0].find("Transfer-Encoding: chunked\r\n") != std::string::npos);
+    TEST_ASSERT_TRUE(client.heads[0].find("Content-Length") == std::string::npos);
+    std::vector<uint8_t> body(client.bodies[0].begin(), client.bodies[0].end());
+    TEST_ASSERT_EQUAL_STRING(json.c_str(), decompress(body, sccGzip).c_str());
+
+    // below the threshold bodies go as they are
+    post("{\"t\":21.5}");
+    TEST_ASSERT_TRUE(client.heads[1].find("Content-Length: 10\r\n") != std::string::npos);
+    TEST_ASSERT_TRUE(client.heads[1].find("Content-Encoding") == std::string::npos);
+
+    #if FLUENTHTTP_METRICS
+    service_endpoint_stats_t stats;
+    TEST_ASSERT_TRUE(endpoint.getStats(stats));
+    TEST_ASSERT_EQUAL(1, stats.compressedBodies);
+    TEST_ASSERT_EQUAL(json.size(), stats.compressIn);
+    TEST_ASSERT_EQUAL(body.size(), stats.compressOut);
+    TEST_ASSERT_TRUE(stats.compressionRatio() < 50);
+    #endif
+}
+
+void test_rejected_encoding_falls_back_to_plain_bodies() {
+    client.strict = true;
+    std::string json = telemetry(50);
+    post(json);
+    TEST_ASSERT_EQUAL(201, outcome.statusCode);
+    TEST_ASSERT_EQUAL(2, client.heads.size());
+    TEST_ASSERT_TRUE(client.heads[0].find("Content-Encoding: gzip\r\n") != std::string::npos);
+    char length[32];
+    snprintf(length, sizeof(length), "Content-Length: %u\r\n", (unsigned)json.size());
+    TEST_ASSERT_TRUE(client.heads[1].find(length) != std::string::npos);
+    TEST_ASSERT_TRUE(client.heads[1].find("Content-Encoding") == std::string::npos);
+    TEST_ASSERT_TRUE(client.bodies[1] == json);
+
+    // the endpoint remembers the rejection
+    post(json);
+    TEST_ASSERT_EQUAL(201, outcome.statusCode);
+    TEST_ASSERT_EQUAL(3, client.heads.size());
+    TEST_ASSERT_TRUE(client.heads[2].find("Content-Encoding") == std::string::npos);
+}
+
+void test_rejected_source_is_not_sent_again() {
+    client.strict = true;
+    std::string json = telemetry(20);
+    PieceSource source(json);
+    ServiceRequest request;
+    TEST_ASSERT_TRUE(endpoint.post("/telemetry", request));
+    track(request).fireContent(source).await();
+    TEST_ASSERT_EQUAL(415, outcome.statusCode);
+    TEST_ASSERT_EQUAL(1, client.heads.size());
+    post(json);
+    TEST_ASSERT_EQUAL(201, outcome.statusCode);
+    TEST_ASSERT_TRUE(client.heads[1].find("Content-Encoding") == std::string::npos);
+}
+
+void test_source_not_matching_its_size_fails() {
+    std::string json = telemetry(20);
+    PieceSource source(json, json.size() + 100);
+    ServiceRequest request;
+    TEST_ASSERT_TRUE(endpoint.post("/telemetry", request));
+    track(request).fireContent(source).await();
+    TEST_ASSERT_EQUAL(1, outcome.failed);
+    TEST_ASSERT_EQUAL_STRING("failed to send request", outcome.message.c_str());
+    // the chunked body was never ended, the server saw no complete request
+    TEST_ASSERT_TRUE(client.written.size() > 0);
+    TEST_ASSERT_EQUAL(0, client.requests.size());
+}
+
+int main(int argc, char** argv)
+{
+    installHostArduino(&client);
+    endpoint.begin(&client);
+
+    UNITY_BEGIN();
+    RUN_TEST(test_gzip_round_trip_beyond_the_window);
+    RUN_TEST(test_deflate_round_trip_from_a_source);
+    RUN_TEST(test_incompressible_and_tiny_bodies);
+    RUN_TEST(test_stored_and_coded_blocks_mix);
+    RUN_TEST(test_output_matches_zlib_checked_fixtures);
+    RUN_TEST(test_endpoint_compresses_large_bodies);
+    RUN_TEST(test_rejected_encoding_falls_back_to_plain_bodies);
+    RUN_TEST(test_rejected_source_is_not_sent_again);
+    RUN_TEST(test_source_not_matching_its_size_fails);
+    return UNITY_END();
+}
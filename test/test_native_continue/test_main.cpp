@@ -0,0 +1,134 @@
+#include <Arduino.h>
+#include <unity.h>
+#include <fluenthttp.h>
+#include "../support/ScriptedClient.h"
+#include "../support/Outcome.h"
+
+// Expect: 100-continue against a scripted server that agrees, rejects or ignores the expectation
+
+enum continue_mode_t {
+    cmAgree,    // 100 Continue after the head, final response after the body
+    cmReject,   // 413 right after the head
+    cmIgnore,   // no interim response, final response after the body
+    cmHints     // 103 Early Hints first, then 100 Continue
+};
+
+class ContinueClient : public ScriptedClient {
+    bool _answeredHead = false;
+
+    // interim response once the head asking for it arrived
+    void answerHead(const std::string& head) {
+        if (_answeredHead || head.find("Expect: 100-continue\r\n") == std::string::npos) return;
+        _answeredHead = true;
+        if (mode == cmReject) {
+            _rx += "HTTP/1.1 413 Payload Too Large\r\nContent-Length: 0\r\n\r\n";
+            return;
+        }
+        if (mode == cmHints)
+            _rx += "HTTP/1.1 103 Early Hints\r\nLink: </style.css>\r\n\r\n";
+        if (mode != cmIgnore)
+            _rx += "HTTP/1.1 100 Continue\r\n\r\n";
+    }
+
+    protected:
+        void partial() {
+            size_t end = _in.find("\r\n\r\n");
+            if (end != std::string::npos)
+                answerHead(_in.substr(0, end + 2));
+        }
+        void answer(const std::string& head, const std::string& body) {
+            answerHead(head);
+            _rx += "HTTP/1.1 201 Created\r\nContent-Length: 2\r\n\r\nok";
+        }
+
+    public:
+        continue_mode_t mode = cmAgree;
+
+        void reset() {
+            ScriptedClient::reset();
+            _answeredHead = false;
+        }
+        size_t bodyLength() { return written.find("\r\n\r\n") != std::string::npos ? body().size() : 0; }
+};
+
+ContinueClient client;
+ServiceEndpoint endpoint("continue.local");
+
+static uint8_t body[2048];
+static const uint16_t CONTINUE_WAIT = 50;
+
+void upload(size_t length) {
+    ServiceRequest request;
+    TEST_ASSERT_TRUE(endpoint.post("/firmware", request));
+    track(request).fireContent(length, body);
+    request.await();
+}
+
+void setUp(void)
+{
+    endpoint.close();
+    client.reset();
+    outcome = outcome_t();
+}
+
+void tearDown(void)
+{
+}
+
+void test_body_follows_100_continue() {
+    client.mode = cmAgree;
+    upload(sizeof(body));
+    TEST_ASSERT_EQUAL(1, outcome.succeeded);
+    TEST_ASSERT_EQUAL(201, outcome.statusCode);
+    TEST_ASSERT_EQUAL(sizeof(body), client.bodyLength());
+}
+
+void test_rejected_upload_sends_no_body() {
+    client.mode = cmReject;
+    upload(sizeof(body));
+    TEST_ASSERT_EQUAL(1, outcome.failed);
+    TEST_ASSERT_EQUAL(413, outcome.statusCode);
+    TEST_ASSERT_EQUAL(0, client.bodyLength());
+    TEST_ASSERT_FALSE(client.connected());
+}
+
+void test_body_goes_after_wait_without_answer() {
+    client.mode = cmIgnore;
+    unsigned long t0 = millis();
+    upload(sizeof(body));
+    TEST_ASSERT_EQUAL(1, outcome.succeeded);
+    TEST_ASSERT_EQUAL(sizeof(body), client.bodyLength());
+    TEST_ASSERT_GREATER_OR_EQUAL(CONTINUE_WAIT, millis() - t0);
+}
+
+void test_other_interim_responses_are_skipped() {
+    client.mode = cmHints;
+    upload(sizeof(body));
+    TEST_ASSERT_EQUAL(1, outcome.succeeded);
+    TEST_ASSERT_EQUAL(201, outcome.statusCode);
+    TEST_ASSERT_EQUAL(sizeof(body), client.bodyLength());
+}
+
+void test_small_body_is_sent_right_away() {
+    client.mode = cmReject;
+    upload(64);
+    TEST_ASSERT_EQUAL(1, outcome.succeeded);
+    TEST_ASSERT_EQUAL(64, client.bodyLength());
+}
+
+int main(int argc, char** argv)
+{
+    installHostArduino(&client);
+    client.setTimeout(100);
+    endpoint.begin(&client);
+    endpoint.withKeepAlive(true)
+        .withExpectContinue(1024, CONTINUE_WAIT);
+
+    UNITY_BEGIN();
+    RUN_TEST(test_body_follows_100_continue);
+    RUN_TEST(test_rejected_upload_sends_no_body);
+    RUN_TEST(test_body_goes_after_wait_without_answer);
+    RUN_TEST(test_other_interim_responses_are_skipped);
+    RUN_TEST(test_small_body_is_sent_right_away);
+    return UNITY_END();
+}
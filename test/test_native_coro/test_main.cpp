@@ -0,0 +1,258 @@
+#include <Arduino.h>
+#include <unity.h>
+#include <fluenthttp.h>
+#include <ServiceCoroutine.h>
+#include <stdexcept>
+#include <string>
+#include "../support/ScriptedClient.h"
+
+// coroutines awaiting requests, built with C++20 (env:native_coro): chained requests resume
+// in order, frames come aligned from the pool and exceptions leaving a task reach poll().
+// Frame pools are tested in any build
+
+StaticServiceFramePool<8192, 3> pool;
+
+void test_frames_are_aligned() {
+    TEST_ASSERT_EQUAL(0, pool.blockSize() % alignof(max_align_t));
+    TEST_ASSERT_TRUE(pool.blockSize() >= 8192);
+    StaticServiceFramePool<100, 2> small;
+    TEST_ASSERT_EQUAL(0, small.blockSize() % alignof(max_align_t));
+    TEST_ASSERT_TRUE(small.blockSize() >= 100);
+
+    // an odd block size is rounded down, so the blocks stay inside the storage
+    alignas(max_align_t) static uint8_t storage[3 * 202];
+    ServiceFramePool odd(storage, 202, 3);
+    TEST_ASSERT_EQUAL(202 / alignof(max_align_t) * alignof(max_align_t), odd.blockSize());
+    void* frames[3];
+    for (int i = 0; i < 3; i++) {
+        frames[i] = ServiceFramePool::allocateFrame(&odd, 100);
+        TEST_ASSERT_NOT_NULL(frames[i]);
+        TEST_ASSERT_EQUAL(0, (uintptr_t)frames[i] % alignof(max_align_t));
+        TEST_ASSERT_TRUE((uint8_t*)frames[i] + 100 <= storage + sizeof(storage));
+    }
+    TEST_ASSERT_NULL(ServiceFramePool::allocateFrame(&odd, 100));
+    for (int i = 0; i < 3; i++)
+        ServiceFramePool::releaseFrame(frames[i]);
+    TEST_ASSERT_EQUAL(0, odd.used());
+}
+
+#if defined(__cpp_impl_coroutine)
+
+// answers by request path
+class RouteClient : public ScriptedClient {
+    protected:
+        void answer(const std::string& head, const std::string& body) {
+            if (head.compare(0, 12, "GET /config ") == 0)
+                _rx += "HTTP/1.1 200 OK\r\nContent-Length: 10\r\n\r\ninterval=5";
+            else if (head.compare(0, 9, "GET /log ") == 0)
+                // the rest is pushed by the test
+                _rx += "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n5\r\nfirst\r\n";
+            else if (head.compare(0, 15, "POST /telemetry") == 0)
+                _rx += "HTTP/1.1 201 Created\r\nContent-Length: " + std::to_string(body.size()) + "\r\n\r\n" + body;
+            else
+                _rx += "HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\n\r\n";
+        }
+};
+
+RouteClient client;
+ServiceEndpoint endpoint("coro.local");
+ServiceScheduler scheduler;
+
+static std::string trail;
+
+static void drive() {
+    uint32_t t0 = millis();
+    while (!scheduler.idle() && millis() - t0 < 2000) {
+        scheduler.poll();
+        delay(1);
+    }
+}
+
+ServiceTask configureAndReport(ServiceFramePool& frames, const char* name) {
+    char config[16] = {0};
+    service_result_t first = co_await endpoint.get("/config").withContent(config, sizeof(config) - 1).on(scheduler);
+    trail += std::string(name) + ":" + std::to_string(first.response.statusCode) + "(" + config + ") ";
+    // the second request is built from the answer to the first
+    char report[32];
+    size_t length = snprintf(report, sizeof(report), "%s %s", name, config);
+    char echo[32] = {0};
+    service_result_t second = co_await endpoint.post("/telemetry", (uint8_t*)report, length)
+        .withContent(echo, sizeof(echo) - 1).on(scheduler);
+    trail += std::string(name) + ":" + std::to_string(second.response.statusCode) + "(" + echo + ") ";
+    service_result_t third = co_await endpoint.get("/missing").on(scheduler);
+    trail += std::string(name) + ":" + std::to_string(third.response.statusCode) + (third.ok() ? " ok" : " failed");
+}
+
+ServiceTask readLog(ServiceFramePool& frames) {
+    char log[32] = {0};
+    service_result_t result = co_await endpoint.get("/log").withContent(log, sizeof(log) - 1).on(scheduler);
+    trail += std::to_string(result.contentRead) + "(" + log + ")";
+}
+
+ServiceTask throwAfterAwait(ServiceFramePool& frames, ServiceScheduler& on) {
+    co_await endpoint.get("/config").on(on);
+    throw std::runtime_error("after await");
+}
+
+ServiceTask throwRightAway(ServiceFramePool& frames, bool fail) {
+    if (fail)
+        throw std::runtime_error("before await");
+    co_await endpoint.get("/config").on(scheduler);
+}
+
+void setUp(void)
+{
+    client.reset();
+    endpoint.withKeepAlive(true);
+    trail.clear();
+}
+
+void tearDown(void)
+{
+}
+
+void test_chained_requests_resume_in_order() {
+    TEST_ASSERT_TRUE(configureAndReport(pool, "a"));
+    TEST_ASSERT_EQUAL(1, pool.used());
+    drive();
+    TEST_ASSERT_TRUE(scheduler.idle());
+    TEST_ASSERT_EQUAL_STRING("a:200(interval=5) a:201(a interval=5) a:404 failed", trail.c_str());
+    TEST_ASSERT_EQUAL(3, client.requests.size());
+    TEST_ASSERT_TRUE(client.bodies[1] == "a interval=5");
+    // the frame went back to the pool
+    TEST_ASSERT_EQUAL(0, pool.used());
+}
+
+void test_tasks_take_turns_on_the_endpoint() {
+    TEST_ASSERT_TRUE(configureAndReport(pool, "a"));
+    TEST_ASSERT_TRUE(configureAndReport(pool, "b"));
+    TEST_ASSERT_EQUAL(2, pool.used());
+    drive();
+    TEST_ASSERT_TRUE(scheduler.idle());
+    TEST_ASSERT_EQUAL(6, client.requests.size());
+    TEST_ASSERT_TRUE(trail.find("b:201(b interval=5)") != std::string::npos);
+    TEST_ASSERT_TRUE(trail.find("a:201(a interval=5)") != std::string::npos);
+    TEST_ASSERT_EQUAL(0, pool.used());
+}
+
+void test_chunked_content_is_read_between_polls() {
+    TEST_ASSERT_TRUE(readLog(pool));
+    // the size line of the second chunk arrives in pieces, poll() returns meanwhile
+    for (int i = 0; i < 5; i++)
+        TEST_ASSERT_EQUAL(0, scheduler.poll());
+    client.push("7");
+    TEST_ASSERT_EQUAL(0, scheduler.poll());
+    client.push("\r\n,secon");
+    TEST_ASSERT_EQUAL(0, scheduler.poll());
+    TEST_ASSERT_FALSE(scheduler.idle());
+    client.push("d\r\n0\r\n\r\n");
+    drive();
+    TEST_ASSERT_TRUE(scheduler.idle());
+    TEST_ASSERT_EQUAL_STRING("12(first,second)", trail.c_str());
+    TEST_ASSERT_EQUAL(0, pool.used());
+}
+
+void test_exception_after_await_is_rethrown_by_poll() {
+    TEST_ASSERT_TRUE(throwAfterAwait(pool, scheduler));
+    std::string message;
+    uint32_t t0 = millis();
+    while (!scheduler.idle() && millis() - t0 < 2000) {
+        try {
+            scheduler.poll();
+        }
+        catch (std::runtime_error& e) {
+            message = e.what();
+        }
+        delay(1);
+    }
+    TEST_ASSERT_EQUAL_STRING("after await", message.c_str());
+    TEST_ASSERT_EQUAL(0, pool.used());
+    // nothing is thrown twice
+    scheduler.poll();
+}
+
+void test_exception_before_await_is_rethrown_by_poll() {
+    TEST_ASSERT_TRUE(throwRightAway(pool, true));
+    TEST_ASSERT_EQUAL(0, pool.used());
+    // no scheduler is known yet, the global one rethrows
+    scheduler.poll();
+    std::string message;
+    try {
+        ServiceScheduler::global().poll();
+    }
+    catch (std::runtime_error& e) {
+        message = e.what();
+    }
+    TEST_ASSERT_EQUAL_STRING("before await", message.c_str());
+    // the next task runs normally
+    TEST_ASSERT_TRUE(throwRightAway(pool, false));
+    drive();
+    TEST_ASSERT_EQUAL(1, client.requests.size());
+    TEST_ASSERT_EQUAL(0, pool.used());
+}
+
+void test_exception_stays_with_its_scheduler() {
+    ServiceScheduler other;
+    TEST_ASSERT_TRUE(throwAfterAwait(pool, other));
+    std::string message;
+    uint32_t t0 = millis();
+    while (!other.idle() && millis() - t0 < 2000) {
+        // the scheduler of another task never sees it
+        scheduler.poll();
+        ServiceScheduler::global().poll();
+        try {
+            other.poll();
+        }
+        catch (std::runtime_error& e) {
+            message = e.what();
+        }
+        delay(1);
+    }
+    TEST_ASSERT_EQUAL_STRING("after await", message.c_str());
+    TEST_ASSERT_EQUAL(0, pool.used());
+}
+
+void test_frames_hold_no_requests() {
+    // the request lives in the endpoint's pool, a frame smaller than one does
+    StaticServiceFramePool<sizeof(ServiceRequest), 1> small;
+    TEST_ASSERT_TRUE(sizeof(ServiceAwaitable) < sizeof(ServiceRequest) / 2);
+    TEST_ASSERT_TRUE(readLog(small));
+    TEST_ASSERT_EQUAL(1, small.used());
+    client.push("7\r\n,second\r\n0\r\n\r\n");
+    drive();
+    TEST_ASSERT_EQUAL_STRING("12(first,second)", trail.c_str());
+    TEST_ASSERT_EQUAL(0, small.used());
+}
+
+#else
+
+void setUp(void)
+{
+}
+
+void tearDown(void)
+{
+}
+
+#endif /* __cpp_impl_coroutine */
+
+int main(int argc, char** argv)
+{
+    #if defined(__cpp_impl_coroutine)
+    installHostArduino(&client);
+    endpoint.begin(&client);
+    #endif
+
+    UNITY_BEGIN();
+    RUN_TEST(test_frames_are_aligned);
+    #if defined(__cpp_impl_coroutine)
+    RUN_TEST(test_chained_requests_resume_in_order);
+    RUN_TEST(test_tasks_take_turns_on_the_endpoint);
+    RUN_TEST(test_chunked_content_is_read_between_polls);
+    RUN_TEST(test_exception_after_await_is_rethrown_by_poll);
+    RUN_TEST(test_exception_before_await_is_rethrown_by_poll);
+    RUN_TEST(test_exception_stays_with_its_scheduler);
+    RUN_TEST(test_frames_hold_no_requests);
+    #endif
+    return UNITY_END();
+}
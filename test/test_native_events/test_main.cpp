@@ -0,0 +1,352 @@
+#include <Arduino.h>
+#include <unity.h>
+#include <fluenthttp.h>
+#include <ServiceEventStream.h>
+#include "../support/ScriptedClient.h"
+#include "../support/AllocationCounter.h"
+
+// text/event-stream parsing and long-lived requests: events across yields,
+// reconnects with Last-Event-ID and the idle timeout
+
+// one scripted response per connection, the test pushes more content while streaming
+class EventClient : public ScriptedClient {
+    protected:
+        void answer(const std::string& head, const std::string& body) {
+            if ((size_t)connects <= responses.size())
+                _rx += responses[connects - 1];
+        }
+
+    public:
+        std::vector<std::string> responses;
+
+        void reset() {
+            ScriptedClient::reset();
+            responses.clear();
+        }
+        void reserve(size_t size) { _rx.reserve(size); }
+};
+
+struct received_t {
+    std::string event;
+    std::string data;
+    std::string id;
+};
+
+EventClient client;
+ServiceEndpoint endpoint("events.local");
+static std::vector<received_t> received;
+static const char* streamHead = "HTTP/1.1 200 OK\r\nContent-Type: text/event-stream\r\nCache-Control: no-cache\r\n\r\n";
+
+void collect(const service_event_t& e) {
+    received.push_back({ e.event, std::string(e.data, e.dataLength), e.id });
+}
+
+std::string chunk(const std::string& data) {
+    char size[12];
+    snprintf(size, sizeof(size), "%x\r\n", (unsigned int)data.size());
+    return size + data + "\r\n";
+}
+
+void feed(ServiceEventStream& events, const std::string& data, size_t step) {
+    for (size_t pos = 0; pos < data.size(); pos += step) {
+        std::string part = data.substr(pos, step);
+        events.feed((const uint8_t*)part.data(), part.size());
+    }
+}
+
+// yields until done() holds, the request finished or ms passed
+template <typename Done>
+void yieldUntil(ServiceRequest& request, Done done, uint32_t ms = 500) {
+    uint32_t t0 = millis();
+    while (!done() && !request.finished() && millis() - t0 < ms) {
+        request.yield();
+        delay(1);
+    }
+}
+
+// yields until the request finished or ms passed
+void yieldFor(ServiceRequest& request, uint32_t ms) {
+    yieldUntil(request, [] { return false; }, ms);
+}
+
+static bool firstReceived() { return received.size() == 1; }
+
+void setUp(void)
+{
+    client.reset();
+    received.clear();
+    endpoint.withRetry(service_retry_policy_t());
+}
+
+void tearDown(void)
+{
+}
+
+void test_parses_fields_and_line_endings() {
+    ServiceEventStream events(collect);
+    events.begin(false);
+    feed(events,
+        "data: first\r\ndata:second\n\n"
+        "event: update\rdata: {\"x\":1}\r\r"
+        ": comment only\n\n"
+        "id: 7\nfoo: ignored\ndata\n\n"
+        "retry: 1500\n\n"
+        "retry: 15x\ndata:  two spaces\n\n", 64);
+    TEST_ASSERT_EQUAL(4, received.size());
+    TEST_ASSERT_TRUE(received[0].event == "message");
+    TEST_ASSERT_TRUE(received[0].data == "first\nsecond");
+    TEST_ASSERT_TRUE(received[1].event == "update");
+    TEST_ASSERT_TRUE(received[1].data == "{\"x\":1}");
+    TEST_ASSERT_TRUE(received[2].id == "7");
+    TEST_ASSERT_TRUE(received[2].data == "");
+    TEST_ASSERT_TRUE(received[3].data == " two spaces");
+    TEST_ASSERT_TRUE(received[3].event == "message");
+    TEST_ASSERT_EQUAL_STRING("7", events.lastEventId());
+    TEST_ASSERT_EQUAL(1500, events.reconnectDelay());
+}
+
+void test_parses_chunked_content_split_anywhere() {
+    std::string content = "id: 1\ndata: alpha\n\n" "event: tick\r\ndata: beta\r\n\r\n" "data: gamma\n\n";
+    std::string chunked = chunk(content.substr(0, 10)) + chunk(content.substr(10, 25))
+        + chunk(content.substr(35)) + "0\r\n\r\n";
+    for (size_t step = 1; step <= 9; step += 4) {
+        received.clear();
+        ServiceEventStream events(collect);
+        events.begin(true);
+        feed(events, chunked, step);
+        TEST_ASSERT_EQUAL(3, received.size());
+        TEST_ASSERT_TRUE(received[0].data == "alpha");
+        TEST_ASSERT_TRUE(received[1].event == "tick");
+        TEST_ASSERT_TRUE(received[1].data == "beta");
+        TEST_ASSERT_TRUE(received[2].data == "gamma");
+        TEST_ASSERT_TRUE(received[2].id == "1");
+    }
+    ServiceEventStream events(collect);
+    events.begin(true);
+    TEST_ASSERT_FALSE(events.feed((const uint8_t*)"0\r\n\r\n", 5));
+}
+
+void test_long_data_is_truncated() {
+    ServiceEventStream events(collect);
+    events.begin(false);
+    std::string data(FLUENTHTTP_EVENT_DATA_SIZE + 50, 'x');
+    feed(events, "data: " + data + "\n\ndata: next\n\n", 32);
+    TEST_ASSERT_EQUAL(2, received.size());
+    TEST_ASSERT_EQUAL(FLUENTHTTP_EVENT_DATA_SIZE - 1, received[0].data.size());
+    TEST_ASSERT_TRUE(received[1].data == "next");
+}
+
+void test_streams_events_across_yields() {
+    client.responses.push_back(streamHead);
+    static int opened;
+    opened = 0;
+    ServiceEventStream events([](const service_event_t& e) { collect(e); });
+    ServiceRequest request;
+    TEST_ASSERT_TRUE(endpoint.get("/events", request));
+    request.withTimeout(30)
+        .withEventStream(events)
+        .onSuccess([](service_response_t r) { opened++; })
+        .fire();
+    std::string head = client.requests[0];
+    TEST_ASSERT_TRUE(head.find("Accept: text/event-stream\r\n") != std::string::npos);
+    TEST_ASSERT_TRUE(head.find("Last-Event-ID") == std::string::npos);
+
+    yieldUntil(request, [&] { return request.getStatus() == srsStreaming; });
+    TEST_ASSERT_EQUAL(srsStreaming, request.getStatus());
+    TEST_ASSERT_EQUAL(1, opened);
+    // the pause between events is longer than the request timeout
+    for (int i = 0; i < 3; i++) {
+        client.push("data: " + std::to_string(i) + "\n");
+        yieldFor(request, 20);
+        client.push("\n");
+        yieldFor(request, 40);
+        TEST_ASSERT_EQUAL(i + 1, received.size());
+        TEST_ASSERT_TRUE(received[i].data == std::to_string(i));
+    }
+    TEST_ASSERT_FALSE(request.finished());
+    TEST_ASSERT_EQUAL(1, client.connects);
+
+    request.cancel("done");
+    TEST_ASSERT_TRUE(request.finished());
+    TEST_ASSERT_FALSE(client.connected());
+}
+
+void test_reconnects_with_last_event_id() {
+    client.responses.push_back(std::string(streamHead) + "retry: 10\nid: 41\ndata: a\n\n");
+    client.responses.push_back(std::string(streamHead) + "id: 42\ndata: b\n\n");
+    static ServiceRequest request;
+    ServiceEventStream events([](const service_event_t& e) {
+        collect(e);
+        if (received.size() == 2) request.cancel("enough");
+    });
+    TEST_ASSERT_TRUE(endpoint.get("/events", request));
+    request.withEventStream(events).fire();
+    yieldUntil(request, firstReceived);
+    TEST_ASSERT_EQUAL(1, received.size());
+    // the server goes away, the stream comes back after the retry delay
+    client.hangUp();
+    yieldFor(request, 200);
+    TEST_ASSERT_TRUE(request.finished());
+    TEST_ASSERT_EQUAL(2, client.connects);
+    TEST_ASSERT_TRUE(client.requests[1].find("\r\nLast-Event-ID: 41\r\n\r\n") != std::string::npos);
+    TEST_ASSERT_EQUAL(2, received.size());
+    TEST_ASSERT_TRUE(received[1].data == "b");
+    TEST_ASSERT_EQUAL_STRING("42", events.lastEventId());
+}
+
+void test_idle_stream_reconnects() {
+    client.responses.push_back(streamHead);
+    client.responses.push_back(std::string(streamHead) + "data: fresh\n\n");
+    static ServiceRequest request;
+    ServiceEventStream events([](const service_event_t& e) {
+        collect(e);
+        request.cancel("enough");
+    });
+    events.withIdleTimeout(30).withReconnectDelay(5).withLastEventId("stored");
+    TEST_ASSERT_TRUE(endpoint.get("/events", request));
+    request.withEventStream(events).fire();
+    TEST_ASSERT_TRUE(client.requests[0].find("Last-Event-ID: stored\r\n") != std::string::npos);
+    yieldFor(request, 20);
+    TEST_ASSERT_EQUAL(1, client.connects);
+    yieldFor(request, 200);
+    TEST_ASSERT_EQUAL(2, client.connects);
+    TEST_ASSERT_EQUAL(1, received.size());
+    TEST_ASSERT_TRUE(received[0].data == "fresh");
+}
+
+void test_error_status_ends_the_stream() {
+    client.responses.push_back("HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\n\r\n");
+    static int failed;
+    failed = 0;
+    ServiceEventStream events(collect);
+    events.withReconnectDelay(5);
+    ServiceRequest request;
+    TEST_ASSERT_TRUE(endpoint.get("/events", request));
+    request.withEventStream(events)
+        .onFailure([](service_response_t r) { failed = r.statusCode; })
+        .fire();
+    yieldFor(request, 50);
+    TEST_ASSERT_TRUE(request.finished());
+    TEST_ASSERT_EQUAL(404, failed);
+    TEST_ASSERT_EQUAL(1, client.connects);
+}
+
+void test_cut_event_does_not_advance_the_id() {
+    client.responses.push_back(std::string(streamHead) + "retry: 5\nid: 1\ndata: a\n\nid: 2\ndata: cut");
+    client.responses.push_back(std::string(streamHead) + "id: 2\ndata: b\n\n");
+    static ServiceRequest request;
+    ServiceEventStream events([](const service_event_t& e) {
+        collect(e);
+        if (received.size() == 2) request.cancel("enough");
+    });
+    TEST_ASSERT_TRUE(endpoint.get("/events", request));
+    request.withEventStream(events).fire();
+    yieldUntil(request, firstReceived);
+    TEST_ASSERT_EQUAL(1, received.size());
+    TEST_ASSERT_EQUAL_STRING("1", events.lastEventId());
+    client.hangUp();
+    yieldFor(request, 200);
+    TEST_ASSERT_EQUAL(2, client.connects);
+    TEST_ASSERT_TRUE(client.requests[1].find("\r\nLast-Event-ID: 1\r\n\r\n") != std::string::npos);
+    TEST_ASSERT_TRUE(received[1].data == "b");
+    TEST_ASSERT_TRUE(received[1].id == "2");
+}
+
+void test_failed_reconnects_back_off_and_give_up() {
+    service_retry_policy_t policy;
+    policy.maxAttempts = 3;
+    policy.maxBackoff = 1000;
+    endpoint.withRetry(policy);
+    client.responses.push_back(std::string(streamHead) + "retry: 10\ndata: a\n\n");
+    static int failed;
+    static String message;
+    failed = 0;
+    ServiceEventStream events(collect);
+    ServiceRequest request;
+    TEST_ASSERT_TRUE(endpoint.get("/events", request));
+    request.withEventStream(events)
+        .onFailure([](service_response_t r) {
+            failed++;
+            message = r.statusMessage;
+        })
+        .fire();
+    yieldUntil(request, firstReceived);
+    TEST_ASSERT_EQUAL(1, received.size());
+    client.refuseConnects = 10;
+    client.hangUp();
+    uint32_t t0 = millis();
+    yieldFor(request, 500);
+    // 10 + 20 + 40 ms before the three reconnects
+    TEST_ASSERT_TRUE(request.finished());
+    TEST_ASSERT_GREATER_OR_EQUAL(70, millis() - t0);
+    TEST_ASSERT_EQUAL(7, client.refuseConnects);
+    TEST_ASSERT_EQUAL(1, failed);
+    TEST_ASSERT_EQUAL_STRING("failed to connect to server", message.c_str());
+}
+
+void test_reconnect_answered_with_error_ends_the_stream() {
+    service_retry_policy_t policy;
+    policy.maxAttempts = 5;
+    endpoint.withRetry(policy);
+    client.responses.push_back(std::string(streamHead) + "retry: 5\ndata: a\n\n");
+    client.responses.push_back("HTTP/1.1 503 Service Unavailable\r\nRetry-After: 0\r\nContent-Length: 0\r\n\r\n");
+    static int failed;
+    failed = 0;
+    ServiceEventStream events(collect);
+    ServiceRequest request;
+    TEST_ASSERT_TRUE(endpoint.get("/events", request));
+    request.withEventStream(events)
+        .onFailure([](service_response_t r) { failed = r.statusCode; })
+        .fire();
+    yieldUntil(request, firstReceived);
+    client.hangUp();
+    yieldFor(request, 200);
+    TEST_ASSERT_TRUE(request.finished());
+    TEST_ASSERT_EQUAL(503, failed);
+    TEST_ASSERT_EQUAL(2, client.connects);
+}
+
+void test_streaming_does_not_allocate() {
+    #if ALLOCATION_COUNTER_ENABLED
+    client.responses.push_back(streamHead);
+    static int count;
+    count = 0;
+    ServiceEventStream events([](const service_event_t& e) { count++; });
+    ServiceRequest request;
+    TEST_ASSERT_TRUE(endpoint.get("/events", request));
+    request.withEventStream(events).fire();
+    yieldUntil(request, [&] { return request.getStatus() == srsStreaming; });
+    TEST_ASSERT_EQUAL(srsStreaming, request.getStatus());
+    std::string batch;
+    for (int i = 0; i < 200; i++)
+        batch += "event: sample\nid: " + std::to_string(i) + "\ndata: {\"value\": " + std::to_string(i * 7) + "}\n\n";
+    client.push(batch);
+    allocation_stats_t a0 = allocationSnapshot();
+    for (int i = 0; i < 100 && count < 200; i++)
+        request.yield();
+    allocation_stats_t a1 = allocationSnapshot();
+    TEST_ASSERT_EQUAL(200, count);
+    TEST_ASSERT_EQUAL(0, a1.allocations - a0.allocations);
+    request.cancel("done");
+    #endif
+}
+
+int main(int argc, char** argv)
+{
+    installHostArduino(&client);
+    endpoint.begin(&client);
+
+    UNITY_BEGIN();
+    RUN_TEST(test_parses_fields_and_line_endings);
+    RUN_TEST(test_parses_chunked_content_split_anywhere);
+    RUN_TEST(test_long_data_is_truncated);
+    RUN_TEST(test_streams_events_across_yields);
+    RUN_TEST(test_reconnects_with_last_event_id);
+    RUN_TEST(test_idle_stream_reconnects);
+    RUN_TEST(test_error_status_ends_the_stream);
+    RUN_TEST(test_cut_event_does_not_advance_the_id);
+    RUN_TEST(test_failed_reconnects_back_off_and_give_up);
+    RUN_TEST(test_reconnect_answered_with_error_ends_the_stream);
+    RUN_TEST(test_streaming_does_not_allocate);
+    return UNITY_END();
+}
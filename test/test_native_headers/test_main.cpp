@@ -0,0 +1,114 @@
+#include <Arduino.h>
+#include <unity.h>
+#include <fluenthttp.h>
+#include <ServiceBatch.h>
+#include "../support/ScriptedClient.h"
+#include "../support/Outcome.h"
+
+// head template of an endpoint: default headers and the connection header are serialized
+// once and spliced into every request head, changes of the endpoint rebuild it
+
+ScriptedClient client;
+ServiceEndpoint endpoint("headers.local");
+
+static void get(const char* uri) {
+    ServiceRequest request;
+    TEST_ASSERT_TRUE(endpoint.get(uri, request));
+    track(request).fire().await();
+    TEST_ASSERT_EQUAL(1, outcome.succeeded);
+    outcome = outcome_t();
+}
+
+static bool contains(const std::string& head, const char* text) {
+    return head.find(text) != std::string::npos;
+}
+
+void setUp(void)
+{
+    client.reset();
+    endpoint.clearDefaultHeaders();
+    endpoint.withKeepAlive(true);
+    outcome = outcome_t();
+}
+
+void tearDown(void)
+{
+}
+
+void test_default_headers_follow_the_fixed_ones() {
+    endpoint.withDefaultHeader("Authorization", "Bearer 42").withDefaultHeader("X-Device", "greenhouse-7");
+    get("/status");
+    TEST_ASSERT_EQUAL_STRING("GET /status HTTP/1.1\r\nHost: headers.local\r\nAccept: */*\r\n"
+        "Connection: keep-alive\r\nAuthorization: Bearer 42\r\nX-Device: greenhouse-7\r\n",
+        client.heads[0].c_str());
+}
+
+void test_request_headers_come_after_the_default_ones() {
+    endpoint.withDefaultHeader("X-Device", "greenhouse-7");
+    ServiceRequest request;
+    TEST_ASSERT_TRUE(endpoint.get("/status", request));
+    track(request).addHeader("Accept-Language", "de").fire().await();
+    TEST_ASSERT_EQUAL(1, outcome.succeeded);
+    const std::string& head = client.heads[0];
+    TEST_ASSERT_TRUE(head.find("X-Device: greenhouse-7\r\n") < head.find("Accept-Language: de\r\n"));
+}
+
+void test_cleared_default_headers_are_not_sent() {
+    endpoint.withDefaultHeader("Authorization", "Bearer 42");
+    get("/a");
+    endpoint.clearDefaultHeaders();
+    get("/b");
+    endpoint.withDefaultHeader("X-Device", "greenhouse-7");
+    get("/c");
+    TEST_ASSERT_EQUAL(3, client.heads.size());
+    TEST_ASSERT_TRUE(contains(client.heads[0], "Authorization: Bearer 42\r\n"));
+    TEST_ASSERT_FALSE(contains(client.heads[1], "Authorization"));
+    TEST_ASSERT_FALSE(contains(client.heads[2], "Authorization"));
+    TEST_ASSERT_TRUE(contains(client.heads[2], "X-Device: greenhouse-7\r\n"));
+}
+
+void test_keep_alive_change_rebuilds_the_template() {
+    endpoint.withDefaultHeader("X-Device", "greenhouse-7");
+    get("/a");
+    endpoint.withKeepAlive(false);
+    get("/b");
+    endpoint.withKeepAlive(true);
+    get("/c");
+    TEST_ASSERT_TRUE(contains(client.heads[0], "Connection: keep-alive\r\n"));
+    TEST_ASSERT_TRUE(contains(client.heads[1], "Connection: close\r\n"));
+    TEST_ASSERT_FALSE(contains(client.heads[1], "keep-alive"));
+    TEST_ASSERT_TRUE(contains(client.heads[2], "Connection: keep-alive\r\n"));
+    // the default headers survive the rebuild
+    for (const std::string& head : client.heads)
+        TEST_ASSERT_TRUE(contains(head, "X-Device: greenhouse-7\r\n"));
+    // without keep-alive every request connects again
+    TEST_ASSERT_EQUAL(2, client.connects);
+}
+
+void test_batch_requests_carry_the_template() {
+    endpoint.withDefaultHeader("X-Device", "greenhouse-7");
+    ServiceBatch batch;
+    batch.get("/a").get("/b").get("/c");
+    TEST_ASSERT_TRUE(endpoint.fire(batch));
+    batch.await();
+    TEST_ASSERT_EQUAL(3, batch.succeeded());
+    TEST_ASSERT_EQUAL(3, client.heads.size());
+    for (const std::string& head : client.heads) {
+        TEST_ASSERT_TRUE(contains(head, "Host: headers.local\r\n"));
+        TEST_ASSERT_TRUE(contains(head, "X-Device: greenhouse-7\r\n"));
+    }
+}
+
+int main(int argc, char** argv)
+{
+    installHostArduino(&client);
+    endpoint.begin(&client);
+
+    UNITY_BEGIN();
+    RUN_TEST(test_default_headers_follow_the_fixed_ones);
+    RUN_TEST(test_request_headers_come_after_the_default_ones);
+    RUN_TEST(test_cleared_default_headers_are_not_sent);
+    RUN_TEST(test_keep_alive_change_rebuilds_the_template);
+    RUN_TEST(test_batch_requests_carry_the_template);
+    return UNITY_END();
+}
@@ -0,0 +1,183 @@
+#include <Arduino.h>
+#include <unity.h>
+#include <fluenthttp.h>
+#include "../support/HostArduino.h"
+#include "../support/ShapedClient.h"
+#include "../support/Outcome.h"
+
+// hedged GETs: a request without a first response byte after the hedge delay is sent
+// once more over the second client, whichever response head completes first is delivered
+
+// selects itself for the Stream helpers whenever the request looks at it
+class HedgeClient : public ShapedClient {
+    public:
+        HedgeClient(uint32_t seed) : ShapedClient(seed) {}
+        int available() { hostSelectStream(this); return ShapedClient::available(); }
+        int peek() { hostSelectStream(this); return ShapedClient::peek(); }
+};
+
+HedgeClient primary(1);
+HedgeClient second(2);
+ServiceEndpoint endpoint("hedge.local");
+
+static const char* response = "HTTP/1.1 200 OK\r\nContent-Length: 2\r\n\r\nok";
+static const uint32_t HEDGE_DELAY = 20;
+
+network_shape_t latency(uint32_t micros) {
+    network_shape_t shape;
+    shape.latencyMicros = micros;
+    return shape;
+}
+
+void setUp(void)
+{
+    primary.reset();
+    second.reset();
+    primary.stop();
+    second.stop();
+    primary.setResponse(response);
+    second.setResponse(response);
+    endpoint.begin(&primary);
+    endpoint.withHedging(&second, HEDGE_DELAY);
+    service_endpoint_stats_t stats;
+    endpoint.getStats(stats, true);
+    outcome = outcome_t();
+}
+
+void tearDown(void)
+{
+}
+
+void test_fast_response_fires_no_hedge() {
+    primary.setShape(latency(0));
+    ServiceRequest request;
+    TEST_ASSERT_TRUE(endpoint.get("/status", request));
+    track(request);
+    request.fire().await();
+    TEST_ASSERT_EQUAL(1, outcome.succeeded);
+    TEST_ASSERT_EQUAL(1, primary.requests);
+    TEST_ASSERT_EQUAL(0, second.requests);
+}
+
+void test_hedge_wins_over_stalled_connection() {
+    primary.setShape(latency(500000));
+    second.setShape(latency(0));
+    ServiceRequest request;
+    TEST_ASSERT_TRUE(endpoint.get("/status", request));
+    track(request);
+    unsigned long t0 = millis();
+    request.fire().await();
+    TEST_ASSERT_LESS_THAN(200, millis() - t0);
+    TEST_ASSERT_EQUAL(1, outcome.succeeded);
+    TEST_ASSERT_EQUAL_STRING("ok", outcome.content.c_str());
+    TEST_ASSERT_EQUAL(1, second.requests);
+    // the stalled connection was cancelled
+    TEST_ASSERT_FALSE(primary.connected());
+
+    // the winner keeps its connection, the endpoint keeps sending over its first client
+    TEST_ASSERT_TRUE(second.connected());
+    primary.setShape(latency(0));
+    ServiceRequest next;
+    TEST_ASSERT_TRUE(endpoint.get("/status", next));
+    track(next);
+    next.fire().await();
+    TEST_ASSERT_EQUAL(2, outcome.succeeded);
+    TEST_ASSERT_EQUAL(2, primary.requests);
+    TEST_ASSERT_EQUAL(1, second.requests);
+
+    #if FLUENTHTTP_METRICS
+    service_endpoint_stats_t stats;
+    TEST_ASSERT_TRUE(endpoint.getStats(stats));
+    TEST_ASSERT_EQUAL(1, stats.hedgesFired);
+    TEST_ASSERT_EQUAL(1, stats.hedgesWon);
+    TEST_ASSERT_EQUAL(2, stats.requests);
+    TEST_ASSERT_EQUAL(2, stats.completed);
+    #endif
+}
+
+void test_open_hedge_connection_is_reused() {
+    primary.setShape(latency(500000));
+    second.setShape(latency(0));
+    for (int i = 0; i < 2; i++) {
+        ServiceRequest request;
+        TEST_ASSERT_TRUE(endpoint.get("/status", request));
+        track(request);
+        request.fire().await();
+    }
+    TEST_ASSERT_EQUAL(2, outcome.succeeded);
+    TEST_ASSERT_EQUAL(2, primary.requests);
+    TEST_ASSERT_EQUAL(2, second.requests);
+    // the stalled first connection is opened again for each request, the hedge stays open
+    TEST_ASSERT_EQUAL(2, primary.connects);
+    TEST_ASSERT_EQUAL(1, second.connects);
+}
+
+void test_retry_after_a_won_hedge_goes_over_the_first_client() {
+    service_retry_policy_t policy;
+    policy.maxAttempts = 2;
+    policy.backoff = 1;
+    primary.setShape(latency(500000));
+    second.setShape(latency(0));
+    second.setResponse("HTTP/1.1 503 Service Unavailable\r\nContent-Length: 0\r\n\r\n");
+    ServiceRequest request;
+    TEST_ASSERT_TRUE(endpoint.get("/status", request));
+    track(request).withRetry(policy);
+    // the first client recovers while the hedge answers
+    request.fire();
+    while (!request.finished() && second.requests == 0)
+        request.yield();
+    primary.setShape(latency(0));
+    request.await();
+    TEST_ASSERT_EQUAL(1, outcome.succeeded);
+    TEST_ASSERT_EQUAL(200, outcome.statusCode);
+    TEST_ASSERT_EQUAL(1, second.requests);
+    TEST_ASSERT_EQUAL(2, primary.requests);
+}
+
+void test_primary_wins_and_hedge_is_cancelled() {
+    primary.setShape(latency(60000));
+    second.setShape(latency(500000));
+    ServiceRequest request;
+    TEST_ASSERT_TRUE(endpoint.get("/status", request));
+    track(request);
+    request.fire().await();
+    TEST_ASSERT_EQUAL(1, outcome.succeeded);
+    TEST_ASSERT_EQUAL(1, second.requests);
+    TEST_ASSERT_FALSE(second.connected());
+
+    #if FLUENTHTTP_METRICS
+    service_endpoint_stats_t stats;
+    TEST_ASSERT_TRUE(endpoint.getStats(stats));
+    TEST_ASSERT_EQUAL(1, stats.hedgesFired);
+    TEST_ASSERT_EQUAL(0, stats.hedgesWon);
+    TEST_ASSERT_EQUAL(1, stats.requests);
+    #endif
+}
+
+void test_post_is_not_hedged() {
+    primary.setShape(latency(60000));
+    ServiceRequest request;
+    TEST_ASSERT_TRUE(endpoint.post("/telemetry", request));
+    track(request);
+    request.fireContent(String("{}"));
+    request.await();
+    TEST_ASSERT_EQUAL(1, outcome.succeeded);
+    TEST_ASSERT_EQUAL(0, second.requests);
+}
+
+int main(int argc, char** argv)
+{
+    installHostArduino(&primary);
+    primary.setTimeout(100);
+    second.setTimeout(100);
+    endpoint.withKeepAlive(true);
+
+    UNITY_BEGIN();
+    RUN_TEST(test_fast_response_fires_no_hedge);
+    RUN_TEST(test_hedge_wins_over_stalled_connection);
+    RUN_TEST(test_open_hedge_connection_is_reused);
+    RUN_TEST(test_retry_after_a_won_hedge_goes_over_the_first_client);
+    RUN_TEST(test_primary_wins_and_hedge_is_cancelled);
+    RUN_TEST(test_post_is_not_hedged);
+    return UNITY_END();
+}
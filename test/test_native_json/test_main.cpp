@@ -0,0 +1,248 @@
+#include <Arduino.h>
+#include <unity.h>
+#include <fluenthttp.h>
+#include <JsonReader.h>
+#include <string>
+#include "../support/ScriptedClient.h"
+#include "../support/AllocationCounter.h"
+
+// JsonReader tokens and path lookup, from plain streams and from responses
+
+// serves a fixed text, available() in small steps like a socket would
+class TextStream : public Stream {
+    std::string _text;
+    size_t _pos = 0;
+    size_t _step;
+
+    public:
+        TextStream(const std::string& text, size_t step = 7) : _text(text), _step(step) {}
+        int available() {
+            hostSelectStream(this);
+            size_t left = _text.size() - _pos;
+            return (int)(left < _step ? left : _step);
+        }
+        int read() { return _pos < _text.size() ? (uint8_t)_text[_pos++] : -1; }
+        int peek() { hostSelectStream(this); return _pos < _text.size() ? (uint8_t)_text[_pos] : -1; }
+        size_t write(uint8_t b) { return 0; }
+        void flush() {}
+};
+
+ScriptedClient client;
+ServiceEndpoint endpoint("json.local");
+
+static const char* document =
+    "{ \"status\": \"ok\", \"count\": 3,\n"
+    "  \"data\": { \"items\": [\n"
+    "    { \"name\": \"alpha\", \"value\": -1.5e2, \"tags\": [\"a\", \"b\"] },\n"
+    "    { \"name\": \"be\\\"ta\\u00e9\", \"value\": 42, \"enabled\": true },\n"
+    "    { \"name\": \"gamma\", \"value\": null, \"enabled\": false }\n"
+    "  ], \"next\": \"/page/2\" } }";
+
+void setUp(void)
+{
+    endpoint.close();
+}
+
+void tearDown(void)
+{
+}
+
+void test_tokens_and_paths() {
+    TextStream stream("{\"a\": [1, {\"b\": \"x\"}], \"c\": true}");
+    char value[16];
+    JsonReader json(stream, value, sizeof(value));
+    const json_token_t expected[] = {
+        jtBeginObject, jtKey, jtBeginArray, jtNumber, jtBeginObject, jtKey, jtString,
+        jtEndObject, jtEndArray, jtKey, jtTrue, jtEndObject, jtEnd
+    };
+    const char* paths[] = {
+        "", "a", "a", "a[0]", "a[1]", "a[1].b", "a[1].b",
+        "a[1]", "a", "c", "c", "", ""
+    };
+    for (size_t i = 0; i < sizeof(expected) / sizeof(expected[0]); i++) {
+        TEST_ASSERT_EQUAL(expected[i], json.next());
+        TEST_ASSERT_EQUAL_STRING(paths[i], json.path());
+    }
+    TEST_ASSERT_EQUAL(jtEnd, json.next());
+}
+
+void test_find_picks_fields_in_document_order() {
+    TextStream stream(document);
+    char value[16];
+    JsonReader json(stream, value, sizeof(value));
+    TEST_ASSERT_TRUE(json.find("count"));
+    TEST_ASSERT_EQUAL(3, json.asLong());
+    TEST_ASSERT_TRUE(json.find("data.items[0].value"));
+    TEST_ASSERT_EQUAL(jtNumber, json.token());
+    TEST_ASSERT_TRUE(json.asDouble() == -150.0);
+    TEST_ASSERT_TRUE(json.find("data.items[1].name"));
+    TEST_ASSERT_EQUAL_STRING("be\"ta\xC3\xA9", json.value());
+    TEST_ASSERT_TRUE(json.find("data.items[1].enabled"));
+    TEST_ASSERT_TRUE(json.asBool());
+    TEST_ASSERT_TRUE(json.find("data.items[2].value"));
+    TEST_ASSERT_EQUAL(jtNull, json.token());
+    TEST_ASSERT_TRUE(json.find("data.next"));
+    TEST_ASSERT_EQUAL_STRING("/page/2", json.value());
+    // already passed
+    TEST_ASSERT_FALSE(json.find("status"));
+    TEST_ASSERT_EQUAL(jtEnd, json.token());
+}
+
+void test_skip_passes_containers() {
+    TextStream stream(document);
+    char value[16];
+    JsonReader json(stream, value, sizeof(value));
+    TEST_ASSERT_TRUE(json.find("data.items"));
+    TEST_ASSERT_EQUAL(jtBeginArray, json.token());
+    json.skip();
+    TEST_ASSERT_EQUAL(jtEndArray, json.token());
+    TEST_ASSERT_EQUAL(jtKey, json.next());
+    TEST_ASSERT_EQUAL_STRING("next", json.value());
+}
+
+void test_long_values_are_truncated() {
+    TextStream stream("[\"0123456789abcdef\", 7]");
+    char value[8];
+    JsonReader json(stream, value, sizeof(value));
+    TEST_ASSERT_TRUE(json.find("[0]"));
+    TEST_ASSERT_TRUE(json.truncated());
+    TEST_ASSERT_EQUAL_STRING("0123456", json.value());
+    TEST_ASSERT_TRUE(json.find("[1]"));
+    TEST_ASSERT_FALSE(json.truncated());
+    TEST_ASSERT_EQUAL(7, json.asLong());
+}
+
+void test_malformed_input_fails() {
+    const char* inputs[] = {
+        "{\"a\" 1}", "[1 2]", "{\"a\": tru}", "[\"open", "{\"a\": 1,}", "[1]]x", "[[[[[[[[[1]]]]]]]]]"
+    };
+    for (size_t i = 0; i < sizeof(inputs) / sizeof(inputs[0]); i++) {
+        TextStream stream(inputs[i]);
+        stream.setTimeout(5);
+        char value[8];
+        JsonReader json(stream, value, sizeof(value));
+        json_token_t t;
+        while ((t = json.next()) != jtEnd && t != jtError);
+        // trailing bytes behind the root value are not read
+        TEST_ASSERT_EQUAL(i == 5 ? jtEnd : jtError, t);
+    }
+}
+
+void test_numbers_follow_the_grammar() {
+    const char* valid[] = { "0", "-0", "12", "-1.5e2", "0.25", "3E+4", "7e-0" };
+    for (size_t i = 0; i < sizeof(valid) / sizeof(valid[0]); i++) {
+        std::string text = std::string("[") + valid[i] + "]";
+        TextStream stream(text);
+        char value[16];
+        JsonReader json(stream, value, sizeof(value));
+        TEST_ASSERT_TRUE(json.find("[0]"));
+        TEST_ASSERT_EQUAL(jtNumber, json.token());
+        TEST_ASSERT_EQUAL_STRING(valid[i], json.value());
+    }
+    const char* invalid[] = { "1-2e", "--", "-", "01", "1.", ".5", "1e", "1e+", "2.e3", "+1", "1.2.3", "1ee2" };
+    for (size_t i = 0; i < sizeof(invalid) / sizeof(invalid[0]); i++) {
+        std::string text = std::string("[") + invalid[i] + "]";
+        TextStream stream(text);
+        stream.setTimeout(5);
+        char value[16];
+        JsonReader json(stream, value, sizeof(value));
+        json_token_t t;
+        while ((t = json.next()) != jtEnd && t != jtError);
+        TEST_ASSERT_EQUAL_MESSAGE(jtError, t, invalid[i]);
+    }
+}
+
+void test_lone_low_surrogate_fails() {
+    TextStream stream("[\"\\udc00\", \"\\ud83d\\ude00\"]");
+    stream.setTimeout(5);
+    char value[16];
+    JsonReader json(stream, value, sizeof(value));
+    TEST_ASSERT_EQUAL(jtBeginArray, json.next());
+    TEST_ASSERT_EQUAL(jtError, json.next());
+
+    TextStream pair("[\"\\ud83d\\ude00\"]");
+    JsonReader emoji(pair, value, sizeof(value));
+    TEST_ASSERT_TRUE(emoji.find("[0]"));
+    TEST_ASSERT_EQUAL_STRING("\xF0\x9F\x98\x80", emoji.value());
+}
+
+void test_reads_chunked_response() {
+    std::string body(document);
+    std::string chunked;
+    for (size_t pos = 0; pos < body.size(); pos += 50) {
+        std::string chunk = body.substr(pos, 50);
+        char size[8];
+        snprintf(size, sizeof(size), "%x\r\n", (unsigned int)chunk.size());
+        chunked += size + chunk + "\r\n";
+    }
+    chunked += "0\r\n\r\n";
+    client.response = "HTTP/1.1 200 OK\r\nContent-Type: application/json\r\nTransfer-Encoding: chunked\r\n\r\n" + chunked;
+
+    static std::string name;
+    static long value;
+    name.clear();
+    value = 0;
+    ServiceRequest request;
+    TEST_ASSERT_TRUE(endpoint.get("/items", request));
+    request.onSuccess([](service_response_t r) {
+            char buffer[16];
+            JsonReader json(r, buffer, sizeof(buffer));
+            if (json.find("data.items[1].value")) value = json.asLong();
+            if (json.find("data.items[2].name")) name = json.value();
+        })
+        .fire();
+    request.await();
+    TEST_ASSERT_EQUAL(42, value);
+    TEST_ASSERT_TRUE(name == "gamma");
+}
+
+void test_reads_content_length_response() {
+    std::string body(document);
+    client.response = "HTTP/1.1 200 OK\r\nContent-Length: " + std::to_string(body.size()) + "\r\n\r\n" + body;
+
+    static int tokens;
+    tokens = 0;
+    ServiceRequest request;
+    TEST_ASSERT_TRUE(endpoint.get("/items", request));
+    request.onSuccess([](service_response_t r) {
+            char buffer[16];
+            JsonReader json(r, buffer, sizeof(buffer));
+            while (json.next() != jtEnd && json.token() != jtError) tokens++;
+            if (json.token() == jtError) tokens = -1;
+        })
+        .fire();
+    request.await();
+    TEST_ASSERT_EQUAL(41, tokens);
+}
+
+void test_reading_does_not_allocate() {
+    #if ALLOCATION_COUNTER_ENABLED
+    TextStream stream(document);
+    char value[16];
+    allocation_stats_t a0 = allocationSnapshot();
+    JsonReader json(stream, value, sizeof(value));
+    bool found = json.find("data.next");
+    allocation_stats_t a1 = allocationSnapshot();
+    TEST_ASSERT_TRUE(found);
+    TEST_ASSERT_EQUAL(0, a1.allocations - a0.allocations);
+    #endif
+}
+
+int main(int argc, char** argv)
+{
+    installHostArduino(&client);
+    endpoint.begin(&client);
+
+    UNITY_BEGIN();
+    RUN_TEST(test_tokens_and_paths);
+    RUN_TEST(test_find_picks_fields_in_document_order);
+    RUN_TEST(test_skip_passes_containers);
+    RUN_TEST(test_long_values_are_truncated);
+    RUN_TEST(test_malformed_input_fails);
+    RUN_TEST(test_numbers_follow_the_grammar);
+    RUN_TEST(test_lone_low_surrogate_fails);
+    RUN_TEST(test_reads_chunked_response);
+    RUN_TEST(test_reads_content_length_response);
+    RUN_TEST(test_reading_does_not_allocate);
+    return UNITY_END();
+}
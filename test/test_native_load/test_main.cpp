@@ -0,0 +1,347 @@
+#include <Arduino.h>
+#include <unity.h>
+#include <fluenthttp.h>
+#include <algorithm>
+#include "../support/HostArduino.h"
+#include "../support/ShapedClient.h"
+#include "../support/ScriptedClient.h"
+
+// drives ServiceEndpoint/ServiceRequest through many requests over a simulated network
+// with latency, bandwidth limits, fragmentation, stalls and resets. Every scenario prints
+// one json line prefixed with "LOAD " with latency percentiles and throughput, builds with
+// FLUENTHTTP_METRICS=1 add a "STATS " line with the endpoint's own histograms
+
+#ifndef LOAD_REQUESTS
+  #define LOAD_REQUESTS 1000
+#endif
+
+ShapedClient client;
+ServiceEndpoint endpoint("load.local");
+
+static const char jsonContent[] = "{\"id\":7,\"state\":\"running\",\"uptime\":1234567890}";
+static char jsonResponse[256];
+
+static char chunkedResponse[512];
+static const int CHUNKED_CONTENT_LENGTH = 4 * 64;
+// offset of the second chunk size line
+static int chunkedSecondChunkOffset = 0;
+
+static uint32_t latencies[LOAD_REQUESTS];
+
+struct load_result_t {
+    uint32_t succeeded = 0;
+    uint32_t failed = 0;
+    uint32_t timedOut = 0;
+    uint32_t lockBusy = 0;
+    uint32_t contentErrors = 0;
+    uint64_t contentBytes = 0;
+};
+
+static load_result_t result;
+static int expectedContentLength = 0;
+
+void readContent(service_response_t r) {
+    uint8_t buffer[64];
+    int total = 0;
+    if (r.chunked) {
+        int chunk;
+        uint32_t t0 = millis();
+        while ((chunk = r.nextChunk()) != 0 || r.chunkPending()) {
+            // the size line is still on its way
+            if (chunk == 0) {
+                if (millis() - t0 >= 1000) break;
+                delay(1);
+                continue;
+            }
+            t0 = millis();
+            while (chunk > 0) {
+                int n = r.contentReader->readBytes(buffer, min(chunk, (int)sizeof(buffer)));
+                if (n <= 0) break;
+                chunk -= n;
+                total += n;
+            }
+        }
+        r.contentReader->readStringUntil('\n');
+    }
+    else {
+        int left = r.contentLength;
+        while (left > 0) {
+            int n = r.contentReader->readBytes(buffer, min(left, (int)sizeof(buffer)));
+            if (n <= 0) break;
+            left -= n;
+            total += n;
+        }
+    }
+    result.contentBytes += total;
+    if (total == expectedContentLength)
+        result.succeeded++;
+    else
+        result.contentErrors++;
+}
+
+void run(const char* scenario, const network_shape_t& shape, int timeout) {
+    endpoint.close();
+    client.setShape(shape);
+    client.reset();
+    result = load_result_t();
+    uint64_t t0 = hostNanos();
+    for (int i = 0; i < LOAD_REQUESTS; i++) {
+        uint64_t r0 = hostNanos();
+        ServiceRequest request;
+        if (!endpoint.get("/status", request)) {
+            // the previous request did not release the endpoint
+            result.lockBusy++;
+            endpoint.forceUnlock();
+            continue;
+        }
+        request.withTimeout(timeout)
+            .onSuccess(readContent)
+            .onFailure([](service_response_t r) { result.failed++; })
+            .onTimeout([] { result.timedOut++; })
+            .fire();
+        request.await();
+        latencies[i] = (uint32_t)((hostNanos() - r0) / 1000);
+    }
+    uint64_t elapsed = hostNanos() - t0;
+
+    std::sort(latencies, latencies + LOAD_REQUESTS);
+    printf("LOAD {\"scenario\":\"%s\",\"requests\":%d,\"succeeded\":%u,\"failed\":%u,\"timeouts\":%u,"
+           "\"content_errors\":%u,\"resets\":%u,\"connects\":%u,\"p50_us\":%u,\"p90_us\":%u,\"p99_us\":%u,"
+           "\"max_us\":%u,\"req_per_s\":%.1f,\"content_kb_per_s\":%.1f}\n",
+        scenario, LOAD_REQUESTS, result.succeeded, result.failed, result.timedOut,
+        result.contentErrors, client.resets, client.connects,
+        latencies[LOAD_REQUESTS / 2], latencies[LOAD_REQUESTS * 9 / 10], latencies[LOAD_REQUESTS * 99 / 100],
+        latencies[LOAD_REQUESTS - 1],
+        LOAD_REQUESTS * 1e9 / elapsed, result.contentBytes * 1e9 / 1024 / elapsed);
+    TEST_ASSERT_EQUAL_UINT32(0, result.lockBusy);
+
+    service_endpoint_stats_t stats;
+    if (endpoint.getStats(stats, true)) {
+        printf("STATS {\"scenario\":\"%s\",\"requests\":%u,\"failures\":%u,\"timeouts\":%u,"
+               "\"connects\":%u,\"reconnects\":%u,\"bytes_out\":%llu,\"bytes_in\":%llu,"
+               "\"ttfb_p50_us\":%u,\"ttfb_p99_us\":%u,\"total_p50_us\":%u,\"total_p99_us\":%u}\n",
+            scenario, stats.requests, stats.failures, stats.timeouts, stats.connects, stats.reconnects,
+            (unsigned long long)stats.bytesOut, (unsigned long long)stats.bytesIn,
+            stats.firstByte.percentileMicros(50), stats.firstByte.percentileMicros(99),
+            stats.total.percentileMicros(50), stats.total.percentileMicros(99));
+        TEST_ASSERT_EQUAL_UINT32(LOAD_REQUESTS, stats.requests);
+        TEST_ASSERT_EQUAL_UINT32(result.timedOut, stats.timeouts);
+    }
+}
+
+void setUp(void)
+{
+    client.setResponse(jsonResponse);
+    expectedContentLength = strlen(jsonContent);
+    endpoint.withKeepAlive(true);
+}
+
+void tearDown(void)
+{
+}
+
+void test_latency_and_bandwidth() {
+    network_shape_t shape;
+    shape.latencyMicros = 500;
+    shape.bytesPerSecond = 1000000;
+    run("latency_500us_1mbps", shape, 1000);
+    TEST_ASSERT_EQUAL_UINT32(LOAD_REQUESTS, result.succeeded);
+}
+
+void test_connection_close() {
+    network_shape_t shape;
+    shape.latencyMicros = 200;
+    endpoint.withKeepAlive(false);
+    run("connection_close", shape, 1000);
+    TEST_ASSERT_EQUAL_UINT32(LOAD_REQUESTS, result.succeeded);
+    TEST_ASSERT_EQUAL_UINT32(LOAD_REQUESTS, client.connects);
+}
+
+void test_single_byte_fragments() {
+    network_shape_t shape;
+    shape.fragmentSize = 1;
+    run("fragments_1_byte", shape, 1000);
+    TEST_ASSERT_EQUAL_UINT32(LOAD_REQUESTS, result.succeeded);
+}
+
+void test_stalls() {
+    network_shape_t shape;
+    shape.bytesPerSecond = 2000000;
+    shape.stallPermille = 100;
+    shape.stallMicros = 5000;
+    run("stalls_10pct_5ms", shape, 1000);
+    TEST_ASSERT_EQUAL_UINT32(LOAD_REQUESTS, result.succeeded);
+}
+
+void test_chunked_with_stalls_between_chunks() {
+    // nextChunk() must report a size line that did not arrive yet as such, not as the end
+    client.setResponse(chunkedResponse);
+    expectedContentLength = CHUNKED_CONTENT_LENGTH;
+    network_shape_t shape;
+    shape.fragmentSize = 7;
+    shape.stallPermille = 1000;
+    shape.stallMicros = 3000;
+    shape.stallOffset = chunkedSecondChunkOffset;
+    run("chunked_stall_between_chunks", shape, 1000);
+    TEST_ASSERT_EQUAL_UINT32(LOAD_REQUESTS, result.succeeded);
+    TEST_ASSERT_EQUAL_UINT32(0, result.contentErrors);
+}
+
+void test_next_chunk_does_not_wait() {
+    ScriptedClient stream;
+    stream.connect("load.local", 80);
+    stream.setTimeout(1000);
+    service_response_t r;
+    r.chunked = true;
+    r.contentReader = &stream;
+    uint32_t t0 = millis();
+    TEST_ASSERT_EQUAL(0, r.nextChunk());
+    TEST_ASSERT_TRUE(r.chunkPending());
+    // the size line arrives in pieces, with an extension
+    stream.push("1");
+    TEST_ASSERT_EQUAL(0, r.nextChunk());
+    TEST_ASSERT_TRUE(r.chunkPending());
+    stream.push("A;name=x\r");
+    TEST_ASSERT_EQUAL(0, r.nextChunk());
+    stream.push("\n");
+    TEST_ASSERT_EQUAL(26, r.nextChunk());
+    TEST_ASSERT_FALSE(r.chunkPending());
+    TEST_ASSERT_TRUE(millis() - t0 < 100);
+    stream.push("abcdefghijklmnopqrstuvwxyz\r\n");
+    for (int i = 0; i < 26; i++)
+        TEST_ASSERT_EQUAL('a' + i, stream.read());
+    TEST_ASSERT_EQUAL(0, r.nextChunk());
+    TEST_ASSERT_TRUE(r.chunkPending());
+    stream.push("0\r\n\r\n");
+    TEST_ASSERT_EQUAL(0, r.nextChunk());
+    TEST_ASSERT_FALSE(r.chunkPending());
+}
+
+void test_chunk_size_skips_leading_zeros() {
+    ScriptedClient stream;
+    stream.connect("load.local", 80);
+    service_response_t r;
+    r.chunked = true;
+    r.contentReader = &stream;
+    stream.push("00000000a\r\n");
+    TEST_ASSERT_EQUAL(10, r.nextChunk());
+    stream.push("0123456789\r\n7fffffff\r\n");
+    for (int i = 0; i < 10; i++)
+        stream.read();
+    TEST_ASSERT_EQUAL(INT32_MAX, r.nextChunk());
+    TEST_ASSERT_FALSE(r.chunkMalformed());
+
+    // a size beyond an int ends the content as malformed
+    service_response_t overflow;
+    overflow.chunked = true;
+    overflow.contentReader = &stream;
+    stream.push("\r\n80000000\r\n");
+    TEST_ASSERT_EQUAL(0, overflow.nextChunk());
+    TEST_ASSERT_FALSE(overflow.chunkPending());
+    TEST_ASSERT_TRUE(overflow.chunkMalformed());
+    TEST_ASSERT_EQUAL(0, overflow.nextChunk());
+}
+
+void test_content_buffer_fails_on_malformed_chunk_size() {
+    ScriptedClient scripted;
+    ServiceEndpoint local("load.local");
+    local.begin(&scripted);
+    local.withKeepAlive(true);
+    scripted.response = "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n123456789\r\n";
+    uint8_t content[16];
+    int succeeded = 0;
+    String failure;
+    ServiceRequest request;
+    TEST_ASSERT_TRUE(local.get("/log", request));
+    request.withTimeout(1000)
+        .withContentBuffer(content, sizeof(content))
+        .onSuccess([&](service_response_t r) { succeeded++; })
+        .onFailure([&](service_response_t r) { failure = r.statusMessage; })
+        .fire().await();
+    TEST_ASSERT_EQUAL(0, succeeded);
+    TEST_ASSERT_EQUAL_STRING("chunk size exceeds int", failure.c_str());
+    TEST_ASSERT_EQUAL(srsFailed, request.getStatus());
+    // the connection is not reused
+    TEST_ASSERT_FALSE(scripted.connected());
+}
+
+void test_content_buffer_fills_without_waiting() {
+    ScriptedClient scripted;
+    ServiceEndpoint local("load.local");
+    local.begin(&scripted);
+    scripted.response = "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n3\r\nabc\r\n";
+    uint8_t content[16];
+    int succeeded = 0;
+    ServiceRequest request;
+    TEST_ASSERT_TRUE(local.get("/log", request));
+    request.withTimeout(1000)
+        .withContentBuffer(content, sizeof(content))
+        .onSuccess([&](service_response_t r) {
+            TEST_ASSERT_NULL(r.contentReader);
+            succeeded++;
+        })
+        .fire();
+    // the callbacks wait for the rest of the content, yield() does not
+    uint32_t t0 = millis();
+    for (int i = 0; i < 5; i++)
+        TEST_ASSERT_FALSE(request.yield());
+    scripted.push("4\r");
+    TEST_ASSERT_FALSE(request.yield());
+    TEST_ASSERT_TRUE(millis() - t0 < 100);
+    TEST_ASSERT_EQUAL(0, succeeded);
+    scripted.push("\ndefg\r\n0\r\n\r\n");
+    TEST_ASSERT_TRUE(request.yield());
+    TEST_ASSERT_EQUAL(1, succeeded);
+    TEST_ASSERT_EQUAL(7, request.contentBuffered());
+    TEST_ASSERT_EQUAL(0, memcmp("abcdefg", content, 7));
+}
+
+void test_resets_recover() {
+    network_shape_t shape;
+    shape.latencyMicros = 100;
+    shape.resetPermille = 30;
+    run("resets_3pct", shape, 50);
+    // every request ends one way or the other and the endpoint stays usable
+    TEST_ASSERT_EQUAL_UINT32(LOAD_REQUESTS,
+        result.succeeded + result.failed + result.timedOut + result.contentErrors);
+    TEST_ASSERT_GREATER_THAN(0, client.resets);
+    TEST_ASSERT_GREATER_THAN(LOAD_REQUESTS * 9 / 10, result.succeeded);
+}
+
+void buildResponses() {
+    sprintf(jsonResponse, "HTTP/1.1 200 OK\r\nContent-Type: application/json\r\nContent-Length: %d\r\n\r\n%s",
+        (int)strlen(jsonContent), jsonContent);
+
+    char* p = chunkedResponse;
+    p += sprintf(p, "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n");
+    for (int i = 0; i < 4; i++) {
+        p += sprintf(p, "40\r\n");
+        memset(p, 'a' + i, 64);
+        p += 64;
+        p += sprintf(p, "\r\n");
+        if (i == 0)
+            chunkedSecondChunkOffset = p - chunkedResponse;
+    }
+    sprintf(p, "0\r\n\r\n");
+}
+
+int main(int argc, char** argv)
+{
+    installHostArduino(&client);
+    buildResponses();
+    client.setTimeout(100);
+    endpoint.begin(&client);
+
+    UNITY_BEGIN();
+    RUN_TEST(test_latency_and_bandwidth);
+    RUN_TEST(test_connection_close);
+    RUN_TEST(test_single_byte_fragments);
+    RUN_TEST(test_stalls);
+    RUN_TEST(test_chunked_with_stalls_between_chunks);
+    RUN_TEST(test_next_chunk_does_not_wait);
+    RUN_TEST(test_content_buffer_fills_without_waiting);
+    RUN_TEST(test_chunk_size_skips_leading_zeros);
+    RUN_TEST(test_content_buffer_fails_on_malformed_chunk_size);
+    RUN_TEST(test_resets_recover);
+    return UNITY_END();
+}
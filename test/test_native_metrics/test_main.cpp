@@ -0,0 +1,231 @@
+#include <Arduino.h>
+#include <unity.h>
+#include <fluenthttp.h>
+#include "../support/ScriptedClient.h"
+#include "../support/Outcome.h"
+
+// latency histograms, request timestamps and endpoint counters, built with
+// FLUENTHTTP_METRICS=1 (env:native_metrics). Without it only the histogram itself is
+// tested and the endpoint must report that it has nothing
+
+ScriptedClient client;
+ServiceEndpoint endpoint("metrics.local");
+
+static const std::string ok = "HTTP/1.1 200 OK\r\nContent-Length: 2\r\n\r\nok";
+
+static service_endpoint_stats_t stats() {
+    service_endpoint_stats_t snapshot;
+    TEST_ASSERT_TRUE(endpoint.getStats(snapshot));
+    return snapshot;
+}
+
+void setUp(void)
+{
+    client.reset();
+    client.response = ok;
+    endpoint.withKeepAlive(true);
+    endpoint.withRetry(service_retry_policy_t());
+    service_endpoint_stats_t snapshot;
+    endpoint.getStats(snapshot, true);
+    outcome = outcome_t();
+}
+
+void tearDown(void)
+{
+}
+
+void test_histogram_buckets() {
+    service_latency_histogram_t histogram;
+    TEST_ASSERT_EQUAL(0, histogram.percentileMicros(50));
+    TEST_ASSERT_EQUAL(0, histogram.meanMicros());
+    // a sample on a limit belongs to that bucket, one above it to the next
+    histogram.record(500);
+    histogram.record(501);
+    histogram.record(0);
+    histogram.record(1999);
+    histogram.record(6000000);
+    TEST_ASSERT_EQUAL(2, histogram.buckets[0]);
+    TEST_ASSERT_EQUAL(1, histogram.buckets[1]);
+    TEST_ASSERT_EQUAL(1, histogram.buckets[2]);
+    TEST_ASSERT_EQUAL(1, histogram.buckets[FLUENTHTTP_HISTOGRAM_BUCKETS - 1]);
+    TEST_ASSERT_EQUAL(5, histogram.count);
+    TEST_ASSERT_EQUAL(6000000, histogram.maxMicros);
+    TEST_ASSERT_EQUAL((500 + 501 + 1999 + 6000000) / 5, histogram.meanMicros());
+    TEST_ASSERT_EQUAL(500, service_latency_histogram_t::bucketLimit(0));
+    TEST_ASSERT_EQUAL(UINT32_MAX, service_latency_histogram_t::bucketLimit(FLUENTHTTP_HISTOGRAM_BUCKETS));
+}
+
+void test_histogram_percentiles() {
+    service_latency_histogram_t histogram;
+    for (int i = 0; i < 90; i++)
+        histogram.record(800);
+    for (int i = 0; i < 10; i++)
+        histogram.record(30000);
+    TEST_ASSERT_EQUAL(1000, histogram.percentileMicros(50));
+    TEST_ASSERT_EQUAL(1000, histogram.percentileMicros(90));
+    // the upper limit of the bucket, but never above the largest sample
+    TEST_ASSERT_EQUAL(30000, histogram.percentileMicros(91));
+    TEST_ASSERT_EQUAL(30000, histogram.percentileMicros(100));
+}
+
+void test_request_phases_go_to_their_histograms() {
+    service_request_timing_t timing;
+    timing.at[stpLocked] = 100;
+    timing.at[stpConnected] = 700;
+    timing.at[stpHeadSent] = 800;
+    timing.at[stpFirstByte] = 20800;
+    timing.at[stpHeadersDone] = 21000;
+    timing.at[stpBodyDone] = 22000;
+    TEST_ASSERT_EQUAL(20000, timing.elapsed(stpHeadSent, stpFirstByte));
+    service_endpoint_stats_t snapshot;
+    snapshot.recordRequest(timing, true);
+    TEST_ASSERT_EQUAL(600, snapshot.connect.maxMicros);
+    TEST_ASSERT_EQUAL(100, snapshot.send.maxMicros);
+    TEST_ASSERT_EQUAL(1, snapshot.firstByte.buckets[5]);
+    TEST_ASSERT_EQUAL(200, snapshot.headers.maxMicros);
+    TEST_ASSERT_EQUAL(1000, snapshot.content.maxMicros);
+    TEST_ASSERT_EQUAL(21900, snapshot.total.maxMicros);
+    TEST_ASSERT_EQUAL(1, snapshot.completed);
+
+    // a request failing before it was sent only counts in total
+    service_request_timing_t failed;
+    failed.at[stpLocked] = 100;
+    failed.at[stpBodyDone] = 400;
+    TEST_ASSERT_EQUAL(0, failed.elapsed(stpLocked, stpConnected));
+    // a reading of 0 still marks the point, the first reading is kept
+    failed.mark(stpConnected, 0);
+    failed.mark(stpConnected, 300);
+    TEST_ASSERT_TRUE(failed.reached(stpConnected));
+    TEST_ASSERT_EQUAL(1, failed.at[stpConnected]);
+    failed.at[stpConnected] = 0;
+    snapshot.recordRequest(failed, false);
+    TEST_ASSERT_EQUAL(1, snapshot.connect.count);
+    TEST_ASSERT_EQUAL(2, snapshot.total.count);
+    TEST_ASSERT_EQUAL(2, snapshot.requests);
+    TEST_ASSERT_EQUAL(1, snapshot.failures);
+}
+
+#if FLUENTHTTP_METRICS
+
+void test_request_reaches_every_timing_point() {
+    ServiceRequest request;
+    TEST_ASSERT_TRUE(endpoint.get("/status", request));
+    track(request).fire().await();
+    TEST_ASSERT_EQUAL(1, outcome.succeeded);
+    service_request_timing_t timing;
+    TEST_ASSERT_TRUE(request.getTiming(timing));
+    for (int point = stpLocked; point < stpCount; point++) {
+        TEST_ASSERT_TRUE(timing.reached((service_timing_point_t)point));
+        if (point > stpLocked)
+            TEST_ASSERT_TRUE(timing.at[point] - timing.at[point - 1] < 1000000);
+    }
+    TEST_ASSERT_EQUAL(timing.at[stpBodyDone] - timing.at[stpLocked], timing.elapsed(stpLocked, stpBodyDone));
+}
+
+void test_endpoint_counts_requests_and_bytes() {
+    for (int i = 0; i < 3; i++) {
+        ServiceRequest request;
+        TEST_ASSERT_TRUE(endpoint.get("/status", request));
+        track(request).fire().await();
+    }
+    TEST_ASSERT_EQUAL(3, outcome.succeeded);
+    service_endpoint_stats_t snapshot = stats();
+    TEST_ASSERT_EQUAL(3, snapshot.requests);
+    TEST_ASSERT_EQUAL(3, snapshot.completed);
+    TEST_ASSERT_EQUAL(0, snapshot.failures);
+    TEST_ASSERT_EQUAL(1, snapshot.connects);
+    TEST_ASSERT_EQUAL(0, snapshot.reconnects);
+    TEST_ASSERT_EQUAL(3, snapshot.total.count);
+    TEST_ASSERT_EQUAL(3, snapshot.firstByte.count);
+    TEST_ASSERT_EQUAL(client.written.size(), snapshot.bytesOut);
+    TEST_ASSERT_EQUAL(3 * ok.size(), snapshot.bytesIn);
+
+    // reset hands out the counters one last time
+    TEST_ASSERT_TRUE(endpoint.getStats(snapshot, true));
+    TEST_ASSERT_EQUAL(3, snapshot.requests);
+    TEST_ASSERT_EQUAL(0, stats().requests);
+    TEST_ASSERT_EQUAL(0, stats().total.count);
+}
+
+void test_failures_timeouts_and_retries_are_counted() {
+    client.response = "HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\n\r\n";
+    ServiceRequest missing;
+    TEST_ASSERT_TRUE(endpoint.get("/missing", missing));
+    track(missing).fire().await();
+    TEST_ASSERT_EQUAL(1, outcome.failed);
+
+    client.response = "";
+    ServiceRequest slow;
+    TEST_ASSERT_TRUE(endpoint.get("/slow", slow));
+    track(slow, 50).fire().await();
+    TEST_ASSERT_EQUAL(1, outcome.timedOut);
+
+    client.response = ok;
+    endpoint.close();
+    client.refuseConnects = 1;
+    service_retry_policy_t policy;
+    policy.maxAttempts = 2;
+    policy.backoff = 1;
+    ServiceRequest retried;
+    TEST_ASSERT_TRUE(endpoint.get("/status", retried));
+    track(retried).withRetry(policy).fire().await();
+    TEST_ASSERT_EQUAL(1, outcome.succeeded);
+
+    service_endpoint_stats_t snapshot = stats();
+    TEST_ASSERT_EQUAL(3, snapshot.requests);
+    TEST_ASSERT_EQUAL(1, snapshot.completed);
+    TEST_ASSERT_EQUAL(2, snapshot.failures);
+    TEST_ASSERT_EQUAL(1, snapshot.timeouts);
+    TEST_ASSERT_EQUAL(1, snapshot.retries);
+}
+
+void test_reconnects_are_counted() {
+    ServiceRequest first;
+    TEST_ASSERT_TRUE(endpoint.get("/a", first));
+    track(first).fire().await();
+    // the server closes the keep-alive connection
+    client.hangUp();
+    ServiceRequest second;
+    TEST_ASSERT_TRUE(endpoint.get("/b", second));
+    track(second).fire().await();
+    TEST_ASSERT_EQUAL(2, outcome.succeeded);
+    service_endpoint_stats_t snapshot = stats();
+    TEST_ASSERT_EQUAL(2, snapshot.connects);
+    TEST_ASSERT_EQUAL(1, snapshot.reconnects);
+    TEST_ASSERT_EQUAL(2, client.connects);
+}
+
+#else
+
+void test_disabled_metrics_report_nothing() {
+    ServiceRequest request;
+    TEST_ASSERT_TRUE(endpoint.get("/status", request));
+    track(request).fire().await();
+    TEST_ASSERT_EQUAL(1, outcome.succeeded);
+    service_request_timing_t timing;
+    TEST_ASSERT_FALSE(request.getTiming(timing));
+    service_endpoint_stats_t snapshot;
+    TEST_ASSERT_FALSE(endpoint.getStats(snapshot));
+}
+
+#endif /* FLUENTHTTP_METRICS */
+
+int main(int argc, char** argv)
+{
+    installHostArduino(&client);
+    endpoint.begin(&client);
+
+    UNITY_BEGIN();
+    RUN_TEST(test_histogram_buckets);
+    RUN_TEST(test_histogram_percentiles);
+    RUN_TEST(test_request_phases_go_to_their_histograms);
+    #if FLUENTHTTP_METRICS
+    RUN_TEST(test_request_reaches_every_timing_point);
+    RUN_TEST(test_endpoint_counts_requests_and_bytes);
+    RUN_TEST(test_failures_timeouts_and_retries_are_counted);
+    RUN_TEST(test_reconnects_are_counted);
+    #else
+    RUN_TEST(test_disabled_metrics_report_nothing);
+    #endif
+    return UNITY_END();
+}
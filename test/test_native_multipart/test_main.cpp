@@ -0,0 +1,234 @@
+#include <Arduino.h>
+#include <unity.h>
+#include <fluenthttp.h>
+#include <MultipartEncoder.h>
+#include "../support/ScriptedClient.h"
+#include "../support/AllocationCounter.h"
+
+// MultipartEncoder output and streamed request bodies, fixed length and chunked
+
+// stream part of a given size, available() in small steps like a file or socket would
+class PatternStream : public Stream {
+    size_t _length;
+    size_t _pos = 0;
+
+    public:
+        PatternStream(size_t length) : _length(length) {}
+        int available() {
+            hostSelectStream(this);
+            size_t left = _length - _pos;
+            return (int)(left < 100 ? left : 100);
+        }
+        int read() { return _pos < _length ? 'a' + (_pos++ % 26) : -1; }
+        int peek() { return _pos < _length ? 'a' + (_pos % 26) : -1; }
+        size_t write(uint8_t b) { return 0; }
+        void flush() {}
+};
+
+// stream of unknown length that pauses after each piece, like a sensor or a serial port
+class TrickleStream : public Stream {
+    size_t _length;
+    size_t _piece;
+    uint32_t _pause;
+    size_t _pos = 0;
+    unsigned long _next = 0;
+
+    bool paused() { return _pos == _length || millis() < _next; }
+
+    public:
+        TrickleStream(size_t length, size_t piece, uint32_t pause) : _length(length), _piece(piece), _pause(pause) {}
+        int available() {
+            hostSelectStream(this);
+            return paused() ? 0 : (int)(_piece - _pos % _piece);
+        }
+        int read() {
+            if (paused()) return -1;
+            int c = 'a' + (_pos++ % 26);
+            if (_pos % _piece == 0) _next = millis() + _pause;
+            return c;
+        }
+        int peek() { return paused() ? -1 : 'a' + (_pos % 26); }
+        size_t write(uint8_t b) { return 0; }
+        void flush() {}
+};
+
+ScriptedClient client;
+ServiceEndpoint endpoint("upload.local");
+
+std::string pattern(size_t length) {
+    std::string s;
+    for (size_t i = 0; i < length; i++) s += (char)('a' + i % 26);
+    return s;
+}
+
+std::string readAll(MultipartEncoder& form, size_t step) {
+    std::string out;
+    uint8_t buffer[64];
+    size_t n;
+    while ((n = form.read(buffer, step < sizeof(buffer) ? step : sizeof(buffer))) > 0)
+        out.append((const char*)buffer, n);
+    return out;
+}
+
+std::string dechunk(const std::string& body) {
+    std::string out;
+    size_t pos = 0;
+    while (true) {
+        size_t eol = body.find("\r\n", pos);
+        size_t length = strtoul(body.c_str() + pos, nullptr, 16);
+        if (length == 0) break;
+        out += body.substr(eol + 2, length);
+        pos = eol + 2 + length + 2;
+    }
+    return out;
+}
+
+void upload(MultipartEncoder& form) {
+    ServiceRequest request;
+    TEST_ASSERT_TRUE(endpoint.post("/upload", request));
+    static bool created;
+    created = false;
+    request.onSuccess([](service_response_t r) { created = r.statusCode == 201; })
+        .addHeader("Content-Type", form.contentType())
+        .fireContent(form);
+    request.await();
+    TEST_ASSERT_TRUE(created);
+}
+
+void setUp(void)
+{
+    endpoint.close();
+    client.reset();
+}
+
+void tearDown(void)
+{
+}
+
+void test_encodes_fields_and_files() {
+    static const uint8_t image[] = { 0x89, 'P', 'N', 'G', 0x00, 0x0D, 0x0A };
+    MultipartEncoder form;
+    form.addField("device", "sensor-7")
+        .addFile("image", "shot.png", "image/png", image, sizeof(image));
+    std::string b = form.boundary();
+    std::string expected =
+        "--" + b + "\r\n"
+        "Content-Disposition: form-data; name=\"device\"\r\n"
+        "\r\n"
+        "sensor-7\r\n"
+        "--" + b + "\r\n"
+        "Content-Disposition: form-data; name=\"image\"; filename=\"shot.png\"\r\n"
+        "Content-Type: image/png\r\n"
+        "\r\n" + std::string((const char*)image, sizeof(image)) + "\r\n"
+        "--" + b + "--\r\n";
+    TEST_ASSERT_EQUAL(expected.size(), form.size());
+    // any read size produces the same bytes
+    TEST_ASSERT_TRUE(expected == readAll(form, 64));
+    form.rewind();
+    TEST_ASSERT_TRUE(expected == readAll(form, 1));
+    form.rewind();
+    TEST_ASSERT_TRUE(expected == readAll(form, 7));
+}
+
+void test_rejects_too_many_parts() {
+    MultipartEncoder form;
+    for (int i = 0; i < FLUENTHTTP_MULTIPART_PARTS; i++)
+        form.addField("f", "v");
+    TEST_ASSERT_TRUE(form.ok());
+    form.addField("f", "v");
+    TEST_ASSERT_FALSE(form.ok());
+}
+
+void test_known_sizes_upload_with_content_length() {
+    PatternStream log(5000);
+    MultipartEncoder form;
+    form.addField("device", "sensor-7")
+        .addFile("log", "log.txt", "text/plain", log, 5000);
+    long size = form.size();
+    TEST_ASSERT_GREATER_THAN(5000, size);
+
+    upload(form);
+    std::string head = client.head();
+    TEST_ASSERT_TRUE(head.find("Content-Length: " + std::to_string(size) + "\r\n") != std::string::npos);
+    TEST_ASSERT_TRUE(head.find("Content-Type: multipart/form-data; boundary=" + std::string(form.boundary())) != std::string::npos);
+    std::string body = client.body();
+    TEST_ASSERT_EQUAL(size, body.size());
+    TEST_ASSERT_TRUE(body.find(pattern(5000)) != std::string::npos);
+}
+
+void test_unknown_size_uploads_chunked() {
+    PatternStream log(3000);
+    log.setTimeout(20);
+    MultipartEncoder form;
+    form.addFile("log", "log.txt", "text/plain", log);
+    TEST_ASSERT_EQUAL(-1, form.size());
+
+    upload(form);
+    TEST_ASSERT_TRUE(client.head().find("Transfer-Encoding: chunked\r\n") != std::string::npos);
+    TEST_ASSERT_TRUE(client.head().find("Content-Length") == std::string::npos);
+    std::string body = dechunk(client.body());
+    std::string b = form.boundary();
+    TEST_ASSERT_TRUE(body.find(pattern(3000) + "\r\n--" + b + "--\r\n") != std::string::npos);
+    TEST_ASSERT_TRUE(client.body().substr(client.body().size() - 5) == "0\r\n\r\n");
+}
+
+void test_slow_stream_of_unknown_size_is_not_cut() {
+    TrickleStream log(1000, 200, 30);
+    log.setTimeout(200);
+    MultipartEncoder form;
+    form.addFile("log", "log.txt", "text/plain", log);
+
+    upload(form);
+    std::string body = dechunk(client.body());
+    std::string b = form.boundary();
+    TEST_ASSERT_TRUE(body.find("\r\n\r\n" + pattern(1000) + "\r\n--" + b + "--\r\n") != std::string::npos);
+}
+
+void test_escapes_quotes_and_line_breaks_in_names() {
+    MultipartEncoder form;
+    form.addFile("a\"b", "evil.txt\"\r\nX-Injected: 1", "text/plain", (const uint8_t*)"x", 1);
+    std::string b = form.boundary();
+    std::string expected =
+        "--" + b + "\r\n"
+        "Content-Disposition: form-data; name=\"a%22b\"; filename=\"evil.txt%22%0D%0AX-Injected: 1\"\r\n"
+        "Content-Type: text/plain\r\n"
+        "\r\n"
+        "x\r\n"
+        "--" + b + "--\r\n";
+    TEST_ASSERT_EQUAL(expected.size(), form.size());
+    TEST_ASSERT_TRUE(expected == readAll(form, 64));
+    form.rewind();
+    TEST_ASSERT_TRUE(expected == readAll(form, 1));
+}
+
+void test_encoding_does_not_allocate() {
+    #if ALLOCATION_COUNTER_ENABLED
+    PatternStream log(20000);
+    MultipartEncoder form;
+    form.addField("device", "sensor-7").addFile("log", "log.txt", "text/plain", log, 20000);
+    uint8_t buffer[FLUENTHTTP_BODY_BUFFER_SIZE];
+    allocation_stats_t a0 = allocationSnapshot();
+    size_t total = 0, n;
+    while ((n = form.read(buffer, sizeof(buffer))) > 0) total += n;
+    allocation_stats_t a1 = allocationSnapshot();
+    TEST_ASSERT_EQUAL(form.size(), total);
+    TEST_ASSERT_EQUAL(0, a1.allocations - a0.allocations);
+    #endif
+}
+
+int main(int argc, char** argv)
+{
+    installHostArduino(&client);
+    client.response = "HTTP/1.1 201 Created\r\nContent-Length: 0\r\n\r\n";
+    endpoint.begin(&client);
+
+    UNITY_BEGIN();
+    RUN_TEST(test_encodes_fields_and_files);
+    RUN_TEST(test_rejects_too_many_parts);
+    RUN_TEST(test_known_sizes_upload_with_content_length);
+    RUN_TEST(test_unknown_size_uploads_chunked);
+    RUN_TEST(test_slow_stream_of_unknown_size_is_not_cut);
+    RUN_TEST(test_escapes_quotes_and_line_breaks_in_names);
+    RUN_TEST(test_encoding_does_not_allocate);
+    return UNITY_END();
+}
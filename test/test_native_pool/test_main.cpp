@@ -0,0 +1,229 @@
+#include <Arduino.h>
+#include <unity.h>
+#include <fluenthttp.h>
+#include "../support/HostArduino.h"
+#include "../support/LoopbackClient.h"
+#include "../support/AllocationCounter.h"
+
+// requests issued from the pool of an endpoint through generation checked handles
+
+LoopbackClient client;
+ServiceEndpoint endpoint("pool.local");
+
+static int succeeded = 0;
+static int failed = 0;
+static String failure;
+
+ServiceRequestHandle issue(const char* uri) {
+    ServiceRequestHandle handle = endpoint.request("GET", uri);
+    if (handle)
+        handle->withTimeout(200)
+            .onSuccess([](service_response_t r) { succeeded++; })
+            .onFailure([](service_response_t r) {
+                failed++;
+                failure = r.statusMessage;
+            });
+    return handle;
+}
+
+void setUp(void)
+{
+    client.reset();
+    client.setResponse("HTTP/1.1 200 OK\r\nContent-Length: 2\r\n\r\nok");
+    endpoint.withKeepAlive(true);
+    succeeded = failed = 0;
+    failure = String();
+}
+
+void tearDown(void)
+{
+}
+
+void test_pool_is_allocated_by_the_first_request() {
+    #if ALLOCATION_COUNTER_ENABLED
+    allocation_stats_t a0 = allocationSnapshot();
+    ServiceEndpoint* unused = new ServiceEndpoint("unused.local");
+    allocation_stats_t a1 = allocationSnapshot();
+    // the endpoint itself grows with FLUENTHTTP_METRICS, it holds no slot though
+    TEST_ASSERT_TRUE(a1.bytes - a0.bytes < sizeof(ServiceEndpoint) + sizeof(service_request_slot_t));
+    delete unused;
+    #endif
+}
+
+void test_handle_drives_pooled_request() {
+    ServiceRequestHandle handle = issue("/status");
+    TEST_ASSERT_TRUE(handle.valid());
+    handle->fire().await();
+    TEST_ASSERT_EQUAL(1, succeeded);
+    TEST_ASSERT_EQUAL(srsCompleted, handle->getStatus());
+    TEST_ASSERT_EQUAL(1, client.requests);
+    handle.release();
+}
+
+void test_released_handle_goes_stale() {
+    ServiceRequestHandle handle = issue("/status");
+    ServiceRequestHandle copy = handle;
+    handle->fire().await();
+    handle.release();
+    TEST_ASSERT_FALSE(handle);
+    TEST_ASSERT_NULL(copy.get());
+    // the slot is handed out again, the old handles do not see the new request
+    ServiceRequestHandle next = issue("/status");
+    TEST_ASSERT_TRUE(next.valid());
+    TEST_ASSERT_FALSE(copy.valid());
+    copy.release();
+    TEST_ASSERT_TRUE(next.valid());
+    next->fire().await();
+    TEST_ASSERT_EQUAL(2, succeeded);
+    next.release();
+    TEST_ASSERT_FALSE(ServiceRequestHandle().valid());
+}
+
+void test_stale_handle_is_checked_before_use() {
+    ServiceRequestHandle handle = issue("/status");
+    ServiceRequestHandle copy = handle;
+    handle->fire().await();
+    handle.release();
+    // a stale handle gives no request, the endpoint and the pool are left alone
+    if (ServiceRequest* request = copy.get())
+        request->fire().await();
+    copy.release();
+    TEST_ASSERT_EQUAL(1, client.requests);
+    TEST_ASSERT_NULL(ServiceRequestHandle().get());
+    // the lock was given back with the released request, the next one gets it
+    ServiceRequestHandle next = issue("/status");
+    TEST_ASSERT_TRUE(next.valid());
+    next->fire().await();
+    TEST_ASSERT_EQUAL(2, succeeded);
+    next.release();
+}
+
+void test_oldest_finished_request_is_recycled() {
+    // FLUENTHTTP_REQUEST_POOL slots
+    ServiceRequestHandle first = issue("/a");
+    first->fire().await();
+    ServiceRequestHandle second = issue("/b");
+    second->fire().await();
+    ServiceRequestHandle third = issue("/c");
+    TEST_ASSERT_TRUE(third.valid());
+    TEST_ASSERT_FALSE(first.valid());
+    TEST_ASSERT_TRUE(second.valid());
+    TEST_ASSERT_EQUAL(srsCompleted, second->getStatus());
+    third->fire().await();
+    TEST_ASSERT_EQUAL(3, succeeded);
+    second.release();
+    third.release();
+}
+
+void test_release_cancels_running_request() {
+    client.setResponse("");
+    ServiceRequestHandle handle = issue("/slow");
+    handle->fire();
+    TEST_ASSERT_TRUE(handle->active());
+    handle.release();
+    TEST_ASSERT_FALSE(handle.valid());
+    TEST_ASSERT_EQUAL(1, failed);
+    TEST_ASSERT_EQUAL_STRING("request released", failure.c_str());
+    // the lock was given back
+    client.setResponse("HTTP/1.1 200 OK\r\nContent-Length: 2\r\n\r\nok");
+    ServiceRequestHandle next = issue("/status");
+    TEST_ASSERT_TRUE(next.valid());
+    next->fire().await();
+    TEST_ASSERT_EQUAL(1, succeeded);
+    next.release();
+}
+
+void test_empty_handle_when_all_slots_are_running() {
+    client.setResponse("");
+    ServiceRequestHandle a = issue("/a");
+    a->fire();
+    endpoint.forceUnlock();
+    ServiceRequestHandle b = issue("/b");
+    b->fire();
+    endpoint.forceUnlock();
+    ServiceRequestHandle c = issue("/c");
+    TEST_ASSERT_FALSE(c.valid());
+    TEST_ASSERT_TRUE(a.valid());
+    TEST_ASSERT_TRUE(b.valid());
+    // the lock was not kept
+    a.release();
+    ServiceRequestHandle d = issue("/d");
+    TEST_ASSERT_TRUE(d.valid());
+    d.release();
+    b.release();
+}
+
+void test_pool_is_not_resized_while_in_use() {
+    ServiceRequestHandle handle = issue("/a");
+    handle->fire().await();
+    endpoint.withRequestPool(4);
+    TEST_ASSERT_TRUE(handle.valid());
+    // still FLUENTHTTP_REQUEST_POOL slots, the third request recycles the first one
+    ServiceRequestHandle second = issue("/b");
+    second->fire().await();
+    ServiceRequestHandle third = issue("/c");
+    TEST_ASSERT_TRUE(third.valid());
+    TEST_ASSERT_FALSE(handle.valid());
+    third->fire().await();
+    ServiceRequestHandle old = third;
+    second.release();
+    third.release();
+
+    // handles of the old pool do not come alive in the resized one
+    endpoint.withRequestPool(4);
+    for (int round = 0; round < 8; round++) {
+        ServiceRequestHandle slots[4];
+        for (int i = 0; i < 4; i++) {
+            slots[i] = issue("/d");
+            TEST_ASSERT_TRUE(slots[i].valid());
+            TEST_ASSERT_FALSE(old.valid());
+            slots[i]->fire().await();
+        }
+        for (int i = 0; i < 4; i++)
+            slots[i].release();
+    }
+    TEST_ASSERT_EQUAL(35, succeeded);
+    endpoint.withRequestPool();
+}
+
+void test_issue_does_not_allocate() {
+    #if ALLOCATION_COUNTER_ENABLED
+    // connection, head template and pool are set up by the first request
+    ServiceRequestHandle handle = issue("/status");
+    handle->fire().await();
+    handle.release();
+    // response parsing is not counted, it fills the status message
+    uint64_t allocations = 0;
+    for (int i = 0; i < 100; i++) {
+        allocation_stats_t a0 = allocationSnapshot();
+        handle = endpoint.request("GET", "/status");
+        handle->withTimeout(200)
+            .withQuery("n", (long)i)
+            .addHeader("Accept", "text/plain")
+            .fire();
+        allocation_stats_t a1 = allocationSnapshot();
+        allocations += a1.allocations - a0.allocations;
+        handle->await();
+        TEST_ASSERT_EQUAL(srsCompleted, handle->getStatus());
+    }
+    TEST_ASSERT_EQUAL(0, allocations);
+    #endif
+}
+
+int main(int argc, char** argv)
+{
+    installHostArduino(&client);
+    endpoint.begin(&client);
+
+    UNITY_BEGIN();
+    RUN_TEST(test_pool_is_allocated_by_the_first_request);
+    RUN_TEST(test_handle_drives_pooled_request);
+    RUN_TEST(test_released_handle_goes_stale);
+    RUN_TEST(test_stale_handle_is_checked_before_use);
+    RUN_TEST(test_oldest_finished_request_is_recycled);
+    RUN_TEST(test_release_cancels_running_request);
+    RUN_TEST(test_empty_handle_when_all_slots_are_running);
+    RUN_TEST(test_pool_is_not_resized_while_in_use);
+    RUN_TEST(test_issue_does_not_allocate);
+    return UNITY_END();
+}
@@ -0,0 +1,229 @@
+#include <Arduino.h>
+#include <unity.h>
+#include <fluenthttp.h>
+#include "../support/HostArduino.h"
+#include "../support/LoopbackClient.h"
+#include "../support/Outcome.h"
+
+// retry policy of ServiceRequest against a loopback server that refuses connections,
+// drops requests or answers 503 a configurable number of times before it answers normally
+
+class FlakyClient : public LoopbackClient {
+    protected:
+        void startResponse() {
+            if (dropRequests > 0) {
+                // connection reset before the response
+                dropRequests--;
+                stop();
+                return;
+            }
+            if (unavailableResponses > 0) {
+                unavailableResponses--;
+                _rxPos = 0;
+                _rxLength = strlen(unavailable);
+                _unavailable = true;
+                return;
+            }
+            _unavailable = false;
+            LoopbackClient::startResponse();
+        }
+
+        const uint8_t* current() { return _unavailable ? (const uint8_t*)unavailable : _response; }
+        bool _unavailable = false;
+
+    public:
+        uint32_t refuseConnects = 0;
+        uint32_t dropRequests = 0;
+        uint32_t unavailableResponses = 0;
+        const char* unavailable = "HTTP/1.1 503 Service Unavailable\r\nRetry-After: 1\r\nContent-Length: 4\r\n\r\nbusy";
+
+        void reset() {
+            LoopbackClient::reset();
+            refuseConnects = dropRequests = unavailableResponses = 0;
+            _unavailable = false;
+        }
+
+        int connect(IPAddress ip, uint16_t port) { return connect((const char*)nullptr, port); }
+        int connect(const char* host, uint16_t port) {
+            if (refuseConnects > 0) {
+                refuseConnects--;
+                return 0;
+            }
+            return LoopbackClient::connect(host, port);
+        }
+
+        int read() {
+            nextResponse();
+            if (_rxPos >= _rxLength) return -1;
+            bytesRead++;
+            return current()[_rxPos++];
+        }
+        int read(uint8_t* buf, size_t size) {
+            nextResponse();
+            size_t n = _rxLength - _rxPos;
+            if (n > size) n = size;
+            memcpy(buf, current() + _rxPos, n);
+            _rxPos += n;
+            bytesRead += n;
+            return (int)n;
+        }
+        int peek() {
+            nextResponse();
+            return _rxPos < _rxLength ? current()[_rxPos] : -1;
+        }
+};
+
+FlakyClient client;
+ServiceEndpoint endpoint("retry.local");
+
+service_retry_policy_t policy(uint8_t maxAttempts) {
+    service_retry_policy_t p;
+    p.maxAttempts = maxAttempts;
+    p.backoff = 4;
+    p.maxBackoff = 20;
+    return p;
+}
+
+void setUp(void)
+{
+    endpoint.close();
+    client.reset();
+    client.setResponse("HTTP/1.1 200 OK\r\nContent-Length: 2\r\n\r\nok");
+    endpoint.withRetry(policy(3));
+    outcome = outcome_t();
+}
+
+void tearDown(void)
+{
+}
+
+void test_retries_failed_connect() {
+    client.refuseConnects = 2;
+    ServiceRequest request;
+    TEST_ASSERT_TRUE(endpoint.get("/status", request));
+    track(request, 200);
+    request.fire().await();
+    TEST_ASSERT_EQUAL(1, outcome.succeeded);
+    TEST_ASSERT_EQUAL(0, outcome.failed);
+    TEST_ASSERT_EQUAL(1, client.connects);
+}
+
+void test_gives_up_after_max_attempts() {
+    client.refuseConnects = 3;
+    ServiceRequest request;
+    TEST_ASSERT_TRUE(endpoint.get("/status", request));
+    track(request, 200);
+    request.fire().await();
+    TEST_ASSERT_EQUAL(0, outcome.succeeded);
+    TEST_ASSERT_EQUAL(1, outcome.failed);
+    TEST_ASSERT_EQUAL_STRING("failed to connect to server", outcome.message.c_str());
+    TEST_ASSERT_EQUAL(srsFailed, request.getStatus());
+}
+
+void test_retries_reset_before_response() {
+    client.dropRequests = 1;
+    ServiceRequest request;
+    TEST_ASSERT_TRUE(endpoint.get("/status", request));
+    track(request, 200);
+    request.fire().await();
+    TEST_ASSERT_EQUAL(1, outcome.succeeded);
+    TEST_ASSERT_EQUAL(0, outcome.timedOut);
+    TEST_ASSERT_EQUAL(2, client.requests);
+}
+
+void test_reset_fails_fast_without_retry() {
+    endpoint.withRetry(policy(1));
+    client.dropRequests = 1;
+    ServiceRequest request;
+    TEST_ASSERT_TRUE(endpoint.get("/status", request));
+    track(request, 200);
+    request.fire().await();
+    TEST_ASSERT_EQUAL(1, outcome.failed);
+    TEST_ASSERT_EQUAL(0, outcome.timedOut);
+    TEST_ASSERT_EQUAL_STRING("connection closed before response", outcome.message.c_str());
+}
+
+void test_retries_service_unavailable_after_retry_after() {
+    service_retry_policy_t p = policy(3);
+    p.maxBackoff = 2000;
+    endpoint.withRetry(p);
+    client.unavailableResponses = 1;
+    ServiceRequest request;
+    TEST_ASSERT_TRUE(endpoint.get("/status", request));
+    track(request, 200);
+    unsigned long t0 = millis();
+    request.fire().await();
+    TEST_ASSERT_EQUAL(1, outcome.succeeded);
+    TEST_ASSERT_EQUAL(200, outcome.statusCode);
+    // Retry-After: 1 is waited for as the server asked
+    TEST_ASSERT_GREATER_OR_EQUAL(1000, millis() - t0);
+    TEST_ASSERT_EQUAL(2, client.requests);
+}
+
+void test_retry_after_beyond_max_backoff_fails() {
+    client.unavailableResponses = 1;
+    ServiceRequest request;
+    TEST_ASSERT_TRUE(endpoint.get("/status", request));
+    track(request, 200);
+    unsigned long t0 = millis();
+    request.fire().await();
+    // not retried earlier than the server asked, the 503 is reported
+    TEST_ASSERT_EQUAL(0, outcome.succeeded);
+    TEST_ASSERT_EQUAL(1, outcome.failed);
+    TEST_ASSERT_EQUAL(503, outcome.statusCode);
+    TEST_ASSERT_EQUAL(1, client.requests);
+    TEST_ASSERT_LESS_THAN(500, millis() - t0);
+}
+
+void test_retries_too_many_requests() {
+    const char* unavailable = client.unavailable;
+    client.unavailable = "HTTP/1.1 429 Too Many Requests\r\nRetry-After: 0\r\nContent-Length: 0\r\n\r\n";
+    client.unavailableResponses = 2;
+    ServiceRequest request;
+    TEST_ASSERT_TRUE(endpoint.get("/status", request));
+    track(request, 200);
+    request.fire().await();
+    client.unavailable = unavailable;
+    TEST_ASSERT_EQUAL(1, outcome.succeeded);
+    TEST_ASSERT_EQUAL(3, client.requests);
+}
+
+void test_post_is_not_retried_unless_idempotent() {
+    client.dropRequests = 1;
+    ServiceRequest request;
+    TEST_ASSERT_TRUE(endpoint.post("/telemetry", request));
+    track(request, 200);
+    request.fireContent(String("{}"));
+    request.await();
+    TEST_ASSERT_EQUAL(1, outcome.failed);
+    TEST_ASSERT_EQUAL(1, client.requests);
+
+    outcome = outcome_t();
+    client.reset();
+    client.dropRequests = 1;
+    ServiceRequest retried;
+    TEST_ASSERT_TRUE(endpoint.post("/telemetry", retried));
+    track(retried, 200);
+    retried.withIdempotent().fireContent(String("{}"));
+    retried.await();
+    TEST_ASSERT_EQUAL(1, outcome.succeeded);
+    TEST_ASSERT_EQUAL(2, client.requests);
+}
+
+int main(int argc, char** argv)
+{
+    installHostArduino(&client);
+    client.setTimeout(100);
+    endpoint.begin(&client);
+
+    UNITY_BEGIN();
+    RUN_TEST(test_retries_failed_connect);
+    RUN_TEST(test_gives_up_after_max_attempts);
+    RUN_TEST(test_retries_reset_before_response);
+    RUN_TEST(test_reset_fails_fast_without_retry);
+    RUN_TEST(test_retries_service_unavailable_after_retry_after);
+    RUN_TEST(test_retry_after_beyond_max_backoff_fails);
+    RUN_TEST(test_retries_too_many_requests);
+    RUN_TEST(test_post_is_not_retried_unless_idempotent);
+    return UNITY_END();
+}
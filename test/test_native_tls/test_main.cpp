@@ -0,0 +1,209 @@
+#include <Arduino.h>
+#include <unity.h>
+#include <fluenthttp.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include "../support/HostArduino.h"
+#include "../support/LoopbackClient.h"
+
+// tls session resumption across reconnects: the endpoint keeps the session of each connection
+// and offers it on the next connect
+
+// tls stand-in: the server side caches the tickets it handed out, an offered ticket
+// it still knows resumes the session
+class TicketClient : public ServiceTlsClient {
+    LoopbackClient _tcp;
+    std::vector<std::string> _known;
+    std::string _offered;
+    std::string _ticket;
+    bool _resumed = false;
+
+    public:
+        uint32_t measured = 0;              // reported handshake micros, 0 to leave it to the endpoint
+        std::vector<std::string> offers;    // by connect
+        int issued = 0;
+
+        void reset() {
+            _tcp.stop();
+            _tcp.reset();
+            _known.clear();
+            _offered.clear();
+            offers.clear();
+            issued = 0;
+            measured = 0;
+        }
+        void restartServer() { _known.clear(); }
+        void setResponse(const char* response) { _tcp.setResponse(response); }
+        uint32_t connects() const { return _tcp.connects; }
+
+        int connect(IPAddress ip, uint16_t port) { return connect((const char*)nullptr, port); }
+        int connect(const char* host, uint16_t port) {
+            offers.push_back(_offered);
+            _resumed = !_offered.empty() && std::find(_known.begin(), _known.end(), _offered) != _known.end();
+            if (_resumed) {
+                _ticket = _offered;
+            }
+            else {
+                _ticket = "ticket-" + std::to_string(++issued);
+                _known.push_back(_ticket);
+            }
+            return _tcp.connect(host, port);
+        }
+        size_t write(uint8_t b) { return _tcp.write(b); }
+        size_t write(const uint8_t* buf, size_t size) { return _tcp.write(buf, size); }
+        int available() { hostSelectStream(this); return _tcp.available(); }
+        int read() { return _tcp.read(); }
+        int read(uint8_t* buf, size_t size) { return _tcp.read(buf, size); }
+        int peek() { hostSelectStream(this); return _tcp.peek(); }
+        void flush() {}
+        void stop() { _tcp.stop(); }
+        uint8_t connected() { return _tcp.connected(); }
+        operator bool() { return _tcp.connected(); }
+
+        size_t saveSession(uint8_t* buffer, size_t size) {
+            if (_ticket.size() > size) return 0;
+            memcpy(buffer, _ticket.data(), _ticket.size());
+            return _ticket.size();
+        }
+        void offerSession(const uint8_t* session, size_t length) { _offered.assign((const char*)session, length); }
+        bool sessionResumed() { return _resumed; }
+        uint32_t handshakeMicros() { return measured; }
+};
+
+TicketClient client;
+ServiceEndpoint endpoint("tls.local", 443);
+static const char* response = "HTTP/1.1 200 OK\r\nContent-Length: 2\r\n\r\nok";
+static int succeeded;
+
+static void request(ServiceEndpoint& target, const char* uri) {
+    ServiceRequest request;
+    TEST_ASSERT_TRUE(target.get(uri, request));
+    request.withTimeout(2000).onSuccess([](service_response_t r) { succeeded++; });
+    request.fire().await();
+}
+
+void setUp(void)
+{
+    client.reset();
+    client.setResponse(response);
+    endpoint.begin(&client);
+    endpoint.withKeepAlive(false);
+    service_endpoint_stats_t stats;
+    endpoint.getStats(stats, true);
+    succeeded = 0;
+}
+
+void tearDown(void)
+{
+}
+
+void test_reconnects_resume_the_session() {
+    request(endpoint, "/a");
+    request(endpoint, "/b");
+    request(endpoint, "/c");
+    TEST_ASSERT_EQUAL(3, succeeded);
+    TEST_ASSERT_EQUAL(3, client.connects());
+    TEST_ASSERT_EQUAL(1, client.issued);
+    TEST_ASSERT_EQUAL_STRING("", client.offers[0].c_str());
+    TEST_ASSERT_EQUAL_STRING("ticket-1", client.offers[1].c_str());
+    TEST_ASSERT_EQUAL_STRING("ticket-1", client.offers[2].c_str());
+
+    #if FLUENTHTTP_METRICS
+    service_endpoint_stats_t stats;
+    TEST_ASSERT_TRUE(endpoint.getStats(stats));
+    TEST_ASSERT_EQUAL(3, stats.tlsHandshakes);
+    TEST_ASSERT_EQUAL(2, stats.tlsResumed);
+    TEST_ASSERT_EQUAL(66, stats.tlsResumptionRate());
+    TEST_ASSERT_EQUAL(3, stats.handshake.count);
+    #endif
+}
+
+void test_unknown_session_falls_back_to_full_handshake() {
+    request(endpoint, "/a");
+    client.restartServer();
+    request(endpoint, "/b");
+    request(endpoint, "/c");
+    TEST_ASSERT_EQUAL(3, succeeded);
+    TEST_ASSERT_EQUAL(2, client.issued);
+    // the session of the full handshake replaces the rejected one
+    TEST_ASSERT_EQUAL_STRING("ticket-1", client.offers[1].c_str());
+    TEST_ASSERT_EQUAL_STRING("ticket-2", client.offers[2].c_str());
+
+    #if FLUENTHTTP_METRICS
+    service_endpoint_stats_t stats;
+    TEST_ASSERT_TRUE(endpoint.getStats(stats));
+    TEST_ASSERT_EQUAL(3, stats.tlsHandshakes);
+    TEST_ASSERT_EQUAL(1, stats.tlsResumed);
+    #endif
+}
+
+void test_forgotten_session_is_not_offered() {
+    request(endpoint, "/a");
+    endpoint.forgetTlsSession();
+    request(endpoint, "/b");
+    TEST_ASSERT_EQUAL_STRING("", client.offers[1].c_str());
+    TEST_ASSERT_EQUAL(2, client.issued);
+}
+
+void test_keep_alive_needs_a_single_handshake() {
+    endpoint.withKeepAlive(true);
+    request(endpoint, "/a");
+    request(endpoint, "/b");
+    request(endpoint, "/c");
+    TEST_ASSERT_EQUAL(3, succeeded);
+    TEST_ASSERT_EQUAL(1, client.connects());
+    endpoint.close();
+
+    #if FLUENTHTTP_METRICS
+    service_endpoint_stats_t stats;
+    TEST_ASSERT_TRUE(endpoint.getStats(stats));
+    TEST_ASSERT_EQUAL(1, stats.tlsHandshakes);
+    #endif
+}
+
+void test_handshake_time_of_the_client_is_recorded() {
+    #if !FLUENTHTTP_METRICS
+    TEST_IGNORE_MESSAGE("handshake times are recorded with FLUENTHTTP_METRICS");
+    #endif
+    client.measured = 1500;
+    request(endpoint, "/a");
+    client.measured = 300;
+    request(endpoint, "/b");
+
+    service_endpoint_stats_t stats;
+    TEST_ASSERT_TRUE(endpoint.getStats(stats));
+    TEST_ASSERT_EQUAL(2, stats.handshake.count);
+    TEST_ASSERT_EQUAL(1500, stats.handshake.maxMicros);
+    TEST_ASSERT_EQUAL(900, stats.handshake.meanMicros());
+}
+
+void test_plain_clients_are_not_counted() {
+    LoopbackClient plain;
+    plain.setResponse(response);
+    endpoint.begin(&plain);
+    hostSelectStream(&plain);
+    request(endpoint, "/a");
+    TEST_ASSERT_EQUAL(1, succeeded);
+    TEST_ASSERT_EQUAL(0, client.offers.size());
+
+    #if FLUENTHTTP_METRICS
+    service_endpoint_stats_t stats;
+    TEST_ASSERT_TRUE(endpoint.getStats(stats));
+    TEST_ASSERT_EQUAL(0, stats.tlsHandshakes);
+    #endif
+}
+
+int main(int argc, char** argv)
+{
+    installHostArduino(&client);
+
+    UNITY_BEGIN();
+    RUN_TEST(test_reconnects_resume_the_session);
+    RUN_TEST(test_unknown_session_falls_back_to_full_handshake);
+    RUN_TEST(test_forgotten_session_is_not_offered);
+    RUN_TEST(test_keep_alive_needs_a_single_handshake);
+    RUN_TEST(test_handshake_time_of_the_client_is_recorded);
+    RUN_TEST(test_plain_clients_are_not_counted);
+    return UNITY_END();
+}
@@ -0,0 +1,175 @@
+#include <Arduino.h>
+#include <unity.h>
+#include <fluenthttp.h>
+#include <type_traits>
+#include <vector>
+#include "../support/ScriptedClient.h"
+#include "../support/Outcome.h"
+
+// ServiceTraceRing as recorder policy, built with -D FLUENTHTTP_TRACE_RING=64
+// (env:native_trace): the ring itself and the events a request records on its way.
+// Other builds test the ring only
+
+typedef ServiceTraceRing<64> Ring;
+static const bool recording = std::is_same<service_trace_policy_t, Ring>::value;
+
+ScriptedClient client;
+ServiceEndpoint endpoint("trace.local");
+
+// collects printed lines
+class LinePrint : public Print {
+    public:
+        std::vector<std::string> lines;
+        std::string current;
+
+        size_t write(uint8_t c) {
+            if (c == '\n') {
+                lines.push_back(current);
+                current.clear();
+            }
+            else if (c != '\r') {
+                current += (char)c;
+            }
+            return 1;
+        }
+        size_t write(const uint8_t* buffer, size_t size) {
+            for (size_t i = 0; i < size; i++) write(buffer[i]);
+            return size;
+        }
+};
+
+// the records of one event kind, oldest first
+static std::vector<const service_trace_record_t*> records(service_trace_event_t event) {
+    std::vector<const service_trace_record_t*> result;
+    for (size_t i = 0; i < Ring::count(); i++)
+        if (Ring::at(i).event == event)
+            result.push_back(&Ring::at(i));
+    return result;
+}
+
+static int32_t sum(service_trace_event_t event) {
+    int32_t total = 0;
+    for (const service_trace_record_t* r : records(event))
+        total += r->value;
+    return total;
+}
+
+static std::vector<int32_t> transitions() {
+    std::vector<int32_t> result;
+    for (const service_trace_record_t* r : records(steStatus))
+        result.push_back(r->value);
+    return result;
+}
+
+void setUp(void)
+{
+    client.reset();
+    endpoint.withKeepAlive(true);
+    outcome = outcome_t();
+    Ring::clear();
+}
+
+void tearDown(void)
+{
+}
+
+void test_ring_keeps_the_last_events() {
+    int marker;
+    for (int i = 0; i < 70; i++)
+        Ring::event(&marker, steBytesOut, i, nullptr, 0);
+    TEST_ASSERT_EQUAL(64, Ring::count());
+    TEST_ASSERT_EQUAL(6, Ring::at(0).value);
+    TEST_ASSERT_EQUAL(69, Ring::at(63).value);
+    TEST_ASSERT_EQUAL((uint16_t)(size_t)&marker, Ring::at(0).request);
+    // texts are cut to the record and stay terminated
+    const char* text = "a-header-name-longer-than-the-record";
+    Ring::event(&marker, steHeaderOut, 0, text, strlen(text));
+    TEST_ASSERT_EQUAL(FLUENTHTTP_TRACE_TEXT_SIZE - 1, strlen(Ring::at(63).text));
+    TEST_ASSERT_EQUAL(0, strncmp(text, Ring::at(63).text, FLUENTHTTP_TRACE_TEXT_SIZE - 1));
+    Ring::clear();
+    TEST_ASSERT_EQUAL(0, Ring::count());
+}
+
+void test_dump_prints_oldest_first() {
+    int marker;
+    Ring::event(&marker, steRequestLine, 0, "GET /a", 6);
+    Ring::event(&marker, steResponse, 204, nullptr, 0);
+    LinePrint out;
+    Ring::dump(out);
+    TEST_ASSERT_EQUAL(2, out.lines.size());
+    TEST_ASSERT_TRUE(out.lines[0].find("request") != std::string::npos);
+    TEST_ASSERT_TRUE(out.lines[0].find("GET /a") != std::string::npos);
+    TEST_ASSERT_TRUE(out.lines[1].find("response") != std::string::npos);
+    TEST_ASSERT_TRUE(out.lines[1].find(" 204") != std::string::npos);
+    TEST_ASSERT_EQUAL_STRING("?", serviceTraceEventName(steCount));
+}
+
+void test_request_records_its_way() {
+    if (!recording) TEST_IGNORE_MESSAGE("requests record with FLUENTHTTP_TRACE_RING=64");
+    client.response = "HTTP/1.1 200 OK\r\nContent-Type: text/plain\r\nContent-Length: 2\r\n\r\nok";
+    ServiceRequest request;
+    TEST_ASSERT_TRUE(endpoint.get("/status", request));
+    track(request).addHeader("X-Probe", "1").fire().await();
+    TEST_ASSERT_EQUAL(1, outcome.succeeded);
+
+    for (size_t i = 0; i < Ring::count(); i++)
+        TEST_ASSERT_EQUAL((uint16_t)(size_t)&request, Ring::at(i).request);
+    std::vector<int32_t> expected = { srsArmed, srsIncomplete, srsAwaitResponse, srsReadingHeader,
+        srsReadingContent, srsCompleted };
+    TEST_ASSERT_TRUE(transitions() == expected);
+    TEST_ASSERT_EQUAL_STRING("GET /status", records(steRequestLine)[0]->text);
+    TEST_ASSERT_EQUAL_STRING("X-Probe", records(steHeaderOut)[0]->text);
+    // bytes out are the head as written, bytes in the response head
+    TEST_ASSERT_EQUAL(client.written.size(), sum(steBytesOut));
+    TEST_ASSERT_EQUAL(client.response.size() - 2, sum(steBytesIn) + sum(steHeaderIn));
+    TEST_ASSERT_EQUAL(200, records(steResponse)[0]->value);
+    std::vector<const service_trace_record_t*> headers = records(steHeaderIn);
+    TEST_ASSERT_EQUAL(2, headers.size());
+    TEST_ASSERT_EQUAL_STRING("Content-Type", headers[0]->text);
+    TEST_ASSERT_EQUAL_STRING("Content-Length", headers[1]->text);
+    TEST_ASSERT_EQUAL(0, records(steTimeout).size());
+    TEST_ASSERT_EQUAL(0, records(steFailure).size());
+    // timestamps do not go back
+    for (size_t i = 1; i < Ring::count(); i++)
+        TEST_ASSERT_TRUE(Ring::at(i).micros >= Ring::at(i - 1).micros);
+}
+
+void test_timeout_is_recorded() {
+    if (!recording) TEST_IGNORE_MESSAGE("requests record with FLUENTHTTP_TRACE_RING=64");
+    client.response = "";
+    ServiceRequest request;
+    TEST_ASSERT_TRUE(endpoint.get("/slow", request));
+    track(request, 50).fire().await();
+    TEST_ASSERT_EQUAL(1, outcome.timedOut);
+    std::vector<const service_trace_record_t*> timeouts = records(steTimeout);
+    TEST_ASSERT_EQUAL(1, timeouts.size());
+    TEST_ASSERT_EQUAL(50, timeouts[0]->value);
+    TEST_ASSERT_EQUAL(srsFailed, transitions().back());
+    TEST_ASSERT_EQUAL(0, records(steResponse).size());
+}
+
+void test_prefailed_request_records_the_reason() {
+    if (!recording) TEST_IGNORE_MESSAGE("requests record with FLUENTHTTP_TRACE_RING=64");
+    ServiceRequest request;
+    TEST_ASSERT_TRUE(endpoint.get("/a", request));
+    track(request).withQuery("k", "v").withPathSegment("b").fire().await();
+    TEST_ASSERT_EQUAL(1, outcome.failed);
+    std::vector<const service_trace_record_t*> failures = records(steFailure);
+    TEST_ASSERT_EQUAL(1, failures.size());
+    TEST_ASSERT_EQUAL(0, strncmp("request uri exceeds", failures[0]->text, 19));
+    TEST_ASSERT_EQUAL(0, records(steBytesOut).size());
+}
+
+int main(int argc, char** argv)
+{
+    installHostArduino(&client);
+    endpoint.begin(&client);
+
+    UNITY_BEGIN();
+    RUN_TEST(test_ring_keeps_the_last_events);
+    RUN_TEST(test_dump_prints_oldest_first);
+    RUN_TEST(test_request_records_its_way);
+    RUN_TEST(test_timeout_is_recorded);
+    RUN_TEST(test_prefailed_request_records_the_reason);
+    return UNITY_END();
+}
@@ -0,0 +1,197 @@
+#include <Arduino.h>
+#include <unity.h>
+#include <fluenthttp.h>
+#include <UriBuilder.h>
+#include <limits.h>
+#include <string>
+#include "../support/ScriptedClient.h"
+#include "../support/Outcome.h"
+
+// percent-encoding table and capacity limits of UriBuilder, and how a request reports a
+// uri that did not fit or was composed in the wrong order
+
+ScriptedClient client;
+ServiceEndpoint endpoint("uri.local");
+
+// the request target of the first request written
+static std::string target() {
+    std::string head = client.head();
+    size_t start = head.find(' ') + 1;
+    return head.substr(start, head.find(' ', start) - start);
+}
+
+void setUp(void)
+{
+    client.reset();
+    endpoint.withKeepAlive(true);
+    outcome = outcome_t();
+}
+
+void tearDown(void)
+{
+}
+
+void test_unreserved_characters_pass_everywhere() {
+    const char* unreserved = "azAZ09-._~";
+    for (const char* c = unreserved; *c != 0; c++) {
+        TEST_ASSERT_TRUE(UriBuilder::isUnescaped(*c, ucTarget));
+        TEST_ASSERT_TRUE(UriBuilder::isUnescaped(*c, ucSegment));
+        TEST_ASSERT_TRUE(UriBuilder::isUnescaped(*c, ucQuery));
+    }
+    // controls, space, delimiters and everything above ascii are always encoded
+    const char always[] = { 0x01, 0x1F, ' ', '"', '#', '<', '>', '\\', '^', '`', '{', '|', '}', 0x7F, (char)0x80, (char)0xC3 };
+    for (char c : always) {
+        TEST_ASSERT_FALSE(UriBuilder::isUnescaped(c, ucTarget));
+        TEST_ASSERT_FALSE(UriBuilder::isUnescaped(c, ucSegment));
+        TEST_ASSERT_FALSE(UriBuilder::isUnescaped(c, ucQuery));
+    }
+}
+
+void test_delimiters_depend_on_the_component() {
+    // a composed target keeps its structure and existing escapes
+    TEST_ASSERT_TRUE(UriBuilder::isUnescaped('/', ucTarget));
+    TEST_ASSERT_TRUE(UriBuilder::isUnescaped('?', ucTarget));
+    TEST_ASSERT_TRUE(UriBuilder::isUnescaped('&', ucTarget));
+    TEST_ASSERT_TRUE(UriBuilder::isUnescaped('%', ucTarget));
+    TEST_ASSERT_TRUE(UriBuilder::isUnescaped('[', ucTarget));
+    // a segment must not open a new segment or the query
+    TEST_ASSERT_FALSE(UriBuilder::isUnescaped('/', ucSegment));
+    TEST_ASSERT_FALSE(UriBuilder::isUnescaped('?', ucSegment));
+    TEST_ASSERT_FALSE(UriBuilder::isUnescaped('%', ucSegment));
+    TEST_ASSERT_TRUE(UriBuilder::isUnescaped('=', ucSegment));
+    // a query key or value must not start another pair
+    TEST_ASSERT_FALSE(UriBuilder::isUnescaped('&', ucQuery));
+    TEST_ASSERT_FALSE(UriBuilder::isUnescaped('=', ucQuery));
+    TEST_ASSERT_FALSE(UriBuilder::isUnescaped('+', ucQuery));
+    TEST_ASSERT_FALSE(UriBuilder::isUnescaped('%', ucQuery));
+    TEST_ASSERT_TRUE(UriBuilder::isUnescaped('/', ucQuery));
+    TEST_ASSERT_TRUE(UriBuilder::isUnescaped('?', ucQuery));
+}
+
+void test_builds_encoded_paths_and_queries() {
+    char buffer[128];
+    UriBuilder uri(buffer, sizeof(buffer));
+    uri.append("/api").path("a b/c").path("\xC3\xA4").query("q", "a&b=c+d").query("n", -42L);
+    TEST_ASSERT_TRUE(uri.ok());
+    TEST_ASSERT_TRUE(uri.hasQuery());
+    TEST_ASSERT_EQUAL_STRING("/api/a%20b%2Fc/%C3%A4?q=a%26b%3Dc%2Bd&n=-42", uri.c_str());
+    TEST_ASSERT_EQUAL(strlen(uri.c_str()), uri.length());
+
+    uri.reset();
+    uri.append("/search?q=x y#top");
+    TEST_ASSERT_TRUE(uri.hasQuery());
+    TEST_ASSERT_EQUAL_STRING("/search?q=x%20y%23top", uri.c_str());
+    uri.query("page", 2L);
+    TEST_ASSERT_EQUAL_STRING("/search?q=x%20y%23top&page=2", uri.c_str());
+}
+
+void test_formats_the_extremes_of_long() {
+    char buffer[UriBuilder::INTEGER_SIZE];
+    char expected[32];
+    const long values[] = { 0, 7, -7, 4096, LONG_MAX, LONG_MIN };
+    for (long value : values) {
+        snprintf(expected, sizeof(expected), "%ld", value);
+        TEST_ASSERT_EQUAL(strlen(expected), UriBuilder::formatInteger(buffer, value));
+        TEST_ASSERT_EQUAL_STRING(expected, buffer);
+    }
+}
+
+void test_overflow_fails_and_stays_terminated() {
+    char buffer[8];
+    memset(buffer, 'x', sizeof(buffer));
+    UriBuilder uri(buffer, sizeof(buffer));
+    uri.append("/abcdef");
+    // exactly fits with its terminator
+    TEST_ASSERT_TRUE(uri.ok());
+    TEST_ASSERT_EQUAL(7, uri.length());
+    uri.path("g");
+    TEST_ASSERT_FALSE(uri.ok());
+    TEST_ASSERT_EQUAL(7, uri.length());
+    TEST_ASSERT_EQUAL_STRING("/abcdef", uri.c_str());
+    // nothing is appended once failed, even if it would fit
+    uri.reset();
+    uri.append("/a b c");
+    TEST_ASSERT_FALSE(uri.ok());
+    TEST_ASSERT_TRUE(uri.length() < sizeof(buffer));
+    TEST_ASSERT_EQUAL(uri.length(), strlen(uri.c_str()));
+    size_t length = uri.length();
+    uri.query("k", 1L);
+    TEST_ASSERT_EQUAL(length, uri.length());
+    // a builder over existing content continues behind it
+    uri.reset();
+    TEST_ASSERT_TRUE(uri.ok());
+    UriBuilder tail(buffer, sizeof(buffer), 2, false);
+    memcpy(buffer, "/x", 2);
+    tail.path("y");
+    TEST_ASSERT_EQUAL_STRING("/x/y", tail.c_str());
+}
+
+void test_segment_after_the_query_fails() {
+    char buffer[64];
+    UriBuilder uri(buffer, sizeof(buffer));
+    uri.append("/a").query("k", "v").path("b");
+    TEST_ASSERT_FALSE(uri.ok());
+}
+
+void test_request_sends_the_composed_target() {
+    ServiceRequest request;
+    TEST_ASSERT_TRUE(endpoint.get("/firmware", request));
+    track(request).withPathSegment("Tester").withPathSegment("image chunk")
+        .withQuery("start", 0L).withQuery("len", 4096L).withQuery("tag", "a&b")
+        .fire().await();
+    TEST_ASSERT_EQUAL(1, outcome.succeeded);
+    TEST_ASSERT_EQUAL_STRING("/firmware/Tester/image%20chunk?start=0&len=4096&tag=a%26b", target().c_str());
+}
+
+void test_request_with_an_oversized_uri_prefails() {
+    std::string uri = "/";
+    uri.append(FLUENTHTTP_HEAD_BUFFER_SIZE, 'a');
+    ServiceRequest request;
+    endpoint.get(uri.c_str(), request);
+    track(request).fire().await();
+    TEST_ASSERT_EQUAL(1, outcome.failed);
+    TEST_ASSERT_EQUAL_STRING("request uri exceeds FLUENTHTTP_HEAD_BUFFER_SIZE or is malformed", outcome.message.c_str());
+    TEST_ASSERT_EQUAL(0, client.written.size());
+
+    // segments growing past the buffer fail the same way
+    outcome = outcome_t();
+    ServiceRequest grown;
+    TEST_ASSERT_TRUE(endpoint.get("/", grown));
+    std::string segment(64, 's');
+    for (int i = 0; i < FLUENTHTTP_HEAD_BUFFER_SIZE / 64; i++)
+        grown.withPathSegment(segment.c_str());
+    track(grown).fire().await();
+    TEST_ASSERT_EQUAL(1, outcome.failed);
+    TEST_ASSERT_EQUAL(0, client.written.size());
+}
+
+void test_request_with_a_segment_after_the_query_prefails() {
+    ServiceRequest request;
+    TEST_ASSERT_TRUE(endpoint.get("/a", request));
+    track(request).withQuery("k", "v").withPathSegment("b").fire().await();
+    TEST_ASSERT_EQUAL(1, outcome.failed);
+    TEST_ASSERT_EQUAL(0, client.written.size());
+    // the endpoint is free for the next request
+    ServiceRequest next;
+    TEST_ASSERT_TRUE(endpoint.get("/a", next));
+    track(next).fire().await();
+    TEST_ASSERT_EQUAL(1, outcome.succeeded);
+}
+
+int main(int argc, char** argv)
+{
+    installHostArduino(&client);
+    endpoint.begin(&client);
+
+    UNITY_BEGIN();
+    RUN_TEST(test_unreserved_characters_pass_everywhere);
+    RUN_TEST(test_delimiters_depend_on_the_component);
+    RUN_TEST(test_builds_encoded_paths_and_queries);
+    RUN_TEST(test_formats_the_extremes_of_long);
+    RUN_TEST(test_overflow_fails_and_stays_terminated);
+    RUN_TEST(test_segment_after_the_query_fails);
+    RUN_TEST(test_request_sends_the_composed_target);
+    RUN_TEST(test_request_with_an_oversized_uri_prefails);
+    RUN_TEST(test_request_with_a_segment_after_the_query_prefails);
+    return UNITY_END();
+}
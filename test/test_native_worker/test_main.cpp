@@ -0,0 +1,198 @@
+#include <Arduino.h>
+#include <unity.h>
+#include <fluenthttp.h>
+#include <ServiceWorker.h>
+#include <atomic>
+#include <string>
+#include <thread>
+#include "../support/ScriptedClient.h"
+
+// requests driven by a ServiceWorker on its std::thread: callbacks run on the dispatching
+// thread, content larger than the pipe streams through, and several application threads
+// fire and await requests through one worker at the same time
+
+ServiceWorker worker;
+ScriptedClient client;
+ServiceEndpoint endpoint("worker.local");
+
+static std::atomic<int> succeeded{0};
+static std::atomic<int> failed{0};
+static std::atomic<int> timedOut{0};
+static std::thread::id callbackThread;
+static std::string content;
+
+// reads the content with read() only, the pipe is filled by the worker meanwhile
+static std::string readContent(service_response_t& r) {
+    std::string result;
+    uint32_t t0 = millis();
+    while (result.size() < r.contentLength && millis() - t0 < 1000) {
+        int c = r.contentReader->read();
+        if (c < 0) {
+            std::this_thread::yield();
+            continue;
+        }
+        result += (char)c;
+    }
+    return result;
+}
+
+static ServiceRequest& observe(ServiceRequest& request, uint32_t timeout = 1000) {
+    return request.withTimeout(timeout)
+        .onSuccess([](service_response_t r) {
+            callbackThread = std::this_thread::get_id();
+            content = readContent(r);
+            succeeded++;
+        })
+        .onFailure([](service_response_t r) { failed++; })
+        .onTimeout([] { timedOut++; });
+}
+
+void setUp(void)
+{
+    client.reset();
+    client.response = "HTTP/1.1 200 OK\r\nContent-Length: 2\r\n\r\nok";
+    endpoint.withKeepAlive(true);
+    succeeded = failed = timedOut = 0;
+    callbackThread = std::thread::id();
+    content.clear();
+}
+
+void tearDown(void)
+{
+}
+
+void test_callbacks_run_on_the_dispatching_thread() {
+    ServiceRequest request;
+    TEST_ASSERT_TRUE(endpoint.get("/status", request));
+    observe(request).fire();
+    TEST_ASSERT_EQUAL(srsQueued, request.getStatus());
+    request.await();
+    TEST_ASSERT_EQUAL(1, succeeded);
+    TEST_ASSERT_EQUAL(srsCompleted, request.getStatus());
+    TEST_ASSERT_TRUE(callbackThread == std::this_thread::get_id());
+    TEST_ASSERT_EQUAL_STRING("ok", content.c_str());
+    TEST_ASSERT_EQUAL(1, client.requests.size());
+}
+
+void test_content_larger_than_the_pipe_streams_through() {
+    std::string body;
+    for (int i = 0; i < 5000; i++)
+        body += (char)('a' + i % 26);
+    client.response = "HTTP/1.1 200 OK\r\nContent-Length: 5000\r\n\r\n" + body;
+    for (int i = 0; i < 3; i++) {
+        ServiceRequest request;
+        TEST_ASSERT_TRUE(endpoint.get("/firmware", request));
+        observe(request).fire().await();
+        TEST_ASSERT_TRUE(content == body);
+    }
+    TEST_ASSERT_EQUAL(3, succeeded);
+    // the connection is reused, the content was read completely each time
+    TEST_ASSERT_EQUAL(1, client.connects);
+}
+
+void test_content_buffer_is_filled_by_the_worker() {
+    client.response = "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n"
+        "5\r\nfirst\r\n7\r\n,second\r\n0\r\n\r\n";
+    uint8_t buffer[32];
+    ServiceRequest request;
+    TEST_ASSERT_TRUE(endpoint.get("/log", request));
+    request.withTimeout(1000)
+        .withContentBuffer(buffer, sizeof(buffer))
+        .onSuccess([](service_response_t r) {
+            TEST_ASSERT_NULL(r.contentReader);
+            succeeded++;
+        })
+        .fire().await();
+    TEST_ASSERT_EQUAL(1, succeeded);
+    TEST_ASSERT_EQUAL(12, request.contentBuffered());
+    TEST_ASSERT_EQUAL(0, memcmp("first,second", buffer, 12));
+}
+
+void test_timeout_is_reported_by_dispatch() {
+    client.response = "";
+    ServiceRequest request;
+    TEST_ASSERT_TRUE(endpoint.get("/slow", request));
+    observe(request, 50).fire().await();
+    TEST_ASSERT_EQUAL(1, timedOut);
+    TEST_ASSERT_EQUAL(0, succeeded);
+    TEST_ASSERT_EQUAL(srsFailed, request.getStatus());
+    // the lock was given back
+    client.response = "HTTP/1.1 200 OK\r\nContent-Length: 2\r\n\r\nok";
+    ServiceRequest next;
+    TEST_ASSERT_TRUE(endpoint.get("/status", next));
+    observe(next).fire().await();
+    TEST_ASSERT_EQUAL(1, succeeded);
+}
+
+void test_failures_are_reported_by_dispatch() {
+    client.response = "HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\n\r\n";
+    ServiceRequest request;
+    TEST_ASSERT_TRUE(endpoint.get("/missing", request));
+    observe(request).fire().await();
+    TEST_ASSERT_EQUAL(1, failed);
+    TEST_ASSERT_EQUAL(srsFailed, request.getStatus());
+}
+
+// each application thread has its endpoint, all share the worker and dispatch its completions
+void test_threads_share_the_worker() {
+    const int threads = 3;
+    const int requests = 40;
+    ScriptedClient clients[threads];
+    ServiceEndpoint* endpoints[threads];
+    static std::atomic<int> answered{0};
+    answered = 0;
+    for (int t = 0; t < threads; t++) {
+        endpoints[t] = new ServiceEndpoint("worker.local");
+        endpoints[t]->begin(&clients[t]);
+        endpoints[t]->withKeepAlive(true).withWorker(&worker);
+    }
+    std::thread runners[threads];
+    for (int t = 0; t < threads; t++) {
+        runners[t] = std::thread([&, t] {
+            for (int i = 0; i < requests; i++) {
+                ServiceRequest request;
+                if (!endpoints[t]->get("/status", request, 1000)) continue;
+                request.withTimeout(1000)
+                    .onSuccess([](service_response_t r) { answered++; })
+                    .fire().await();
+            }
+        });
+    }
+    for (int t = 0; t < threads; t++)
+        runners[t].join();
+    TEST_ASSERT_EQUAL(threads * requests, answered);
+    for (int t = 0; t < threads; t++) {
+        TEST_ASSERT_EQUAL(requests, clients[t].requests.size());
+        delete endpoints[t];
+    }
+}
+
+void test_end_waits_for_the_worker() {
+    worker.end();
+    TEST_ASSERT_FALSE(worker.running());
+    TEST_ASSERT_TRUE(worker.begin());
+    ServiceRequest request;
+    TEST_ASSERT_TRUE(endpoint.get("/status", request));
+    observe(request).fire().await();
+    TEST_ASSERT_EQUAL(1, succeeded);
+}
+
+int main(int argc, char** argv)
+{
+    installHostArduino(&client);
+    endpoint.begin(&client);
+    endpoint.withWorker(&worker);
+    worker.begin();
+
+    UNITY_BEGIN();
+    RUN_TEST(test_callbacks_run_on_the_dispatching_thread);
+    RUN_TEST(test_content_larger_than_the_pipe_streams_through);
+    RUN_TEST(test_content_buffer_is_filled_by_the_worker);
+    RUN_TEST(test_timeout_is_reported_by_dispatch);
+    RUN_TEST(test_failures_are_reported_by_dispatch);
+    RUN_TEST(test_threads_share_the_worker);
+    RUN_TEST(test_end_waits_for_the_worker);
+    int result = UNITY_END();
+    worker.end();
+    return result;
+}